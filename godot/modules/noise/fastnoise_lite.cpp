@@ -30,6 +30,8 @@
 
 #include "fastnoise_lite.h"
 
+#include "fastnoise_lite_batch.h"
+
 _FastNoiseLite::FractalType FastNoiseLite::_convert_domain_warp_fractal_type_enum(DomainWarpFractalType p_domain_warp_fractal_type) {
 	_FastNoiseLite::FractalType type;
 	switch (p_domain_warp_fractal_type) {
@@ -322,6 +324,69 @@ real_t FastNoiseLite::get_noise_2d(real_t p_x, real_t p_y) const {
 	return _noise.GetNoise(p_x, p_y);
 }
 
+bool FastNoiseLite::_can_batch_noise_2d() const {
+#ifdef REAL_T_IS_DOUBLE
+	// The kernels work on single precision coordinates.
+	return false;
+#else
+	return !domain_warp_enabled && fastnoiselite::FastNoiseLiteBatch::is_vectorized(_noise);
+#endif
+}
+
+void FastNoiseLite::get_noise_2d_points(const Vector2 *p_points, int p_count, real_t *r_values) const {
+	if (!_can_batch_noise_2d()) {
+		for (int i = 0; i < p_count; i++) {
+			r_values[i] = FastNoiseLite::get_noise_2d(p_points[i].x, p_points[i].y);
+		}
+		return;
+	}
+
+	float x[NOISE_BATCH_SIZE];
+	float y[NOISE_BATCH_SIZE];
+	for (int start = 0; start < p_count; start += NOISE_BATCH_SIZE) {
+		const int count = MIN(NOISE_BATCH_SIZE, p_count - start);
+		for (int i = 0; i < count; i++) {
+			x[i] = p_points[start + i].x + offset.x;
+			y[i] = p_points[start + i].y + offset.y;
+		}
+		fastnoiselite::FastNoiseLiteBatch::get_noise_2d(_noise, x, y, count, r_values + start);
+	}
+}
+
+void FastNoiseLite::get_noise_2d_grid(const Vector2 &p_origin, const Vector2 &p_step, const Vector2i &p_count, real_t *r_values, int p_stride) const {
+	if (!_can_batch_noise_2d()) {
+		Noise::get_noise_2d_grid(p_origin, p_step, p_count, r_values, p_stride);
+		return;
+	}
+
+	float x[NOISE_BATCH_SIZE];
+	float y[NOISE_BATCH_SIZE];
+	for (int row = 0; row < p_count.y; row++) {
+		const real_t pos_y = (p_origin.y + p_step.y * row) + offset.y;
+		for (int start = 0; start < p_count.x; start += NOISE_BATCH_SIZE) {
+			const int count = MIN(NOISE_BATCH_SIZE, p_count.x - start);
+			for (int i = 0; i < count; i++) {
+				x[i] = (p_origin.x + p_step.x * (start + i)) + offset.x;
+				y[i] = pos_y;
+			}
+			fastnoiselite::FastNoiseLiteBatch::get_noise_2d(_noise, x, y, count, r_values + row * p_stride + start);
+		}
+	}
+}
+
+real_t FastNoiseLite::get_noise_2dv_with_gradient(Vector2 p_v, Vector2 &r_gradient) const {
+	if (!domain_warp_enabled) {
+		float value;
+		float dx;
+		float dy;
+		if (fastnoiselite::FastNoiseLiteBatch::get_noise_2d_with_gradient(_noise, p_v.x + offset.x, p_v.y + offset.y, value, dx, dy)) {
+			r_gradient = Vector2(dx, dy);
+			return value;
+		}
+	}
+	return Noise::get_noise_2dv_with_gradient(p_v, r_gradient);
+}
+
 real_t FastNoiseLite::get_noise_3dv(Vector3 p_v) const {
 	return get_noise_3d(p_v.x, p_v.y, p_v.z);
 }
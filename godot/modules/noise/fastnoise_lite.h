@@ -96,6 +96,9 @@ protected:
 	void _validate_property(PropertyInfo &p_property) const;
 
 private:
+	// Points are converted in blocks of this size for the batch noise functions.
+	static constexpr int NOISE_BATCH_SIZE = 64;
+
 	_FastNoiseLite _noise;
 	_FastNoiseLite _domain_warp_noise;
 
@@ -131,6 +134,8 @@ private:
 	// This needs manual conversion because Godots Inspector property API does not support discontiguous enum indices.
 	_FastNoiseLite::FractalType _convert_domain_warp_fractal_type_enum(DomainWarpFractalType p_domain_warp_fractal_type);
 
+	bool _can_batch_noise_2d() const;
+
 public:
 	FastNoiseLite();
 	~FastNoiseLite();
@@ -212,6 +217,10 @@ public:
 	real_t get_noise_2dv(Vector2 p_v) const override;
 	real_t get_noise_2d(real_t p_x, real_t p_y) const override;
 
+	void get_noise_2d_points(const Vector2 *p_points, int p_count, real_t *r_values) const override;
+	void get_noise_2d_grid(const Vector2 &p_origin, const Vector2 &p_step, const Vector2i &p_count, real_t *r_values, int p_stride) const override;
+	real_t get_noise_2dv_with_gradient(Vector2 p_v, Vector2 &r_gradient) const override;
+
 	real_t get_noise_3dv(Vector3 p_v) const override;
 	real_t get_noise_3d(real_t p_x, real_t p_y, real_t p_z) const override;
 
@@ -0,0 +1,451 @@
+/**************************************************************************/
+/*  fastnoise_lite_batch.cpp                                              */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             GODOT ENGINE                               */
+/*                        https://godotengine.org                         */
+/**************************************************************************/
+/* Copyright (c) 2014-present Godot Engine contributors (see AUTHORS.md). */
+/* Copyright (c) 2007-2014 Juan Linietsky, Ariel Manzur.                  */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "fastnoise_lite_batch.h"
+
+#include "core/typedefs.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#endif
+
+namespace fastnoiselite {
+
+#ifdef __SSE2__
+
+// Every operation below mirrors the scalar code in FastNoiseLite.h one to one and in the same order,
+// so the results stay bit identical. Branches are evaluated for all lanes and selected afterwards.
+
+struct BatchSettings {
+	int seed = 0;
+	float frequency = 0.0f;
+	bool fbm = false;
+	int octaves = 0;
+	float lacunarity = 0.0f;
+	float gain = 0.0f;
+	float weighted_strength = 0.0f;
+	float fractal_bounding = 0.0f;
+	const float *gradients_2d = nullptr;
+};
+
+static const int PRIME_X = 501125321;
+static const int PRIME_Y = 1136930381;
+
+static _FORCE_INLINE_ __m128i _mullo_epi32(__m128i p_a, __m128i p_b) {
+#ifdef __SSE4_1__
+	return _mm_mullo_epi32(p_a, p_b);
+#else
+	const __m128i even = _mm_mul_epu32(p_a, p_b);
+	const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(p_a, 32), _mm_srli_epi64(p_b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+
+static _FORCE_INLINE_ __m128 _select(__m128 p_mask, __m128 p_a, __m128 p_b) {
+	return _mm_or_ps(_mm_and_ps(p_mask, p_a), _mm_andnot_ps(p_mask, p_b));
+}
+
+static _FORCE_INLINE_ __m128i _select(__m128 p_mask, __m128i p_a, __m128i p_b) {
+	const __m128i mask = _mm_castps_si128(p_mask);
+	return _mm_or_si128(_mm_and_si128(mask, p_a), _mm_andnot_si128(mask, p_b));
+}
+
+// Like FastFloor(), which also subtracts one from negative whole numbers.
+static _FORCE_INLINE_ __m128i _fast_floor(__m128 p_f) {
+	const __m128i truncated = _mm_cvttps_epi32(p_f);
+	return _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmplt_ps(p_f, _mm_setzero_ps())));
+}
+
+static _FORCE_INLINE_ __m128 _grad_coord(const BatchSettings &p_settings, __m128i p_seed, __m128i p_x_primed, __m128i p_y_primed, __m128 p_xd, __m128 p_yd) {
+	__m128i hash = _mm_xor_si128(_mm_xor_si128(p_seed, p_x_primed), p_y_primed);
+	hash = _mullo_epi32(hash, _mm_set1_epi32(0x27d4eb2d));
+	hash = _mm_xor_si128(hash, _mm_srai_epi32(hash, 15));
+	hash = _mm_and_si128(hash, _mm_set1_epi32(127 << 1));
+
+	// No gathers in SSE, the table lookups are done per lane.
+	alignas(16) int32_t indices[4];
+	_mm_store_si128((__m128i *)indices, hash);
+	const float *gradients = p_settings.gradients_2d;
+	const __m128 xg = _mm_setr_ps(gradients[indices[0]], gradients[indices[1]], gradients[indices[2]], gradients[indices[3]]);
+	const __m128 yg = _mm_setr_ps(gradients[indices[0] | 1], gradients[indices[1] | 1], gradients[indices[2] | 1], gradients[indices[3] | 1]);
+
+	return _mm_add_ps(_mm_mul_ps(p_xd, xg), _mm_mul_ps(p_yd, yg));
+}
+
+static _FORCE_INLINE_ __m128 _falloff(__m128 p_x, __m128 p_y) {
+	return _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(2.0f / 3.0f), _mm_mul_ps(p_x, p_x)), _mm_mul_ps(p_y, p_y));
+}
+
+static _FORCE_INLINE_ __m128 _contribution(__m128 p_a, __m128 p_grad) {
+	const __m128 a2 = _mm_mul_ps(p_a, p_a);
+	return _mm_mul_ps(_mm_mul_ps(a2, a2), p_grad);
+}
+
+static __m128 _single_open_simplex_2s(const BatchSettings &p_settings, __m128i p_seed, __m128 p_x, __m128 p_y) {
+	const float SQRT3 = (float)1.7320508075688772935274463415059;
+	const float G2 = (3 - SQRT3) / 6;
+
+	__m128i i = _fast_floor(p_x);
+	__m128i j = _fast_floor(p_y);
+	const __m128 xi = _mm_sub_ps(p_x, _mm_cvtepi32_ps(i));
+	const __m128 yi = _mm_sub_ps(p_y, _mm_cvtepi32_ps(j));
+
+	const __m128i prime_x = _mm_set1_epi32(PRIME_X);
+	const __m128i prime_y = _mm_set1_epi32(PRIME_Y);
+	i = _mullo_epi32(i, prime_x);
+	j = _mullo_epi32(j, prime_y);
+	const __m128i i1 = _mm_add_epi32(i, prime_x);
+	const __m128i j1 = _mm_add_epi32(j, prime_y);
+
+	const __m128 t = _mm_mul_ps(_mm_add_ps(xi, yi), _mm_set1_ps(G2));
+	const __m128 x0 = _mm_sub_ps(xi, t);
+	const __m128 y0 = _mm_sub_ps(yi, t);
+
+	const __m128 a0 = _falloff(x0, y0);
+	__m128 value = _contribution(a0, _grad_coord(p_settings, p_seed, i, j, x0, y0));
+
+	const __m128 a1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps((float)(2 * (1 - 2 * G2) * (1 / G2 - 2))), t), _mm_add_ps(_mm_set1_ps((float)(-2 * (1 - 2 * G2) * (1 - 2 * G2))), a0));
+	const __m128 x1 = _mm_sub_ps(x0, _mm_set1_ps((float)(1 - 2 * G2)));
+	const __m128 y1 = _mm_sub_ps(y0, _mm_set1_ps((float)(1 - 2 * G2)));
+	value = _mm_add_ps(value, _contribution(a1, _grad_coord(p_settings, p_seed, i1, j1, x1, y1)));
+
+	const __m128 xmyi = _mm_sub_ps(xi, yi);
+	const __m128 upper = _mm_cmpgt_ps(t, _mm_set1_ps(G2));
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	// Third point, subtracting a constant gives the same result as adding its negation.
+	{
+		const __m128 xi_plus_xmyi = _mm_add_ps(xi, xmyi);
+		const __m128 upper_far = _mm_cmpgt_ps(xi_plus_xmyi, one);
+		const __m128 lower_far = _mm_cmplt_ps(xi_plus_xmyi, zero);
+
+		const __m128 offset_x = _select(upper,
+				_select(upper_far, _mm_set1_ps((float)(3 * G2 - 2)), _mm_set1_ps((float)G2)),
+				_select(lower_far, _mm_set1_ps((float)(1 - G2)), _mm_set1_ps((float)(G2 - 1))));
+		const __m128 offset_y = _select(upper,
+				_select(upper_far, _mm_set1_ps((float)(3 * G2 - 1)), _mm_set1_ps((float)(G2 - 1))),
+				_select(lower_far, _mm_set1_ps(-(float)G2), _mm_set1_ps((float)G2)));
+		const __m128i cell_x = _select(upper,
+				_select(upper_far, _mm_add_epi32(i, _mm_set1_epi32(PRIME_X << 1)), i),
+				_select(lower_far, _mm_sub_epi32(i, prime_x), _mm_add_epi32(i, prime_x)));
+		const __m128i cell_y = _select(upper, _mm_add_epi32(j, prime_y), j);
+
+		const __m128 x2 = _mm_add_ps(x0, offset_x);
+		const __m128 y2 = _mm_add_ps(y0, offset_y);
+		const __m128 a2 = _falloff(x2, y2);
+		const __m128 added = _mm_add_ps(value, _contribution(a2, _grad_coord(p_settings, p_seed, cell_x, cell_y, x2, y2)));
+		value = _select(_mm_cmpgt_ps(a2, zero), added, value);
+	}
+
+	// Fourth point.
+	{
+		const __m128 upper_far = _mm_cmpgt_ps(_mm_sub_ps(yi, xmyi), one);
+		const __m128 lower_far = _mm_cmplt_ps(yi, xmyi);
+
+		const __m128 offset_x = _select(upper,
+				_select(upper_far, _mm_set1_ps((float)(3 * G2 - 1)), _mm_set1_ps((float)(G2 - 1))),
+				_select(lower_far, _mm_set1_ps(-(float)G2), _mm_set1_ps((float)G2)));
+		const __m128 offset_y = _select(upper,
+				_select(upper_far, _mm_set1_ps((float)(3 * G2 - 2)), _mm_set1_ps((float)G2)),
+				_select(lower_far, _mm_set1_ps(-(float)(G2 - 1)), _mm_set1_ps((float)(G2 - 1))));
+		const __m128i cell_x = _select(upper, _mm_add_epi32(i, prime_x), i);
+		const __m128i cell_y = _select(upper,
+				_select(upper_far, _mm_add_epi32(j, _mm_set1_epi32(PRIME_Y << 1)), j),
+				_select(lower_far, _mm_sub_epi32(j, prime_y), _mm_add_epi32(j, prime_y)));
+
+		const __m128 x3 = _mm_add_ps(x0, offset_x);
+		const __m128 y3 = _mm_add_ps(y0, offset_y);
+		const __m128 a3 = _falloff(x3, y3);
+		const __m128 added = _mm_add_ps(value, _contribution(a3, _grad_coord(p_settings, p_seed, cell_x, cell_y, x3, y3)));
+		value = _select(_mm_cmpgt_ps(a3, zero), added, value);
+	}
+
+	return _mm_mul_ps(value, _mm_set1_ps(18.24196194486065f));
+}
+
+static __m128 _get_noise(const BatchSettings &p_settings, __m128 p_x, __m128 p_y) {
+	// TransformNoiseCoordinate()
+	const float SQRT3 = (float)1.7320508075688772935274463415059;
+	const float F2 = 0.5f * (SQRT3 - 1);
+	__m128 x = _mm_mul_ps(p_x, _mm_set1_ps(p_settings.frequency));
+	__m128 y = _mm_mul_ps(p_y, _mm_set1_ps(p_settings.frequency));
+	const __m128 t = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+	x = _mm_add_ps(x, t);
+	y = _mm_add_ps(y, t);
+
+	if (!p_settings.fbm) {
+		return _single_open_simplex_2s(p_settings, _mm_set1_epi32(p_settings.seed), x, y);
+	}
+
+	// GenFractalFBm()
+	int seed = p_settings.seed;
+	__m128 sum = _mm_setzero_ps();
+	__m128 amp = _mm_set1_ps(p_settings.fractal_bounding);
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (int i = 0; i < p_settings.octaves; i++) {
+		const __m128 noise = _single_open_simplex_2s(p_settings, _mm_set1_epi32(seed++), x, y);
+		sum = _mm_add_ps(sum, _mm_mul_ps(noise, amp));
+		const __m128 weight = _mm_mul_ps(_mm_min_ps(_mm_add_ps(noise, one), _mm_set1_ps(2.0f)), _mm_set1_ps(0.5f));
+		amp = _mm_mul_ps(amp, _mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(p_settings.weighted_strength), _mm_sub_ps(weight, one))));
+
+		x = _mm_mul_ps(x, _mm_set1_ps(p_settings.lacunarity));
+		y = _mm_mul_ps(y, _mm_set1_ps(p_settings.lacunarity));
+		amp = _mm_mul_ps(amp, _mm_set1_ps(p_settings.gain));
+	}
+	return sum;
+}
+
+#endif // __SSE2__
+
+bool FastNoiseLiteBatch::is_vectorized(const FastNoiseLite &p_noise) {
+#ifdef __SSE2__
+	return p_noise.mNoiseType == FastNoiseLite::NoiseType_OpenSimplex2S && (p_noise.mFractalType == FastNoiseLite::FractalType_None || p_noise.mFractalType == FastNoiseLite::FractalType_FBm);
+#else
+	return false;
+#endif
+}
+
+void FastNoiseLiteBatch::get_noise_2d(const FastNoiseLite &p_noise, const float *p_x, const float *p_y, int p_count, float *r_values) {
+	int i = 0;
+#ifdef __SSE2__
+	if (is_vectorized(p_noise)) {
+		BatchSettings settings;
+		settings.seed = p_noise.mSeed;
+		settings.frequency = p_noise.mFrequency;
+		settings.fbm = p_noise.mFractalType == FastNoiseLite::FractalType_FBm;
+		settings.octaves = p_noise.mOctaves;
+		settings.lacunarity = p_noise.mLacunarity;
+		settings.gain = p_noise.mGain;
+		settings.weighted_strength = p_noise.mWeightedStrength;
+		settings.fractal_bounding = p_noise.mFractalBounding;
+		settings.gradients_2d = FastNoiseLite::Lookup<float>::Gradients2D;
+
+		for (; i + 4 <= p_count; i += 4) {
+			_mm_storeu_ps(r_values + i, _get_noise(settings, _mm_loadu_ps(p_x + i), _mm_loadu_ps(p_y + i)));
+		}
+		if (i < p_count) {
+			// Pad the last few points so they go through the same kernel.
+			alignas(16) float x[4] = {};
+			alignas(16) float y[4] = {};
+			alignas(16) float values[4];
+			const int remaining = p_count - i;
+			for (int j = 0; j < remaining; j++) {
+				x[j] = p_x[i + j];
+				y[j] = p_y[i + j];
+			}
+			_mm_store_ps(values, _get_noise(settings, _mm_load_ps(x), _mm_load_ps(y)));
+			for (int j = 0; j < remaining; j++) {
+				r_values[i + j] = values[j];
+			}
+			i = p_count;
+		}
+	}
+#endif
+	for (; i < p_count; i++) {
+		r_values[i] = p_noise.GetNoise(p_x[i], p_y[i]);
+	}
+}
+
+float FastNoiseLiteBatch::_single_open_simplex_2s_with_gradient(const FastNoiseLite &p_noise, int p_seed, float p_x, float p_y, float &r_dx, float &r_dy) {
+	const int PrimeX = FastNoiseLite::PrimeX;
+	const int PrimeY = FastNoiseLite::PrimeY;
+	const float SQRT3 = (float)1.7320508075688772935274463415059;
+	const float G2 = (3 - SQRT3) / 6;
+
+	int i = FastNoiseLite::FastFloor(p_x);
+	int j = FastNoiseLite::FastFloor(p_y);
+	float xi = (float)(p_x - i);
+	float yi = (float)(p_y - j);
+
+	i *= PrimeX;
+	j *= PrimeY;
+
+	float t = (xi + yi) * (float)G2;
+	float x0 = xi - t;
+	float y0 = yi - t;
+
+	// Every point contributes a^4 * dot(gradient, offset) with a = 2/3 - |offset|^2, all offsets move with (x0, y0).
+	float value = 0.0f;
+	float dx0 = 0.0f;
+	float dy0 = 0.0f;
+	const auto add_point = [&](float p_xd, float p_yd, int p_x_primed, int p_y_primed) {
+		const float a = (2.0f / 3.0f) - p_xd * p_xd - p_yd * p_yd;
+		int hash = FastNoiseLite::Hash(p_seed, p_x_primed, p_y_primed);
+		hash ^= hash >> 15;
+		hash &= 127 << 1;
+		const float xg = FastNoiseLite::Lookup<float>::Gradients2D[hash];
+		const float yg = FastNoiseLite::Lookup<float>::Gradients2D[hash | 1];
+		const float dot = p_xd * xg + p_yd * yg;
+		const float a2 = a * a;
+		const float a4 = a2 * a2;
+		value += a4 * dot;
+		const float da = -8.0f * a2 * a * dot;
+		dx0 += da * p_xd + a4 * xg;
+		dy0 += da * p_yd + a4 * yg;
+	};
+	const auto falloff = [](float p_xd, float p_yd) {
+		return (2.0f / 3.0f) - p_xd * p_xd - p_yd * p_yd;
+	};
+
+	add_point(x0, y0, i, j);
+	add_point(x0 - (float)(1 - 2 * G2), y0 - (float)(1 - 2 * G2), i + PrimeX, j + PrimeY);
+
+	// Same point selection as SingleOpenSimplex2S().
+	float xmyi = xi - yi;
+	if (t > G2) {
+		if (xi + xmyi > 1) {
+			float x2 = x0 + (float)(3 * G2 - 2);
+			float y2 = y0 + (float)(3 * G2 - 1);
+			if (falloff(x2, y2) > 0) {
+				add_point(x2, y2, i + (PrimeX << 1), j + PrimeY);
+			}
+		} else {
+			float x2 = x0 + (float)G2;
+			float y2 = y0 + (float)(G2 - 1);
+			if (falloff(x2, y2) > 0) {
+				add_point(x2, y2, i, j + PrimeY);
+			}
+		}
+
+		if (yi - xmyi > 1) {
+			float x3 = x0 + (float)(3 * G2 - 1);
+			float y3 = y0 + (float)(3 * G2 - 2);
+			if (falloff(x3, y3) > 0) {
+				add_point(x3, y3, i + PrimeX, j + (PrimeY << 1));
+			}
+		} else {
+			float x3 = x0 + (float)(G2 - 1);
+			float y3 = y0 + (float)G2;
+			if (falloff(x3, y3) > 0) {
+				add_point(x3, y3, i + PrimeX, j);
+			}
+		}
+	} else {
+		if (xi + xmyi < 0) {
+			float x2 = x0 + (float)(1 - G2);
+			float y2 = y0 - (float)G2;
+			if (falloff(x2, y2) > 0) {
+				add_point(x2, y2, i - PrimeX, j);
+			}
+		} else {
+			float x2 = x0 + (float)(G2 - 1);
+			float y2 = y0 + (float)G2;
+			if (falloff(x2, y2) > 0) {
+				add_point(x2, y2, i + PrimeX, j);
+			}
+		}
+
+		if (yi < xmyi) {
+			float x2 = x0 - (float)G2;
+			float y2 = y0 - (float)(G2 - 1);
+			if (falloff(x2, y2) > 0) {
+				add_point(x2, y2, i, j - PrimeY);
+			}
+		} else {
+			float x2 = x0 + (float)G2;
+			float y2 = y0 + (float)(G2 - 1);
+			if (falloff(x2, y2) > 0) {
+				add_point(x2, y2, i, j + PrimeY);
+			}
+		}
+	}
+
+	// (x0, y0) = (xi, yi) - (xi + yi) * G2
+	const float scale = 18.24196194486065f;
+	r_dx = (dx0 * (1 - G2) - dy0 * G2) * scale;
+	r_dy = (dy0 * (1 - G2) - dx0 * G2) * scale;
+	return value * scale;
+}
+
+bool FastNoiseLiteBatch::get_noise_2d_with_gradient(const FastNoiseLite &p_noise, float p_x, float p_y, float &r_value, float &r_dx, float &r_dy) {
+	if (p_noise.mNoiseType != FastNoiseLite::NoiseType_OpenSimplex2S || (p_noise.mFractalType != FastNoiseLite::FractalType_None && p_noise.mFractalType != FastNoiseLite::FractalType_FBm)) {
+		return false;
+	}
+
+	// TransformNoiseCoordinate()
+	const float SQRT3 = (float)1.7320508075688772935274463415059;
+	const float F2 = 0.5f * (SQRT3 - 1);
+	float x = p_x * p_noise.mFrequency;
+	float y = p_y * p_noise.mFrequency;
+	const float t = (x + y) * F2;
+	x += t;
+	y += t;
+
+	// Gradient in skewed space first.
+	float dx = 0.0f;
+	float dy = 0.0f;
+	if (p_noise.mFractalType == FastNoiseLite::FractalType_None) {
+		r_value = _single_open_simplex_2s_with_gradient(p_noise, p_noise.mSeed, x, y, dx, dy);
+	} else {
+		// GenFractalFBm(), the amplitude depends on the previous octave when weighted strength is used.
+		int seed = p_noise.mSeed;
+		float sum = 0.0f;
+		float amp = p_noise.mFractalBounding;
+		float amp_dx = 0.0f;
+		float amp_dy = 0.0f;
+		float frequency_scale = 1.0f;
+		for (int i = 0; i < p_noise.mOctaves; i++) {
+			float noise_dx;
+			float noise_dy;
+			const float noise = _single_open_simplex_2s_with_gradient(p_noise, seed++, x, y, noise_dx, noise_dy);
+			noise_dx *= frequency_scale;
+			noise_dy *= frequency_scale;
+
+			sum += noise * amp;
+			dx += noise_dx * amp + noise * amp_dx;
+			dy += noise_dy * amp + noise * amp_dy;
+
+			const bool clamped = noise + 1 >= 2;
+			const float weight = FastNoiseLite::Lerp(1.0f, FastNoiseLite::FastMin(noise + 1, 2) * 0.5f, p_noise.mWeightedStrength);
+			const float weight_dx = clamped ? 0.0f : p_noise.mWeightedStrength * 0.5f * noise_dx;
+			const float weight_dy = clamped ? 0.0f : p_noise.mWeightedStrength * 0.5f * noise_dy;
+			amp_dx = (amp_dx * weight + amp * weight_dx) * p_noise.mGain;
+			amp_dy = (amp_dy * weight + amp * weight_dy) * p_noise.mGain;
+			amp *= weight;
+
+			x *= p_noise.mLacunarity;
+			y *= p_noise.mLacunarity;
+			frequency_scale *= p_noise.mLacunarity;
+			amp *= p_noise.mGain;
+		}
+		r_value = sum;
+	}
+
+	// Back through the skew and the frequency.
+	r_dx = p_noise.mFrequency * ((1 + F2) * dx + F2 * dy);
+	r_dy = p_noise.mFrequency * (F2 * dx + (1 + F2) * dy);
+	return true;
+}
+
+} //namespace fastnoiselite
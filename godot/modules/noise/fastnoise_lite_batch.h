@@ -0,0 +1,55 @@
+/**************************************************************************/
+/*  fastnoise_lite_batch.h                                                */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             GODOT ENGINE                               */
+/*                        https://godotengine.org                         */
+/**************************************************************************/
+/* Copyright (c) 2014-present Godot Engine contributors (see AUTHORS.md). */
+/* Copyright (c) 2007-2014 Juan Linietsky, Ariel Manzur.                  */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef FASTNOISE_LITE_BATCH_H
+#define FASTNOISE_LITE_BATCH_H
+
+#include <thirdparty/noise/FastNoiseLite.h>
+
+namespace fastnoiselite {
+
+// Evaluates 2D noise for many points at once, giving exactly the same values as FastNoiseLite::GetNoise().
+// OpenSimplex2S with no fractal or FBm goes through SIMD kernels when they are available, everything else
+// is evaluated one point at a time.
+class FastNoiseLiteBatch {
+	static float _single_open_simplex_2s_with_gradient(const FastNoiseLite &p_noise, int p_seed, float p_x, float p_y, float &r_dx, float &r_dy);
+
+public:
+	static bool is_vectorized(const FastNoiseLite &p_noise);
+	static void get_noise_2d(const FastNoiseLite &p_noise, const float *p_x, const float *p_y, int p_count, float *r_values);
+
+	// Noise value together with its analytic gradient, for the same settings the SIMD kernels cover.
+	// Returns false for anything else.
+	static bool get_noise_2d_with_gradient(const FastNoiseLite &p_noise, float p_x, float p_y, float &r_value, float &r_dx, float &r_dy);
+};
+
+} //namespace fastnoiselite
+
+#endif // FASTNOISE_LITE_BATCH_H
@@ -164,6 +164,29 @@ Vector<Ref<Image>> Noise::_get_image(int p_width, int p_height, int p_depth, boo
 	return images;
 }
 
+void Noise::get_noise_2d_points(const Vector2 *p_points, int p_count, real_t *r_values) const {
+	for (int i = 0; i < p_count; i++) {
+		r_values[i] = get_noise_2d(p_points[i].x, p_points[i].y);
+	}
+}
+
+void Noise::get_noise_2d_grid(const Vector2 &p_origin, const Vector2 &p_step, const Vector2i &p_count, real_t *r_values, int p_stride) const {
+	for (int y = 0; y < p_count.y; y++) {
+		const real_t pos_y = p_origin.y + p_step.y * y;
+		real_t *row = r_values + y * p_stride;
+		for (int x = 0; x < p_count.x; x++) {
+			row[x] = get_noise_2d(p_origin.x + p_step.x * x, pos_y);
+		}
+	}
+}
+
+real_t Noise::get_noise_2dv_with_gradient(Vector2 p_v, Vector2 &r_gradient) const {
+	const real_t eps = 0.01;
+	r_gradient.x = (get_noise_2d(p_v.x + eps, p_v.y) - get_noise_2d(p_v.x - eps, p_v.y)) / (2.0 * eps);
+	r_gradient.y = (get_noise_2d(p_v.x, p_v.y + eps) - get_noise_2d(p_v.x, p_v.y - eps)) / (2.0 * eps);
+	return get_noise_2d(p_v.x, p_v.y);
+}
+
 Ref<Image> Noise::get_image(int p_width, int p_height, bool p_invert, bool p_in_3d_space, bool p_normalize) const {
 	Vector<Ref<Image>> images = _get_image(p_width, p_height, 1, p_invert, p_in_3d_space, p_normalize);
 	if (images.is_empty()) {
@@ -290,6 +290,13 @@ public:
 	virtual real_t get_noise_3dv(Vector3 p_v) const = 0;
 	virtual real_t get_noise_3d(real_t p_x, real_t p_y, real_t p_z) const = 0;
 
+	// Batch versions of get_noise_2d(), they give the same values as calling it for every point.
+	virtual void get_noise_2d_points(const Vector2 *p_points, int p_count, real_t *r_values) const;
+	// Samples p_origin + p_step * (x, y) for every x and y in p_count, rows are p_stride values apart in r_values.
+	virtual void get_noise_2d_grid(const Vector2 &p_origin, const Vector2 &p_step, const Vector2i &p_count, real_t *r_values, int p_stride) const;
+	// Noise value and its gradient, uses central differences unless the noise has an analytic version.
+	virtual real_t get_noise_2dv_with_gradient(Vector2 p_v, Vector2 &r_gradient) const;
+
 	Vector<Ref<Image>> _get_image(int p_width, int p_height, int p_depth, bool p_invert = false, bool p_in_3d_space = false, bool p_normalize = true) const;
 	virtual Ref<Image> get_image(int p_width, int p_height, bool p_invert = false, bool p_in_3d_space = false, bool p_normalize = true) const;
 	virtual TypedArray<Image> get_image_3d(int p_width, int p_height, int p_depth, bool p_invert = false, bool p_normalize = true) const;
@@ -577,6 +577,86 @@ TEST_CASE("[FastNoiseLite] Domain warp") {
 	}
 }
 
+TEST_CASE("[FastNoiseLite] Batch noise generation") {
+	FastNoiseLite noise;
+	noise.set_offset(Vector3(10, 20, 0));
+	noise.set_frequency(0.05);
+
+	// Odd counts so the last points don't fill a whole SIMD register.
+	const Vector2 origin = Vector2(-13.7, 42.1);
+	const Vector2 step = Vector2(0.9, 1.3);
+	const Vector2i count = Vector2i(37, 5);
+
+	Vector<Vector2> points;
+	for (int i = 0; i < 103; i++) {
+		points.push_back(Vector2(i * 7.3 - 300.0, i * -2.9 + 15.0));
+	}
+
+	const auto check_batches = [&]() {
+		Vector<real_t> point_values;
+		point_values.resize(points.size());
+		noise.get_noise_2d_points(points.ptr(), points.size(), point_values.ptrw());
+		for (int i = 0; i < points.size(); i++) {
+			CHECK(point_values[i] == noise.get_noise_2d(points[i].x, points[i].y));
+		}
+
+		Vector<real_t> grid_values;
+		grid_values.resize(count.x * count.y);
+		noise.get_noise_2d_grid(origin, step, count, grid_values.ptrw(), count.x);
+		for (int y = 0; y < count.y; y++) {
+			for (int x = 0; x < count.x; x++) {
+				CHECK(grid_values[y * count.x + x] == noise.get_noise_2d(origin.x + step.x * x, origin.y + step.y * y));
+			}
+		}
+	};
+
+	SUBCASE("Batches should match single points for OpenSimplex2S without fractal") {
+		noise.set_noise_type(FastNoiseLite::NoiseType::TYPE_SIMPLEX_SMOOTH);
+		noise.set_fractal_type(FastNoiseLite::FractalType::FRACTAL_NONE);
+		check_batches();
+	}
+
+	SUBCASE("Batches should match single points for OpenSimplex2S with FBM") {
+		noise.set_noise_type(FastNoiseLite::NoiseType::TYPE_SIMPLEX_SMOOTH);
+		noise.set_fractal_type(FastNoiseLite::FractalType::FRACTAL_FBM);
+		noise.set_fractal_weighted_strength(0.5);
+		check_batches();
+	}
+
+	SUBCASE("Batches should match single points for other noise types") {
+		noise.set_noise_type(FastNoiseLite::NoiseType::TYPE_CELLULAR);
+		check_batches();
+		noise.set_noise_type(FastNoiseLite::NoiseType::TYPE_SIMPLEX_SMOOTH);
+		noise.set_domain_warp_enabled(true);
+		check_batches();
+	}
+}
+
+TEST_CASE("[FastNoiseLite] Noise gradient") {
+	FastNoiseLite noise;
+	noise.set_noise_type(FastNoiseLite::NoiseType::TYPE_SIMPLEX_SMOOTH);
+	noise.set_offset(Vector3(10, 20, 0));
+	noise.set_frequency(0.05);
+	noise.set_fractal_type(FastNoiseLite::FractalType::FRACTAL_FBM);
+	noise.set_fractal_weighted_strength(0.5);
+
+	SUBCASE("Analytic gradient should match central differences") {
+		const real_t eps = 0.001;
+		for (int i = 0; i < 32; i++) {
+			const Vector2 point = Vector2(i * 3.7 - 50.0, i * -1.3 + 20.0);
+			Vector2 gradient;
+			const real_t value = noise.get_noise_2dv_with_gradient(point, gradient);
+			const Vector2 expected = Vector2(
+					noise.get_noise_2d(point.x + eps, point.y) - noise.get_noise_2d(point.x - eps, point.y),
+					noise.get_noise_2d(point.x, point.y + eps) - noise.get_noise_2d(point.x, point.y - eps)) /
+					(2.0 * eps);
+			CHECK(value == doctest::Approx(noise.get_noise_2dv(point)).epsilon(0.0001));
+			CHECK(gradient.x == doctest::Approx(expected.x).epsilon(0.01));
+			CHECK(gradient.y == doctest::Approx(expected.y).epsilon(0.01));
+		}
+	}
+}
+
 // Raw image data for the reference images used in the regression tests.
 // Generated with the following code:
 //     for (int y = 0; y < img->get_data().size(); y++) {
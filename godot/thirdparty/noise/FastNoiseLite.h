@@ -56,6 +56,8 @@ namespace fastnoiselite {
 
 class FastNoiseLite
 {
+    friend class FastNoiseLiteBatch;
+
 public:
     enum NoiseType
     {
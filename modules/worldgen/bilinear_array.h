@@ -2,6 +2,8 @@
 #define BILINEAR_ARRAY_H
 
 #include "core/error/error_macros.h"
+#include "core/io/file_access.h"
+#include "core/math/rect2.h"
 #include "core/object/class_db.h"
 #include "core/object/ref_counted.h"
 #include "core/string/print_string.h"
@@ -56,6 +58,14 @@ public:
         return data;
     };
 
+    const float *ptr() const {
+        return data.ptr();
+    }
+
+    float *ptrw() {
+        return data.ptr();
+    }
+
     static Ref<BilinearVector> create(Vector<float> p_data, int p_dimension) {
         Ref<BilinearVector> heightmap;
         heightmap.instantiate();
@@ -82,42 +92,179 @@ public:
     }
 };
 
-class WorldBoundBilinearArray : public RefCounted {
-    Ref<BilinearVector> bilinear_array;
+// Heightmap over a world rect, texels sit on a corner aligned grid so neighbouring chunks share their edges.
+// Heights are rounded to 16 bit multiples of a power of two step given by the layer, the same for all of its
+// chunks, and stored in 8x8 tiles so the four texels of a bilinear sample are almost always in the same 128 bytes.
+class TiledHeightmap {
+    static constexpr int TILE_SHIFT = 3;
+    static constexpr int TILE_SIZE = 1 << TILE_SHIFT;
+    static constexpr int TILE_MASK = TILE_SIZE - 1;
 
-    float pixel_size;
-    float half_pixel_size;
+    LocalVector<uint16_t> data;
+    int dimension = 0;
+    int tiles_per_row = 0;
+    // height = height_offset + quantised * height_scale, the scale is a power of two and the offset a multiple of it
+    float height_offset = 0.0f;
+    float height_scale = 0.0f;
     Rect2 bounds;
+    Vector2 texels_per_unit;
+
+    _FORCE_INLINE_ uint32_t get_texel_index(int p_x, int p_y) const {
+        const uint32_t tile = (p_y >> TILE_SHIFT) * tiles_per_row + (p_x >> TILE_SHIFT);
+        return (tile << (2 * TILE_SHIFT)) | ((p_y & TILE_MASK) << TILE_SHIFT) | (p_x & TILE_MASK);
+    }
+
+    _FORCE_INLINE_ float decode(uint16_t p_value) const {
+        return height_offset + p_value * height_scale;
+    }
+
+    void resize(int p_dimension, const Rect2 &p_bounds) {
+        dimension = p_dimension;
+        tiles_per_row = (p_dimension + TILE_MASK) >> TILE_SHIFT;
+        data.resize(tiles_per_row * tiles_per_row * TILE_SIZE * TILE_SIZE);
+        bounds = p_bounds;
+        texels_per_unit = Vector2(dimension - 1, dimension - 1) / bounds.size;
+    }
 
-    _FORCE_INLINE_ Vector2 remap_uv(const Vector2 &p_world_position) const {
-        const Vector2 bounds_end = bounds.get_end();
-        Vector2 remapped_uv;
-        remapped_uv.x = Math::remap(p_world_position.x, bounds.position.x, bounds_end.x, 0.0f, 1.0f);
-        remapped_uv.y = Math::remap(p_world_position.y, bounds.position.y, bounds_end.y, 0.0f, 1.0f);
-        remapped_uv *= 1.0 - pixel_size;
-        remapped_uv += Vector2(half_pixel_size, half_pixel_size);
-        return remapped_uv * bilinear_array->get_dimension();
+    // Corner texel and the position inside of it, clamped to the edges instead of branching
+    _FORCE_INLINE_ void get_sample_texel(const Vector2 &p_world_position, Vector2i &r_texel, Vector2 &r_fraction) const {
+        const float last = dimension - 1;
+        const Vector2 texel_position = ((p_world_position - bounds.position) * texels_per_unit).clampf(0.0f, last);
+        r_texel.x = MIN((int)texel_position.x, dimension - 2);
+        r_texel.y = MIN((int)texel_position.y, dimension - 2);
+        r_fraction = texel_position - Vector2(r_texel);
     }
+
 public:
-    static Ref<WorldBoundBilinearArray> create(int p_dimension, Rect2 p_bounds) {
-        Ref<WorldBoundBilinearArray> out;
-        out.instantiate();
+    // Smallest quantisation step, gives up to 256 units of height range
+    static constexpr float MIN_HEIGHT_STEP = 1.0f / 256.0f;
+
+    // Finest power of two step that fits every height between p_min_height and p_max_height into 16 bits
+    static float get_height_step(float p_min_height, float p_max_height) {
+        float height_step = MIN_HEIGHT_STEP;
+        // One step of slack on either end for rounding
+        while (Math::ceil((double)p_max_height / height_step) - Math::floor((double)p_min_height / height_step) + 2.0 > UINT16_MAX) {
+            height_step *= 2.0f;
+        }
+        return height_step;
+    }
+
+    // Quantises row major heights into the tiled layout. Heights snap to a global grid of p_height_step steps,
+    // so chunks sharing the step decode shared or copied texels to the exact same heights and copying them is lossless
+    void create(const float *p_heights, int p_dimension, const Rect2 &p_bounds, float p_height_step) {
+        ERR_FAIL_COND(p_dimension < 2);
+        resize(p_dimension, p_bounds);
+
+        float min_height = p_heights[0];
+        for (int i = 1; i < dimension * dimension; i++) {
+            min_height = MIN(min_height, p_heights[i]);
+        }
+
+        height_scale = p_height_step;
+        const double inv_height_scale = 1.0 / height_scale;
+        const int64_t base = (int64_t)Math::floor(min_height * inv_height_scale);
+        height_offset = base * height_scale;
+
+        for (int y = 0; y < dimension; y++) {
+            const float *row = p_heights + y * dimension;
+            for (int x = 0; x < dimension; x++) {
+                const int64_t quantised = (int64_t)Math::round(row[x] * inv_height_scale) - base;
+                data[get_texel_index(x, y)] = (uint16_t)CLAMP(quantised, (int64_t)0, (int64_t)UINT16_MAX);
+            }
+        }
+    }
+
+    bool is_empty() const {
+        return data.is_empty();
+    }
 
-        out->bilinear_array = BilinearVector::create_xy(p_dimension);
+    int get_dimension() const {
+        return dimension;
+    }
+
+    float get_height_step() const {
+        return height_scale;
+    }
+
+    float get_texel(int p_x, int p_y) const {
+        return decode(data[get_texel_index(p_x, p_y)]);
+    }
+
+    // Decodes a whole row of texels into r_heights
+    void get_row(int p_y, float *r_heights) const {
+        for (int x = 0; x < dimension; x++) {
+            r_heights[x] = get_texel(x, p_y);
+        }
+    }
+
+    float sample(const Vector2 &p_world_position) const {
+        Vector2i texel;
+        Vector2 fraction;
+        get_sample_texel(p_world_position, texel, fraction);
+
+        const float top = Math::lerp(get_texel(texel.x, texel.y), get_texel(texel.x + 1, texel.y), fraction.x);
+        const float bottom = Math::lerp(get_texel(texel.x, texel.y + 1), get_texel(texel.x + 1, texel.y + 1), fraction.x);
+        return Math::lerp(top, bottom, fraction.y);
+    }
+
+    // Height and its gradient in world units, from the same four texels
+    float sample_with_gradient(const Vector2 &p_world_position, Vector2 &r_gradient) const {
+        Vector2i texel;
+        Vector2 fraction;
+        get_sample_texel(p_world_position, texel, fraction);
+
+        const float top_x0 = get_texel(texel.x, texel.y);
+        const float top_x1 = get_texel(texel.x + 1, texel.y);
+        const float bottom_x0 = get_texel(texel.x, texel.y + 1);
+        const float bottom_x1 = get_texel(texel.x + 1, texel.y + 1);
+        const float top = Math::lerp(top_x0, top_x1, fraction.x);
+        const float bottom = Math::lerp(bottom_x0, bottom_x1, fraction.x);
+
+        r_gradient.x = Math::lerp(top_x1 - top_x0, bottom_x1 - bottom_x0, fraction.y) * texels_per_unit.x;
+        r_gradient.y = (bottom - top) * texels_per_unit.y;
+        return Math::lerp(top, bottom, fraction.y);
+    }
+
+    void sample_batch(const Vector2 *p_world_positions, int p_count, float *r_values) const {
+        for (int i = 0; i < p_count; i++) {
+            r_values[i] = sample(p_world_positions[i]);
+        }
+    }
+
+    // Samples a grid of p_count points starting at p_origin, rows are written p_row_stride floats apart
+    void sample_grid(const Vector2 &p_origin, const Vector2 &p_step, const Vector2i &p_count, float *r_values, int p_row_stride) const {
+        for (int y = 0; y < p_count.y; y++) {
+            float *row = r_values + y * p_row_stride;
+            for (int x = 0; x < p_count.x; x++) {
+                row[x] = sample(p_origin + p_step * Vector2(x, y));
+            }
+        }
+    }
 
-        out->pixel_size = 1.0 / (float)p_dimension;
-        out->half_pixel_size = 0.5 / (float)p_dimension;
-        out->bounds = p_bounds;
-        return out;
+    uint64_t get_memory_usage() const {
+        return data.size() * sizeof(uint16_t);
     }
 
-    float sample(Vector2 p_world_position) const {
-        ERR_FAIL_COND_V_MSG(!bounds.has_point(p_world_position), 0.0f, "Tried to sample out of bounds");
-        return bilinear_array->sample(remap_uv(p_world_position));
+    void save(const Ref<FileAccess> &p_file) const {
+        p_file->store_32(dimension);
+        p_file->store_float(height_offset);
+        p_file->store_float(height_scale);
+        p_file->store_buffer((const uint8_t *)data.ptr(), data.size() * sizeof(uint16_t));
     }
 
-    void set_pixel(Vector2i p_pixel, float p_value) {
-        bilinear_array->set_pixel(p_pixel, p_value);
+    // Fails if the file holds a heightmap of any other dimension than p_dimension, checked before anything is allocated
+    bool load(const Ref<FileAccess> &p_file, int p_dimension, const Rect2 &p_bounds) {
+        ERR_FAIL_COND_V(p_dimension < 2, false);
+        const int file_dimension = p_file->get_32();
+        if (file_dimension != p_dimension) {
+            return false;
+        }
+        resize(file_dimension, p_bounds);
+        height_offset = p_file->get_float();
+        height_scale = p_file->get_float();
+        // Stored in the same tiled layout, so it can be read straight in
+        const uint64_t data_size = data.size() * sizeof(uint16_t);
+        return p_file->get_buffer((uint8_t *)data.ptr(), data_size) == data_size;
     }
 };
 
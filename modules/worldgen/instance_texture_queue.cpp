@@ -52,6 +52,10 @@ int InstanceTextureQueue::get_texture_dimensions() const {
     return texture_dimensions;
 }
 
+int InstanceTextureQueue::get_available_count() const {
+    return available_uniform_indices.size();
+}
+
 int InstanceTextureHandle::get_idx() const {
     return idx;
 }
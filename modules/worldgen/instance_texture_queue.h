@@ -31,6 +31,7 @@ public:
     void release_idx(int p_idx);
     Ref<Texture2DArray> get_texture() const;
     int get_texture_dimensions() const;
+    int get_available_count() const;
 };
 
 class InstanceTextureHandle : public RefCounted {
@@ -35,10 +35,23 @@ void BiomeGeneratorSettings::_bind_methods() {
 
 }
 
+uint32_t BiomeVoronoiTriangulationLayer::get_settings_hash() const {
+    uint32_t hash = ChunkDiskCache::hash_resource(ResourceLoader::load(GLOBAL_GET("kgame/terrain/biome_settings")));
+    hash = hash_murmur3_one_float(get_chunk_size(), hash);
+    hash = hash_murmur3_one_32((int)GLOBAL_GET("kgame/terrain/biome_weight_map_resolution"), hash);
+    return hash_murmur3_one_float(get_chunk_padding(), hash);
+}
+
+void BiomeVoronoiTriangulationLayer::get_settings_resources(LocalVector<Ref<Resource>> &r_resources) const {
+    r_resources.push_back(ResourceLoader::load(GLOBAL_GET("kgame/terrain/biome_settings")));
+}
+
 Ref<ChunkerChunk> BiomeVoronoiTriangulationLayer::create_chunk(int p_lod_level) const {
     Ref<BiomeVoronoiTriangulationChunk> chunk;
-    chunk.instantiate();
+    chunk.instantiate(get_weight_map_dimensions(), get_settings_snapshot("kgame/terrain/biome_settings"));
     chunk->layer = const_cast<BiomeVoronoiTriangulationLayer*>(this);
     chunk->point_layer = points_layer;
+    chunk->biome_index_texture_handle = biome_index_texture_queue->get_available_handle();
+    chunk->biome_weight_texture_handle = biome_weight_texture_queue->get_available_handle();
     return chunk;
 }
@@ -3,16 +3,22 @@
 
 #include "core/config/project_settings.h"
 #include "core/error/error_macros.h"
+#include "core/io/image.h"
 #include "core/math/geometry_2d.h"
 #include "core/math/random_number_generator.h"
 #include "core/math/rect2.h"
 #include "core/object/ref_counted.h"
 #include "core/string/print_string.h"
+#include "core/templates/hash_set.h"
 #include "core/templates/hashfuncs.h"
 #include "core/variant/typed_array.h"
 #include "core/variant/variant.h"
+#include "build_scratch.h"
 #include "layer_manager.h"
 #include "modules/noise/fastnoise_lite.h"
+#include "servers/rendering_server.h"
+#include "worldgen/instance_texture_queue.h"
+#include "worldgen/thirdparty/taskflow/algorithm/for_each.hpp"
 #include "worldgen/thirdparty/taskflow/core/taskflow.hpp"
 #include "worldgen/voronoi.h"
 
@@ -26,16 +32,28 @@ protected:
     static void _bind_methods();
 public:
     float get_height_multiplier() const { return height_multiplier; }
-    void set_height_multiplier(float p_height_multiplier) { height_multiplier = p_height_multiplier; }
+    void set_height_multiplier(float p_height_multiplier) {
+        height_multiplier = p_height_multiplier;
+        emit_changed();
+    }
 
     float get_reference_height() const { return reference_height; }
-    void set_reference_height(float p_reference_height) { reference_height = p_reference_height; }
+    void set_reference_height(float p_reference_height) {
+        reference_height = p_reference_height;
+        emit_changed();
+    }
 
     Ref<FastNoiseLite> get_noise() const { return noise; }
-    void set_noise(Ref<FastNoiseLite> p_noise) { noise = p_noise; }
+    void set_noise(Ref<FastNoiseLite> p_noise) {
+        noise = p_noise;
+        emit_changed();
+    }
 
     Rect2 get_selector_rect() const { return selector_rect; }
-    void set_selector_rect(const Rect2 &p_selector_rect) { selector_rect = p_selector_rect; }
+    void set_selector_rect(const Rect2 &p_selector_rect) {
+        selector_rect = p_selector_rect;
+        emit_changed();
+    }
 };
 
 class BiomeGeneratorSettings : public Resource {
@@ -50,10 +68,16 @@ protected:
 
 public:
     Ref<Noise> get_x_noise() const { return x_noise; }
-    void set_x_noise(Ref<Noise> p_x_noise) { x_noise = p_x_noise; }
+    void set_x_noise(Ref<Noise> p_x_noise) {
+        x_noise = p_x_noise;
+        emit_changed();
+    }
 
     Ref<Noise> get_y_noise() const { return y_noise; }
-    void set_y_noise(Ref<Noise> p_y_noise) { y_noise = p_y_noise; }
+    void set_y_noise(Ref<Noise> p_y_noise) {
+        y_noise = p_y_noise;
+        emit_changed();
+    }
     TypedArray<BiomeSettings> get_biomes_bind() const {
         TypedArray<BiomeSettings> out;
         for (Ref<BiomeSettings> biome : biomes) {
@@ -61,11 +85,16 @@ public:
         }
         return out;
     }
+    // Weight maps store biome indices in 8 bits
+    static constexpr int MAX_BIOMES = UINT8_MAX;
+
     void set_biomes_bind(TypedArray<BiomeSettings> p_biomes) {
+        ERR_FAIL_COND_MSG(p_biomes.size() > MAX_BIOMES, vformat("Biome weight maps only support up to %d biomes.", MAX_BIOMES));
         biomes.clear();
         for (Ref<BiomeSettings> biome : p_biomes) {
             biomes.push_back(biome);
         }
+        emit_changed();
     }
 
     Vector<Ref<BiomeSettings>> get_biomes() const {
@@ -100,14 +129,18 @@ public:
     LocalVector<Vector2> get_grid_points() const {
         return grid_points;
     }
+
+    virtual uint64_t get_memory_usage() const override {
+        return grid_points.size() * sizeof(Vector2);
+    }
 };
 
 class BiomeVoronoiPointsLayer : public ChunkerLayer {
 public:
     PackedVector2Array get_points_in_rect(Rect2 p_rect) const {
         PackedVector2Array out;
-        for (const KeyValue<Vector2i, Ref<ChunkerChunk>> &kv : loaded_chunks) {
-            Ref<BiomeVoronoiPointsChunk> chunk = kv.value;
+        for (const KeyValue<Vector2i, Ref<ChunkerChunk>> &kv : get_chunks_snapshot()) {
+            const BiomeVoronoiPointsChunk *chunk = static_cast<const BiomeVoronoiPointsChunk *>(kv.value.ptr());
             if (chunk->get_bounds().intersects(p_rect, true)) {
                 for (const Vector2 &pos : chunk->get_grid_points()) {
                     out.push_back(pos);
@@ -120,6 +153,10 @@ public:
         return 2048.0f;
     }
 
+    virtual uint32_t get_settings_hash() const override {
+        return hash_murmur3_one_float(get_chunk_size());
+    }
+
     virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const override {
         Ref<BiomeVoronoiPointsChunk> chunk;
         chunk.instantiate();
@@ -131,9 +168,36 @@ class BiomeVoronoiTriangulationChunk;
 
 class BiomeVoronoiTriangulationLayer : public ChunkerLayer {
     Ref<BiomeVoronoiPointsLayer> points_layer;
+    // Weight maps are the same size at every LOD, so both arrays are shared by all of them
+    Ref<InstanceTextureQueue> biome_index_texture_queue;
+    Ref<InstanceTextureQueue> biome_weight_texture_queue;
+
+    static Ref<InstanceTextureQueue> create_texture_queue(const StringName &p_uniform_name, int p_texture_count, int p_dimensions) {
+        RenderingServer::get_singleton()->global_shader_parameter_add(p_uniform_name, RenderingServer::GLOBAL_VAR_TYPE_SAMPLER2DARRAY, Variant());
+        Ref<InstanceTextureQueue> texture_queue;
+        texture_queue.instantiate(InstanceTextureQueue::InstanceTextureQueueCreateParams {
+            .texture_count = p_texture_count,
+            .texture_dimensions = Vector2i(p_dimensions, p_dimensions),
+            .format = Image::FORMAT_RGBA8,
+            .uses_global_uniform = true,
+            .uniform_name = p_uniform_name
+        });
+        return texture_queue;
+    }
 public:
     BiomeVoronoiTriangulationLayer(Ref<BiomeVoronoiPointsLayer> p_points_layer) {
         points_layer = p_points_layer;
+        const int texture_count = GLOBAL_GET("kgame/terrain/biome_weight_map_texture_count");
+        const int dimensions = get_weight_map_dimensions();
+        biome_index_texture_queue = create_texture_queue(SNAME("terrain_biome_indices"), texture_count, dimensions);
+        biome_weight_texture_queue = create_texture_queue(SNAME("terrain_biome_weights"), texture_count, dimensions);
+    }
+    // Resolution counts intervals, like the heightmap
+    static int get_weight_map_dimensions() {
+        return MAX(2, (int)GLOBAL_GET("kgame/terrain/biome_weight_map_resolution") + 1);
+    }
+    virtual bool has_room_for_chunk(int p_lod_level) const override {
+        return biome_index_texture_queue->get_available_count() > 0 && biome_weight_texture_queue->get_available_count() > 0;
     }
     virtual float get_chunk_size() const override {
         return 2048.0f;
@@ -141,32 +205,150 @@ public:
     virtual float get_chunk_padding() const override {
         return 1024.0f;
     }
+    virtual uint32_t get_settings_hash() const override;
+    virtual void get_settings_resources(LocalVector<Ref<Resource>> &r_resources) const override;
     virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const override;
 };
 
 class BiomeVoronoiTriangulationChunk : public ChunkerChunk {
     BiomeVoronoiTriangulationLayer* layer;
     Ref<BiomeVoronoiPointsLayer> point_layer;
+    // Slots in the global biome index and weight texture arrays, for blending biome materials in the terrain shader
+    Ref<InstanceTextureHandle> biome_index_texture_handle;
+    Ref<InstanceTextureHandle> biome_weight_texture_handle;
     Ref<BiomeGeneratorSettings> biome_settings;
     Ref<VoronoiGraph> graph;
     struct VoronoiTriangle {
         Rect2 bounds;
         int sites[3];
+        Vector2 points[3];
     };
-    HashMap<Vector3i, VoronoiTriangle> triangles;
+    LocalVector<VoronoiTriangle> triangles;
+
+    // Uniform grid over the triangles, each cell lists the triangles whose bounds touch it.
+    // Stored as offsets into a flat index list, cell i goes from grid_cell_offsets[i] to grid_cell_offsets[i+1]
+    Rect2 grid_bounds;
+    Vector2i grid_size;
+    Vector2 grid_cell_size_inv;
+    LocalVector<uint32_t> grid_cell_offsets;
+    LocalVector<uint32_t> grid_triangle_indices;
     
     struct SiteBiomeInformation {
         Ref<BiomeSettings> biome;
+        uint8_t biome_index = 0;
     };
     LocalVector<SiteBiomeInformation> site_biome_infos;
+    LocalVector<Ref<BiomeSettings>> biomes;
+
 public:
-    BiomeVoronoiTriangulationChunk() {
-        biome_settings = ResourceLoader::load(GLOBAL_GET("kgame/terrain/biome_settings"));
+    // How many biomes a weight map texel keeps
+    static constexpr int WEIGHT_MAP_BIOMES = 3;
+    // Bilinear sampling mixes four texels
+    static constexpr int MAX_SAMPLED_BIOMES = 4 * WEIGHT_MAP_BIOMES;
+
+    struct BiomeWeights {
+        int count = 0;
+        uint8_t biomes[MAX_SAMPLED_BIOMES];
+        float weights[MAX_SAMPLED_BIOMES];
+    };
+
+private:
+    // Biome indices and their squared, normalised weights, unused slots have a weight of 0.
+    // Laid out so it can go straight into two RGBA8 images
+    struct WeightMapTexel {
+        uint8_t biomes[4];
+        uint8_t weights[4];
+    };
+    // Texels sit on a corner aligned grid over the chunk bounds, like the heightmap samples
+    int weight_map_dimensions = 0;
+    LocalVector<WeightMapTexel> weight_map;
+
+    const VoronoiTriangle *find_triangle(const Vector2 &p_point, float r_weights[3]) const {
+        if (triangles.is_empty()) {
+            return nullptr;
+        }
+
+        const Vector2i cell = get_grid_cell(p_point);
+        const uint32_t cell_idx = cell.y * grid_size.x + cell.x;
+        for (uint32_t i = grid_cell_offsets[cell_idx]; i < grid_cell_offsets[cell_idx + 1]; i++) {
+            const VoronoiTriangle &triangle = triangles[grid_triangle_indices[i]];
+            const Vector2 bounds_end = triangle.bounds.get_end();
+            if (p_point.x < triangle.bounds.position.x || p_point.y < triangle.bounds.position.y || p_point.x > bounds_end.x || p_point.y > bounds_end.y) {
+                continue;
+            }
+
+            if (!Geometry2D::is_point_in_triangle(p_point, triangle.points[0], triangle.points[1], triangle.points[2])) {
+                continue;
+            }
+            barycentric(p_point, triangle.points[0], triangle.points[1], triangle.points[2], r_weights[0], r_weights[1], r_weights[2]);
+            return &triangle;
+        }
+        return nullptr;
+    }
+
+    void rasterize_weight_map_texel(const Vector2 &p_point, WeightMapTexel &r_texel) const {
+        r_texel = {};
+        float weights[3];
+        const VoronoiTriangle *triangle = find_triangle(p_point, weights);
+        if (!triangle) {
+            return;
+        }
+
+        float weights_pow2[3];
+        float total_weights = 0.0f;
+        for (int i = 0; i < 3; i++) {
+            weights_pow2[i] = weights[i] * weights[i];
+            total_weights += weights_pow2[i];
+        }
+
+        // Sites of a triangle can share a biome, those end up in the same slot
+        int slot_count = 0;
+        float slot_weights[WEIGHT_MAP_BIOMES] = {};
+        for (int i = 0; i < 3; i++) {
+            const uint8_t biome_index = site_biome_infos[triangle->sites[i]].biome_index;
+            int slot = 0;
+            while (slot < slot_count && r_texel.biomes[slot] != biome_index) {
+                slot++;
+            }
+            if (slot == slot_count) {
+                r_texel.biomes[slot_count++] = biome_index;
+            }
+            slot_weights[slot] += weights_pow2[i] / total_weights;
+        }
+
+        // Rounding can leave us a bit off, the biggest weight takes the difference so the texel still adds up to 255
+        int total_quantized = 0;
+        int largest_slot = 0;
+        for (int i = 0; i < slot_count; i++) {
+            r_texel.weights[i] = (uint8_t)CLAMP(Math::round(slot_weights[i] * 255.0f), 0.0f, 255.0f);
+            total_quantized += r_texel.weights[i];
+            if (slot_weights[i] > slot_weights[largest_slot]) {
+                largest_slot = i;
+            }
+        }
+        r_texel.weights[largest_slot] = (uint8_t)CLAMP(r_texel.weights[largest_slot] + 255 - total_quantized, 0, 255);
+    }
+
+    Ref<Image> create_weight_map_image(bool p_weights) const {
+        Vector<uint8_t> data;
+        data.resize(weight_map.size() * 4);
+        uint8_t *data_ptrw = data.ptrw();
+        for (uint32_t i = 0; i < weight_map.size(); i++) {
+            memcpy(data_ptrw + i * 4, p_weights ? weight_map[i].weights : weight_map[i].biomes, 4);
+        }
+        return Image::create_from_data(weight_map_dimensions, weight_map_dimensions, false, Image::FORMAT_RGBA8, data);
+    }
+
+public:
+    BiomeVoronoiTriangulationChunk(int p_weight_map_dimensions, Ref<BiomeGeneratorSettings> p_biome_settings) {
+        biome_settings = p_biome_settings;
+        weight_map_dimensions = p_weight_map_dimensions;
     }
     virtual void build(tf::Taskflow &p_taskflow) {
-        p_taskflow.emplace([&]() {
+        tf::Task voronoi_task = p_taskflow.emplace([&]() {
             Rect2 rect = bounds.grow(layer->get_chunk_padding()*2.0f);
             graph = VoronoiGraph::create(point_layer->get_points_in_rect(rect));
+            HashSet<Vector3i> found_triangles;
             for (int i = 0; i < graph->get_site_count(); i++) {
                 Vector<PackedInt32Array> triangles_idx = graph->get_site_triangles(i);
                 for (int t = 0; t < triangles_idx.size(); t++) {
@@ -177,40 +359,71 @@ public:
                     };
                     std::sort(triangle_sites.begin(), triangle_sites.end());
 
-                    if (triangles.has(Vector3i(triangle_sites[0], triangle_sites[1], triangle_sites[2]))) {
+                    const Vector3i triangle_key = Vector3i(triangle_sites[0], triangle_sites[1], triangle_sites[2]);
+                    if (found_triangles.has(triangle_key)) {
                         continue;
                     }
+                    found_triangles.insert(triangle_key);
 
-                    Rect2 triangle_rect = Rect2(graph->get_site_position(triangle_sites[0]), Vector2());
-                    triangle_rect.expand_to(graph->get_site_position(triangle_sites[1]));
-                    triangle_rect.expand_to(graph->get_site_position(triangle_sites[2]));
+                    const Vector2 points[3] = {
+                        graph->get_site_position(triangle_sites[0]),
+                        graph->get_site_position(triangle_sites[1]),
+                        graph->get_site_position(triangle_sites[2])
+                    };
+                    Rect2 triangle_rect = Rect2(points[0], Vector2());
+                    triangle_rect.expand_to(points[1]);
+                    triangle_rect.expand_to(points[2]);
 
-                    triangles.insert(Vector3i(triangle_sites[0], triangle_sites[1], triangle_sites[2]), {
+                    triangles.push_back({
                         .bounds = triangle_rect,
                         .sites = {
                             triangle_sites[0],
                             triangle_sites[1],
                             triangle_sites[2]
                         },
+                        .points = {
+                            points[0],
+                            points[1],
+                            points[2]
+                        },
                     });
                 }
             }
 
             site_biome_infos.resize(graph->get_site_count());
             SiteBiomeInformation *site_biome_infos_ptrw = site_biome_infos.ptr();
-            Ref<FastNoiseLite> x_noise = biome_settings->get_x_noise();
-            Ref<FastNoiseLite> y_noise = biome_settings->get_y_noise();
-            Vector<Ref<BiomeSettings>> biomes = biome_settings->get_biomes();
+            biomes.clear();
+            for (const Ref<BiomeSettings> &biome : biome_settings->get_biomes()) {
+                biomes.push_back(biome);
+            }
+            // set_biomes_bind() keeps the count in range, the rest of the build has to run either way
+            DEV_ASSERT(biomes.size() <= BiomeGeneratorSettings::MAX_BIOMES);
+
+            BuildScratch<Vector2> site_positions;
+            site_positions->resize(site_biome_infos.size());
+            for (uint32_t i = 0; i < site_positions->size(); i++) {
+                (*site_positions)[i] = graph->get_site_position(i);
+            }
+            BuildScratch<real_t> x_selection_scratch;
+            BuildScratch<real_t> y_selection_scratch;
+            LocalVector<real_t> &x_selection = *x_selection_scratch;
+            LocalVector<real_t> &y_selection = *y_selection_scratch;
+            x_selection.resize(site_positions->size());
+            y_selection.resize(site_positions->size());
+            biome_settings->get_x_noise()->get_noise_2d_points(site_positions->ptr(), site_positions->size(), x_selection.ptr());
+            biome_settings->get_y_noise()->get_noise_2d_points(site_positions->ptr(), site_positions->size(), y_selection.ptr());
+
             for (size_t i = 0; i < site_biome_infos.size(); i++) {
-                const Vector2 site_position = graph->get_site_position(i);
-                const float biome_selection_point_x = x_noise->get_noise_2dv(site_position) * 0.5f + 0.5f;
-                const float biome_selection_point_y = y_noise->get_noise_2dv(site_position) * 0.5f + 0.5f;
+                const float biome_selection_point_x = x_selection[i] * 0.5f + 0.5f;
+                const float biome_selection_point_y = y_selection[i] * 0.5f + 0.5f;
 
                 Ref<BiomeSettings> biome;
+                uint8_t biome_index = 0;
 
-                for (Ref<BiomeSettings> b : biomes) {
-                    if (b->get_selector_rect().has_point(Vector2(biome_selection_point_x, biome_selection_point_y))) {
-                        biome = b;
+                for (uint32_t b = 0; b < biomes.size(); b++) {
+                    if (biomes[b]->get_selector_rect().has_point(Vector2(biome_selection_point_x, biome_selection_point_y))) {
+                        biome = biomes[b];
+                        biome_index = b;
                         break;
                     }
                 }
@@ -218,17 +431,83 @@ public:
                 DEV_ASSERT(biome.is_valid());
 
                 site_biome_infos_ptrw[i] = {
-                    .biome = biome
+                    .biome = biome,
+                    .biome_index = biome_index
                 };
             }
+
+            build_triangle_grid();
+            weight_map.resize(weight_map_dimensions * weight_map_dimensions);
         }).name("Build voronoi diagram");
+
+        tf::Task weight_map_task = p_taskflow.for_each_index(0, weight_map_dimensions, 1, [&](int y) {
+            WeightMapTexel *row = weight_map.ptr() + y * weight_map_dimensions;
+            for (int x = 0; x < weight_map_dimensions; x++) {
+                const Vector2 progress = Vector2(x, y) / Vector2(weight_map_dimensions - 1, weight_map_dimensions - 1);
+                rasterize_weight_map_texel(bounds.position + progress * bounds.size, row[x]);
+            }
+        }).name("Rasterize biome weight map");
+        tf::Task upload_task = p_taskflow.emplace([&]() {
+            biome_index_texture_handle->upload_image(create_weight_map_image(false));
+            biome_weight_texture_handle->upload_image(create_weight_map_image(true));
+        }).name("Upload biome weight map to the GPU");
+        voronoi_task.precede(weight_map_task);
+        weight_map_task.precede(upload_task);
+    }
+
+    _FORCE_INLINE_ Vector2i get_grid_cell(const Vector2 &p_point) const {
+        const Vector2 cell = ((p_point - grid_bounds.position) * grid_cell_size_inv).floor();
+        return Vector2i(CLAMP((int)cell.x, 0, grid_size.x - 1), CLAMP((int)cell.y, 0, grid_size.y - 1));
+    }
+
+    void build_triangle_grid() {
+        grid_bounds = Rect2();
+        for (uint32_t i = 0; i < triangles.size(); i++) {
+            grid_bounds = i == 0 ? triangles[i].bounds : grid_bounds.merge(triangles[i].bounds);
+        }
+
+        // Around one triangle per cell
+        const int cells_per_axis = CLAMP((int)Math::ceil(Math::sqrt((float)triangles.size())), 1, 256);
+        grid_size = Vector2i(cells_per_axis, cells_per_axis);
+        grid_cell_size_inv.x = grid_bounds.size.x > 0.0f ? grid_size.x / grid_bounds.size.x : 0.0f;
+        grid_cell_size_inv.y = grid_bounds.size.y > 0.0f ? grid_size.y / grid_bounds.size.y : 0.0f;
+
+        // Count first so the index list can be laid out contiguously
+        grid_cell_offsets.resize(grid_size.x * grid_size.y + 1);
+        for (uint32_t &offset : grid_cell_offsets) {
+            offset = 0;
+        }
+        for (const VoronoiTriangle &triangle : triangles) {
+            const Vector2i start = get_grid_cell(triangle.bounds.position);
+            const Vector2i end = get_grid_cell(triangle.bounds.get_end());
+            for (int y = start.y; y <= end.y; y++) {
+                for (int x = start.x; x <= end.x; x++) {
+                    grid_cell_offsets[y * grid_size.x + x + 1]++;
+                }
+            }
+        }
+        for (uint32_t i = 1; i < grid_cell_offsets.size(); i++) {
+            grid_cell_offsets[i] += grid_cell_offsets[i - 1];
+        }
+
+        grid_triangle_indices.resize(grid_cell_offsets[grid_cell_offsets.size() - 1]);
+        LocalVector<uint32_t> cell_cursors = grid_cell_offsets;
+        for (uint32_t i = 0; i < triangles.size(); i++) {
+            const Vector2i start = get_grid_cell(triangles[i].bounds.position);
+            const Vector2i end = get_grid_cell(triangles[i].bounds.get_end());
+            for (int y = start.y; y <= end.y; y++) {
+                for (int x = start.x; x <= end.x; x++) {
+                    grid_triangle_indices[cell_cursors[y * grid_size.x + x]++] = i;
+                }
+            }
+        }
     }
     struct BiomeInterpInfo {
         Ref<BiomeSettings> biome;
         float weight = 0.0f;
     };
 
-    void barycentric(Vector2 p_p, Vector2 p_a, Vector2 p_b, Vector2 p_c, float &r_u, float &r_v, float &r_w) {
+    static void barycentric(Vector2 p_p, Vector2 p_a, Vector2 p_b, Vector2 p_c, float &r_u, float &r_v, float &r_w) {
         Vector2 v0 = p_b - p_a;
         Vector2 v1 = p_c - p_a;
         Vector2 v2 = p_p - p_a;
@@ -239,35 +518,106 @@ public:
     }
 
 
-    bool get_biomes_at_point(Vector2 p_point, BiomeInterpInfo r_intep_info[3]) {
-        for (const KeyValue<Vector3i, VoronoiTriangle> &kv : triangles) {
-            /*if (!kv.value.bounds.has_point(p_point)) {
-                continue;
-            }*/
+    virtual uint64_t get_memory_usage() const override {
+        uint64_t memory_usage = triangles.size() * sizeof(VoronoiTriangle);
+        memory_usage += (grid_cell_offsets.size() + grid_triangle_indices.size()) * sizeof(uint32_t);
+        memory_usage += site_biome_infos.size() * sizeof(SiteBiomeInformation);
+        memory_usage += weight_map.size() * sizeof(WeightMapTexel);
+        // The slots in the texture arrays we hold
+        if (biome_index_texture_handle.is_valid()) {
+            memory_usage += Image::get_image_data_size(weight_map_dimensions, weight_map_dimensions, Image::FORMAT_RGBA8, false);
+        }
+        if (biome_weight_texture_handle.is_valid()) {
+            memory_usage += Image::get_image_data_size(weight_map_dimensions, weight_map_dimensions, Image::FORMAT_RGBA8, false);
+        }
+        if (graph.is_valid()) {
+            memory_usage += graph->get_memory_usage();
+        }
+        return memory_usage;
+    }
 
-            Vector2 site_positions[3] = {
-                graph->get_site_position(kv.value.sites[0]),
-                graph->get_site_position(kv.value.sites[1]),
-                graph->get_site_position(kv.value.sites[2])
+    virtual void unload() override {
+        // Give the texture slots back right away, the chunk itself might live a bit longer in a snapshot
+        biome_index_texture_handle.unref();
+        biome_weight_texture_handle.unref();
+    }
+
+    bool get_biomes_at_point(Vector2 p_point, BiomeInterpInfo r_intep_info[3]) const {
+        float weights[3];
+        const VoronoiTriangle *triangle = find_triangle(p_point, weights);
+        if (!triangle) {
+            return false;
+        }
+        for (int j = 0; j < 3; j++) {
+            r_intep_info[j] = {
+                .biome = site_biome_infos[triangle->sites[j]].biome,
+                .weight = weights[j]
             };
+        }
+        return true;
+    }
 
-            if (!Geometry2D::is_point_in_triangle(p_point, site_positions[0], site_positions[1], site_positions[2])) {
-                continue;
-            }
-            float weights[3];
-            barycentric(p_point, site_positions[0], site_positions[1], site_positions[2], weights[0], weights[1], weights[2]);
+    // Bilinearly filtered weight map lookup, weights are already squared and add up to 1
+    void sample_biome_weights(const Vector2 &p_point, BiomeWeights &r_weights) const {
+        r_weights.count = 0;
+        if (weight_map.is_empty()) {
+            return;
+        }
 
-            for (int i = 0; i < 3; i++) {
-                r_intep_info[i] = {
-                    .biome = site_biome_infos[kv.value.sites[i]].biome,
-                    .weight = weights[i]
-                };
+        const int last = weight_map_dimensions - 1;
+        const Vector2 texel_pos = ((p_point - bounds.position) / bounds.size * last).clampf(0.0f, last);
+        const int x0 = MIN((int)texel_pos.x, last - 1);
+        const int y0 = MIN((int)texel_pos.y, last - 1);
+        const Vector2 frac = texel_pos - Vector2(x0, y0);
+        const float corner_weights[4] = {
+            (1.0f - frac.x) * (1.0f - frac.y),
+            frac.x * (1.0f - frac.y),
+            (1.0f - frac.x) * frac.y,
+            frac.x * frac.y
+        };
+        const WeightMapTexel *corners[4] = {
+            &weight_map[y0 * weight_map_dimensions + x0],
+            &weight_map[y0 * weight_map_dimensions + x0 + 1],
+            &weight_map[(y0 + 1) * weight_map_dimensions + x0],
+            &weight_map[(y0 + 1) * weight_map_dimensions + x0 + 1]
+        };
+
+        float total_weights = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            for (int s = 0; s < WEIGHT_MAP_BIOMES; s++) {
+                if (corners[c]->weights[s] == 0 || corner_weights[c] == 0.0f) {
+                    continue;
+                }
+                const float weight = corner_weights[c] * corners[c]->weights[s];
+                int i = 0;
+                while (i < r_weights.count && r_weights.biomes[i] != corners[c]->biomes[s]) {
+                    i++;
+                }
+                if (i == r_weights.count) {
+                    r_weights.biomes[r_weights.count] = corners[c]->biomes[s];
+                    r_weights.weights[r_weights.count++] = 0.0f;
+                }
+                r_weights.weights[i] += weight;
+                total_weights += weight;
             }
+        }
 
-            return true;
+        // Texels outside the triangulation have no weights, renormalise so they don't pull the result down
+        for (int i = 0; i < r_weights.count; i++) {
+            r_weights.weights[i] /= total_weights;
         }
+    }
 
-        return false;
+    const BiomeSettings *get_biome(int p_biome_index) const {
+        return biomes[p_biome_index].ptr();
+    }
+
+    // The RGB channels of the index texture hold the biome indices and the matching channels of the weight texture their weights
+    Ref<InstanceTextureHandle> get_biome_index_texture_handle() const {
+        return biome_index_texture_handle;
+    }
+    Ref<InstanceTextureHandle> get_biome_weight_texture_handle() const {
+        return biome_weight_texture_handle;
     }
 
     friend class BiomeVoronoiTriangulationLayer;
@@ -0,0 +1,78 @@
+#ifndef BUILD_SCRATCH_H
+#define BUILD_SCRATCH_H
+
+#include "core/os/memory.h"
+#include "core/templates/local_vector.h"
+
+// Working memory for chunk builds. Every thread keeps a small pool of buffers per type, so borrowing one
+// never takes a lock and its capacity carries over to the next build. Only the final result of a build
+// should end up in the chunk.
+template <typename T>
+class BuildScratch {
+    // Anything bigger than this is freed instead of going back into the pool
+    static constexpr uint64_t MAX_POOLED_BYTES = 16 * 1024 * 1024;
+    static constexpr uint32_t MAX_POOLED_BUFFERS = 16;
+
+    struct Pool {
+        LocalVector<LocalVector<T> *> buffers;
+        ~Pool() {
+            for (LocalVector<T> *buffer : buffers) {
+                memdelete(buffer);
+            }
+        }
+    };
+
+    static Pool &get_pool() {
+        static thread_local Pool pool;
+        return pool;
+    }
+
+    LocalVector<T> *buffer = nullptr;
+
+public:
+    // For buffers handed from one task to the next, they can be released on any thread
+    static LocalVector<T> *borrow() {
+        Pool &pool = get_pool();
+        if (pool.buffers.is_empty()) {
+            return memnew(LocalVector<T>);
+        }
+        LocalVector<T> *pooled = pool.buffers[pool.buffers.size() - 1];
+        pool.buffers.remove_at(pool.buffers.size() - 1);
+        return pooled;
+    }
+
+    static void release(LocalVector<T> *p_buffer) {
+        if (!p_buffer) {
+            return;
+        }
+        // clear() keeps the capacity
+        p_buffer->clear();
+        Pool &pool = get_pool();
+        if (pool.buffers.size() >= MAX_POOLED_BUFFERS || p_buffer->get_capacity() * sizeof(T) > MAX_POOLED_BYTES) {
+            memdelete(p_buffer);
+            return;
+        }
+        pool.buffers.push_back(p_buffer);
+    }
+
+    LocalVector<T> &operator*() {
+        return *buffer;
+    }
+
+    LocalVector<T> *operator->() {
+        return buffer;
+    }
+
+    BuildScratch() {
+        buffer = borrow();
+    }
+
+    ~BuildScratch() {
+        release(buffer);
+    }
+
+    BuildScratch(const BuildScratch &) = delete;
+    BuildScratch &operator=(const BuildScratch &) = delete;
+};
+
+#endif // BUILD_SCRATCH_H
@@ -0,0 +1,97 @@
+#ifndef CHUNK_BUILD_TIMER_H
+#define CHUNK_BUILD_TIMER_H
+
+#include "core/os/os.h"
+#include "core/os/rw_lock.h"
+#include "core/templates/hash_map.h"
+#include "core/templates/local_vector.h"
+#include "worldgen/thirdparty/taskflow/core/observer.hpp"
+#include "worldgen/thirdparty/taskflow/core/taskflow.hpp"
+#include <atomic>
+
+// Adds up the time workers spend inside the tasks of a chunk's taskflow. Workers run other tasks while they
+// wait (corun), those get taken out again so a chunk is only charged for its own work.
+// Tasks spawned from inside a chunk task (parallel loop partitions) don't belong to any taskflow, they are
+// charged to the chunk of whatever task the worker was running when it picked them up, if any
+class ChunkBuildTimer : public tf::ObserverInterface {
+    struct Frame {
+        uint64_t start_usec = 0;
+        // Time of nested tasks that belong to someone else
+        uint64_t foreign_usec = 0;
+        std::atomic<uint64_t> *owner = nullptr;
+    };
+
+    static LocalVector<Frame> &get_frames() {
+        static thread_local LocalVector<Frame> frames;
+        return frames;
+    }
+
+    mutable RWLock owners_lock;
+    HashMap<size_t, std::atomic<uint64_t> *> task_owners;
+
+    std::atomic<uint64_t> *find_owner(const tf::TaskView &p_task) const {
+        RWLockRead lock(owners_lock);
+        std::atomic<uint64_t> *const *owner = task_owners.getptr(p_task.hash_value());
+        return owner ? *owner : nullptr;
+    }
+
+public:
+    // Time spent in the tasks of p_taskflow gets added to r_time_usec, until untrack() is called
+    void track(const tf::Taskflow &p_taskflow, std::atomic<uint64_t> *r_time_usec) {
+        RWLockWrite lock(owners_lock);
+        p_taskflow.for_each_task([&](tf::Task p_task) {
+            task_owners.insert(p_task.hash_value(), r_time_usec);
+        });
+    }
+
+    void untrack(const tf::Taskflow &p_taskflow) {
+        RWLockWrite lock(owners_lock);
+        p_taskflow.for_each_task([&](tf::Task p_task) {
+            task_owners.erase(p_task.hash_value());
+        });
+    }
+
+    // For tasks that don't belong to any chunk but may run while a chunk task waits, like the chunk builds themselves
+    static void detach_current_task() {
+        LocalVector<Frame> &frames = get_frames();
+        if (!frames.is_empty()) {
+            frames[frames.size() - 1].owner = nullptr;
+        }
+    }
+
+    virtual void set_up(size_t p_worker_count) override {}
+
+    virtual void on_entry(tf::WorkerView p_worker, tf::TaskView p_task) override {
+        LocalVector<Frame> &frames = get_frames();
+        Frame frame;
+        frame.owner = find_owner(p_task);
+        if (!frame.owner && !frames.is_empty()) {
+            frame.owner = frames[frames.size() - 1].owner;
+        }
+        frame.start_usec = OS::get_singleton()->get_ticks_usec();
+        frames.push_back(frame);
+    }
+
+    virtual void on_exit(tf::WorkerView p_worker, tf::TaskView p_task) override {
+        LocalVector<Frame> &frames = get_frames();
+        ERR_FAIL_COND(frames.is_empty());
+        const Frame frame = frames[frames.size() - 1];
+        frames.remove_at(frames.size() - 1);
+        const uint64_t elapsed_usec = OS::get_singleton()->get_ticks_usec() - frame.start_usec;
+
+        Frame *parent = frames.is_empty() ? nullptr : &frames[frames.size() - 1];
+        if (parent && parent->owner == frame.owner) {
+            // Already part of the time of the task we ran inside of
+            parent->foreign_usec += frame.foreign_usec;
+            return;
+        }
+        if (frame.owner) {
+            frame.owner->fetch_add(elapsed_usec - frame.foreign_usec, std::memory_order_relaxed);
+        }
+        if (parent) {
+            parent->foreign_usec += elapsed_usec;
+        }
+    }
+};
+
+#endif // CHUNK_BUILD_TIMER_H
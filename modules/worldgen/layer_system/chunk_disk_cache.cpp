@@ -0,0 +1,133 @@
+#include "chunk_disk_cache.h"
+#include "core/config/project_settings.h"
+#include "core/error/error_macros.h"
+#include "core/io/dir_access.h"
+#include "core/os/thread.h"
+#include "core/string/print_string.h"
+#include "layer_manager.h"
+
+bool ChunkDiskCache::is_enabled() {
+    return GLOBAL_GET("kgame/chunker/disk_cache_enabled");
+}
+
+uint32_t ChunkDiskCache::hash_variant(const Variant &p_value, uint32_t p_hash) {
+    switch (p_value.get_type()) {
+        case Variant::OBJECT: {
+            // Object hashes are pointer based, so we have to look inside them
+            Ref<Resource> resource = p_value;
+            if (resource.is_valid()) {
+                return hash_resource(resource, p_hash);
+            }
+            return hash_murmur3_one_32(0, p_hash);
+        }
+        case Variant::ARRAY: {
+            const Array array = p_value;
+            p_hash = hash_murmur3_one_32(array.size(), p_hash);
+            for (int i = 0; i < array.size(); i++) {
+                p_hash = hash_variant(array[i], p_hash);
+            }
+            return p_hash;
+        }
+        case Variant::DICTIONARY: {
+            const Dictionary dictionary = p_value;
+            const Array keys = dictionary.keys();
+            p_hash = hash_murmur3_one_32(keys.size(), p_hash);
+            for (int i = 0; i < keys.size(); i++) {
+                p_hash = hash_variant(keys[i], p_hash);
+                p_hash = hash_variant(dictionary[keys[i]], p_hash);
+            }
+            return p_hash;
+        }
+        default: {
+            return hash_murmur3_one_32(p_value.hash(), p_hash);
+        }
+    }
+}
+
+uint32_t ChunkDiskCache::hash_resource(const Ref<Resource> &p_resource, uint32_t p_hash) {
+    if (p_resource.is_null()) {
+        return hash_murmur3_one_32(0, p_hash);
+    }
+    p_hash = hash_murmur3_one_32(p_resource->get_class_name().hash(), p_hash);
+
+    List<PropertyInfo> properties;
+    p_resource->get_property_list(&properties);
+    for (const PropertyInfo &property : properties) {
+        if (!(property.usage & PROPERTY_USAGE_STORAGE)) {
+            continue;
+        }
+        p_hash = hash_murmur3_one_32(property.name.hash(), p_hash);
+        p_hash = hash_variant(p_resource->get(property.name), p_hash);
+    }
+    return p_hash;
+}
+
+String ChunkDiskCache::get_chunk_path(const StringName &p_layer_name, uint32_t p_settings_hash, const Vector2i &p_chunk, int p_lod_level) const {
+    return base_path.path_join(String(p_layer_name).validate_filename()).path_join(String::num_uint64(p_settings_hash, 16)).path_join(vformat("%d_%d_%d.kchunk", p_lod_level, p_chunk.x, p_chunk.y));
+}
+
+void ChunkDiskCache::prepare_layer(const StringName &p_layer_name, uint32_t p_settings_hash) const {
+    const String layer_path = base_path.path_join(String(p_layer_name).validate_filename()).path_join(String::num_uint64(p_settings_hash, 16));
+    Error err = DirAccess::make_dir_recursive_absolute(layer_path);
+    ERR_FAIL_COND_MSG(err != OK, vformat("Chunker: Can't create disk cache directory %s", layer_path));
+}
+
+bool ChunkDiskCache::load_chunk(const StringName &p_layer_name, uint32_t p_settings_hash, const Ref<ChunkerChunk> &p_chunk) const {
+    const String path = get_chunk_path(p_layer_name, p_settings_hash, p_chunk->chunk, p_chunk->lod_level);
+    if (!FileAccess::exists(path)) {
+        return false;
+    }
+    Ref<FileAccess> file = FileAccess::open(path, FileAccess::READ);
+    if (file.is_null() || file->get_length() < sizeof(Header)) {
+        return false;
+    }
+
+    Header header;
+    header.magic = file->get_32();
+    header.version = file->get_32();
+    header.settings_hash = file->get_32();
+    header.lod_level = file->get_32();
+    header.chunk_x = file->get_32();
+    header.chunk_y = file->get_32();
+
+    if (header.magic != MAGIC || header.version != VERSION || header.settings_hash != p_settings_hash) {
+        return false;
+    }
+    if (header.lod_level != p_chunk->lod_level || header.chunk_x != p_chunk->chunk.x || header.chunk_y != p_chunk->chunk.y) {
+        return false;
+    }
+
+    if (!p_chunk->load_from_cache(file) || file->get_error() != OK) {
+        print_verbose(vformat("Chunker: Discarding broken cache file %s", path));
+        return false;
+    }
+    return true;
+}
+
+void ChunkDiskCache::save_chunk(const StringName &p_layer_name, uint32_t p_settings_hash, const Ref<ChunkerChunk> &p_chunk) const {
+    const String path = get_chunk_path(p_layer_name, p_settings_hash, p_chunk->chunk, p_chunk->lod_level);
+    // Write to a temporary file first, a half written file must never be picked up by a reader
+    const String temp_path = vformat("%s.%d.tmp", path, (uint64_t)Thread::get_caller_id());
+    {
+        Ref<FileAccess> file = FileAccess::open(temp_path, FileAccess::WRITE);
+        ERR_FAIL_COND_MSG(file.is_null(), vformat("Chunker: Can't write disk cache file %s", temp_path));
+
+        file->store_32(MAGIC);
+        file->store_32(VERSION);
+        file->store_32(p_settings_hash);
+        file->store_32(p_chunk->lod_level);
+        file->store_32(p_chunk->chunk.x);
+        file->store_32(p_chunk->chunk.y);
+        p_chunk->save_to_cache(file);
+    }
+
+    if (FileAccess::exists(path)) {
+        DirAccess::remove_absolute(path);
+    }
+    Error err = DirAccess::rename_absolute(temp_path, path);
+    ERR_FAIL_COND_MSG(err != OK, vformat("Chunker: Can't move disk cache file into place %s", path));
+}
+
+ChunkDiskCache::ChunkDiskCache(const String &p_base_path) {
+    base_path = p_base_path;
+}
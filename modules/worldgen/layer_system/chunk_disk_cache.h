@@ -0,0 +1,44 @@
+#ifndef CHUNK_DISK_CACHE_H
+#define CHUNK_DISK_CACHE_H
+
+#include "core/io/file_access.h"
+#include "core/io/resource.h"
+#include "core/object/ref_counted.h"
+#include "core/string/string_name.h"
+
+class ChunkerChunk;
+
+// Stores built chunks on disk so they don't have to be generated again next time.
+// Files live in <base_path>/<layer name>/<settings hash>/<lod>_<x>_<y>.kchunk, changing the
+// settings of a layer (or any of its parents) changes the hash and leaves the old files alone.
+class ChunkDiskCache : public RefCounted {
+    String base_path;
+public:
+    struct Header {
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        uint32_t settings_hash = 0;
+        int32_t lod_level = 0;
+        int32_t chunk_x = 0;
+        int32_t chunk_y = 0;
+    };
+
+    static constexpr uint32_t MAGIC = 0x4B48434B; // KCHK
+    static constexpr uint32_t VERSION = 7;
+
+    static bool is_enabled();
+    // Hashes all stored properties of a resource, going into sub resources and arrays
+    static uint32_t hash_resource(const Ref<Resource> &p_resource, uint32_t p_hash = HASH_MURMUR3_SEED);
+    static uint32_t hash_variant(const Variant &p_value, uint32_t p_hash = HASH_MURMUR3_SEED);
+
+    String get_chunk_path(const StringName &p_layer_name, uint32_t p_settings_hash, const Vector2i &p_chunk, int p_lod_level) const;
+    void prepare_layer(const StringName &p_layer_name, uint32_t p_settings_hash) const;
+
+    // Both are called from the executor threads
+    bool load_chunk(const StringName &p_layer_name, uint32_t p_settings_hash, const Ref<ChunkerChunk> &p_chunk) const;
+    void save_chunk(const StringName &p_layer_name, uint32_t p_settings_hash, const Ref<ChunkerChunk> &p_chunk) const;
+
+    ChunkDiskCache(const String &p_base_path);
+};
+
+#endif // CHUNK_DISK_CACHE_H
@@ -0,0 +1,167 @@
+#include "chunker_benchmark.h"
+#include "core/config/project_settings.h"
+#include "core/io/file_access.h"
+#include "core/io/json.h"
+#include "core/os/os.h"
+#include "core/string/print_string.h"
+#include "core/templates/sort_array.h"
+#include "scene/main/window.h"
+
+void ChunkerBenchmark::parse_arguments() {
+    const List<String> args = OS::get_singleton()->get_cmdline_user_args();
+    bool use_disk_cache = false;
+    for (const String &arg : args) {
+        if (arg.begins_with("--frames=")) {
+            frame_count = MAX(1, arg.get_slice("=", 1).to_int());
+        } else if (arg.begins_with("--speed=")) {
+            speed = arg.get_slice("=", 1).to_float();
+        } else if (arg.begins_with("--output=")) {
+            output_path = arg.get_slice("=", 1);
+        } else if (arg == "--no-realtime") {
+            realtime = false;
+        } else if (arg == "--disk-cache") {
+            use_disk_cache = true;
+        } else {
+            WARN_PRINT(vformat("ChunkerBenchmark: Unknown argument %s", arg));
+        }
+    }
+
+    // Loading chunks from disk would make runs depend on the previous one
+    if (!use_disk_cache) {
+        ProjectSettings::get_singleton()->set_setting("kgame/chunker/disk_cache_enabled", false);
+    }
+}
+
+Vector2 ChunkerBenchmark::get_camera_position(double p_time) const {
+    // Drive forward while weaving side to side, so we cross chunk borders on both axes
+    return Vector2(speed * p_time, Math::sin(p_time * 0.2) * 500.0);
+}
+
+Vector2 ChunkerBenchmark::get_camera_velocity(double p_time) const {
+    return Vector2(speed, Math::cos(p_time * 0.2) * 0.2 * 500.0);
+}
+
+void ChunkerBenchmark::initialize() {
+    SceneTree::initialize();
+    parse_arguments();
+
+    chunker = memnew(ChunkerLayerManager);
+    get_root()->add_child(chunker);
+    layer_stack.create(chunker);
+    chunker->set_record_build_times(true);
+
+    print_line(vformat("ChunkerBenchmark: %d frames at %.1f units/s with %d worker threads", frame_count, speed, ChunkerLayerManager::get_worker_thread_count()));
+    start_usec = OS::get_singleton()->get_ticks_usec();
+}
+
+bool ChunkerBenchmark::process(double p_time) {
+    bool quit = SceneTree::process(p_time);
+
+    // Scripted time instead of the real delta, so every run requests the same chunks in the same order
+    const double time = MIN(frame, frame_count) * FRAME_TIME;
+    layer_stack.update(chunker, get_camera_position(time), frame < frame_count ? get_camera_velocity(time) : Vector2());
+    peak_chunker_memory = MAX(peak_chunker_memory, chunker->get_total_memory_usage());
+
+    const uint64_t now_usec = OS::get_singleton()->get_ticks_usec();
+    if (first_view_ready_usec == 0 && chunker->is_idle()) {
+        first_view_ready_usec = now_usec - start_usec;
+    }
+
+    frame++;
+    if (frame >= frame_count) {
+        // Stop moving and wait for what's left
+        if (drain_start_usec == 0) {
+            drain_start_usec = now_usec;
+        }
+        if (chunker->is_idle() || now_usec - drain_start_usec > DRAIN_TIMEOUT_USEC) {
+            finish();
+            return true;
+        }
+    }
+
+    if (realtime) {
+        const uint64_t frame_end_usec = start_usec + uint64_t(frame * FRAME_TIME * 1000000.0);
+        if (now_usec < frame_end_usec) {
+            OS::get_singleton()->delay_usec(frame_end_usec - now_usec);
+        }
+    }
+
+    return quit;
+}
+
+void ChunkerBenchmark::add_time_stats(Dictionary &r_report, const String &p_prefix, LocalVector<uint64_t> p_times_usec) {
+    SortArray<uint64_t> sorter;
+    sorter.sort(p_times_usec.ptr(), p_times_usec.size());
+
+    uint64_t total_usec = 0;
+    for (const uint64_t &time_usec : p_times_usec) {
+        total_usec += time_usec;
+    }
+
+    const auto percentile_ms = [&p_times_usec](double p_percentile) -> double {
+        if (p_times_usec.is_empty()) {
+            return 0.0;
+        }
+        const uint32_t idx = MIN(p_times_usec.size() - 1, uint32_t(p_percentile * p_times_usec.size()));
+        return p_times_usec[idx] / 1000.0;
+    };
+
+    r_report[p_prefix + "total_ms"] = total_usec / 1000.0;
+    r_report[p_prefix + "p50_ms"] = percentile_ms(0.50);
+    r_report[p_prefix + "p95_ms"] = percentile_ms(0.95);
+    r_report[p_prefix + "p99_ms"] = percentile_ms(0.99);
+    r_report[p_prefix + "max_ms"] = p_times_usec.is_empty() ? 0.0 : p_times_usec[p_times_usec.size() - 1] / 1000.0;
+}
+
+Dictionary ChunkerBenchmark::build_report(uint64_t p_wall_time_usec) const {
+    Dictionary layers;
+    uint64_t total_chunks = 0;
+    uint64_t total_cache_loads = 0;
+    for (const StringName &layer_name : layer_stack.layer_names) {
+        // Build times only cover the chunk's own tasks, chunks that came from the disk cache are reported on their own
+        const LocalVector<uint64_t> build_times = chunker->get_build_times_usec(layer_name);
+        const LocalVector<uint64_t> cache_load_times = chunker->get_cache_load_times_usec(layer_name);
+        total_chunks += build_times.size();
+        total_cache_loads += cache_load_times.size();
+
+        Dictionary layer_report;
+        layer_report["chunks"] = build_times.size();
+        add_time_stats(layer_report, "", build_times);
+        layer_report["cache_loads"] = cache_load_times.size();
+        add_time_stats(layer_report, "cache_load_", cache_load_times);
+        layer_report["evicted"] = chunker->get_memory_stats(layer_name).evicted;
+        layers[String(layer_name)] = layer_report;
+    }
+
+    const double wall_time_sec = p_wall_time_usec / 1000000.0;
+    Dictionary report;
+    report["frames"] = frame_count;
+    report["speed"] = speed;
+    report["realtime"] = realtime;
+    report["worker_threads"] = ChunkerLayerManager::get_worker_thread_count();
+    report["wall_time_sec"] = wall_time_sec;
+    report["first_view_ready_sec"] = first_view_ready_usec / 1000000.0;
+    report["chunks_built"] = total_chunks;
+    report["chunks_loaded_from_cache"] = total_cache_loads;
+    report["chunks_per_second"] = wall_time_sec > 0.0 ? (total_chunks + total_cache_loads) / wall_time_sec : 0.0;
+    report["peak_chunker_memory_bytes"] = peak_chunker_memory;
+    report["peak_static_memory_bytes"] = OS::get_singleton()->get_static_memory_peak_usage();
+    report["layers"] = layers;
+    return report;
+}
+
+void ChunkerBenchmark::finish() {
+    const uint64_t wall_time_usec = OS::get_singleton()->get_ticks_usec() - start_usec;
+    if (!chunker->is_idle()) {
+        WARN_PRINT("ChunkerBenchmark: Timed out waiting for chunks to finish building.");
+    }
+
+    const String report = JSON::stringify(build_report(wall_time_usec), "\t");
+    print_line(report);
+
+    if (!output_path.is_empty()) {
+        Ref<FileAccess> file = FileAccess::open(output_path, FileAccess::WRITE);
+        ERR_FAIL_COND_MSG(file.is_null(), vformat("ChunkerBenchmark: Can't write report to %s", output_path));
+        file->store_string(report);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef CHUNKER_BENCHMARK_H
+#define CHUNKER_BENCHMARK_H
+
+#include "scene/main/scene_tree.h"
+#include "test_layer.h"
+
+// Streams the terrain layer stack along a scripted camera path and prints a JSON report, run it with:
+// godot --headless --main-loop ChunkerBenchmark -- --frames=1200 --speed=80 --output=user://chunker_benchmark.json
+// Other options: --no-realtime to not wait for frames, --disk-cache to keep the disk cache enabled
+class ChunkerBenchmark : public SceneTree {
+    GDCLASS(ChunkerBenchmark, SceneTree);
+
+    static constexpr double FRAME_TIME = 1.0 / 60.0;
+    // Give up waiting for the last chunks after this long
+    static constexpr uint64_t DRAIN_TIMEOUT_USEC = 60 * 1000000;
+
+    ChunkerLayerManager *chunker = nullptr;
+    TerrainLayerStack layer_stack;
+
+    int frame_count = 1200;
+    float speed = 80.0f;
+    bool realtime = true;
+    String output_path;
+
+    int frame = 0;
+    uint64_t start_usec = 0;
+    uint64_t drain_start_usec = 0;
+    uint64_t first_view_ready_usec = 0;
+    uint64_t peak_chunker_memory = 0;
+
+    void parse_arguments();
+    Vector2 get_camera_position(double p_time) const;
+    Vector2 get_camera_velocity(double p_time) const;
+    // Adds total, p50, p95, p99 and max in milliseconds to r_report, with p_prefix in front of the keys
+    static void add_time_stats(Dictionary &r_report, const String &p_prefix, LocalVector<uint64_t> p_times_usec);
+    Dictionary build_report(uint64_t p_wall_time_usec) const;
+    void finish();
+public:
+    virtual void initialize() override;
+    virtual bool process(double p_time) override;
+};
+
+#endif // CHUNKER_BENCHMARK_H
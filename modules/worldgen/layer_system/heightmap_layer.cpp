@@ -4,35 +4,89 @@
 #include "worldgen/bilinear_array.h"
 
 Ref<HeightmapChunk> HeightmapLayer::get_chunk_at_world_position(Vector2 p_world_position) const {
-    const Vector2i chunk = Vector2(p_world_position / get_chunk_size()).floor();
-    HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = loaded_chunks.find(chunk);
-    ERR_FAIL_COND_V_MSG(it == loaded_chunks.end(), Ref<HeightmapChunk>(), "Tried to get chunk at position that doesn't exist");
-    return it->value;
+    return Ref<HeightmapChunk>(static_cast<HeightmapChunk *>(find_chunk_at_world_position(p_world_position)));
 }
 
 float HeightmapLayer::sample_height_at_position(Vector2 p_world_position) const {
-    Ref<HeightmapChunk> chunk = get_chunk_at_world_position(p_world_position);
-    ERR_FAIL_COND_V(!chunk.is_valid(), 0.0f);
-    Ref<WorldBoundBilinearArray> bilinear_array = chunk->heightmap_array;
-    return bilinear_array->sample(p_world_position);
+    // Called per pixel from the executor threads, stays on raw pointers to avoid the refcount traffic
+    const HeightmapChunk *chunk = static_cast<const HeightmapChunk *>(find_chunk_at_world_position(p_world_position));
+    ERR_FAIL_NULL_V(chunk, 0.0f);
+    return chunk->heightmap.sample(p_world_position);
 }
 
-void HeightmapLayer::sample_height_with_derivative_at_position(Vector2 p_world_position, float p_dir_eps, float &r_height, Vector2 &r_derivative) const {
-    float sample_height = sample_height_at_position(p_world_position);
-    float h2 = sample_height_at_position(p_world_position + Vector2(p_dir_eps, 0.0f));
-    float h3 = sample_height_at_position(p_world_position + Vector2(0.0f, p_dir_eps));
+void HeightmapLayer::sample_region(const Rect2 &p_region, const Vector2i &p_sample_count, float *r_values) const {
+    const Vector2 step = get_sample_grid_step(p_region, p_sample_count);
+    for (const SampleGridSpan &span : get_sample_grid_spans(p_region, p_sample_count)) {
+        const Vector2i span_size = span.end - span.start;
+        float *span_values = r_values + span.start.y * p_sample_count.x + span.start.x;
+        if (!span.chunk) {
+            for (int y = 0; y < span_size.y; y++) {
+                memset(span_values + y * p_sample_count.x, 0, span_size.x * sizeof(float));
+            }
+            continue;
+        }
+        const HeightmapChunk *chunk = static_cast<const HeightmapChunk *>(span.chunk);
+        chunk->heightmap.sample_grid(p_region.position + step * Vector2(span.start), step, span_size, span_values, p_sample_count.x);
+    }
+}
 
-    r_height = sample_height;
+void HeightmapLayer::sample_height_with_derivative_at_position(Vector2 p_world_position, float &r_height, Vector2 &r_derivative) const {
+    const HeightmapChunk *chunk = static_cast<const HeightmapChunk *>(find_chunk_at_world_position(p_world_position));
+    if (!chunk) {
+        r_derivative = Vector2();
+        r_height = 0.0f;
+        ERR_FAIL_MSG("No heightmap chunk at the given position.");
+    }
+    r_height = chunk->heightmap.sample_with_gradient(p_world_position, r_derivative);
+}
 
-    float slope_x = h2 - sample_height;
-    float slope_z = h3 - sample_height;
-    r_derivative.x = slope_x;
-    r_derivative.y = slope_z;
+void HeightmapLayer::sample_lattice_row(const Vector2i &p_start, int p_count, float p_spacing, float *r_values) const {
+    const float chunk_size = get_chunk_size();
+    const float row_y = p_start.y * p_spacing;
+    int i = 0;
+    while (i < p_count) {
+        // Run of points that fall in the same chunk
+        const Vector2 run_start = Vector2(p_start.x + i, p_start.y) * p_spacing;
+        const int chunk_x = Math::floor(run_start.x / chunk_size);
+        const HeightmapChunk *chunk = static_cast<const HeightmapChunk *>(find_chunk_at_world_position(run_start));
+        int run_end = i + 1;
+        while (run_end < p_count && (int)Math::floor((p_start.x + run_end) * p_spacing / chunk_size) == chunk_x) {
+            run_end++;
+        }
+        for (; i < run_end; i++) {
+            r_values[i] = chunk ? chunk->heightmap.sample(Vector2((p_start.x + i) * p_spacing, row_y)) : 0.0f;
+        }
+    }
+}
+
+float HeightmapLayer::get_height_step(const Ref<BiomeGeneratorSettings> &p_biome_settings) {
+    if (p_biome_settings.is_null() || p_biome_settings->get_biomes().is_empty()) {
+        return TiledHeightmap::MIN_HEIGHT_STEP;
+    }
+    // Heights are a weighted average of biome heights, which stay between the reference height and
+    // reference height + multiplier as the noise goes from -1 to 1
+    float min_height = INFINITY;
+    float max_height = -INFINITY;
+    for (const Ref<BiomeSettings> &biome : p_biome_settings->get_biomes()) {
+        ERR_CONTINUE(biome.is_null());
+        const float reference_height = biome->get_reference_height();
+        const float top_height = reference_height + biome->get_height_multiplier();
+        min_height = MIN(min_height, MIN(reference_height, top_height));
+        max_height = MAX(max_height, MAX(reference_height, top_height));
+    }
+    if (min_height > max_height) {
+        return TiledHeightmap::MIN_HEIGHT_STEP;
+    }
+    return TiledHeightmap::get_height_step(min_height, max_height);
 }
 
 Ref<ChunkerChunk> HeightmapLayer::create_chunk(int p_lod_level) const {
+    // The resolution counts intervals, so grids of different LODs line up with each other
+    const int intervals = GLOBAL_GET("kgame/terrain/normal_height_texture_size");
+    const float height_step = get_height_step(get_settings_snapshot("kgame/terrain/biome_settings"));
     Ref<HeightmapChunk> chunk;
-    chunk.instantiate(biomes_layer);
+    chunk.instantiate(biomes_layer, get_lod_resolution(intervals, p_lod_level) + 1, height_step, get_settings_snapshot("kgame/terrain/height_settings"));
+    chunk->layer = this;
     return chunk;
 }
 
@@ -44,6 +98,20 @@ float HeightmapLayer::get_chunk_size() const {
     return GLOBAL_GET("kgame/terrain/terrain_chunk_size");
 }
 
+float HeightmapLayer::get_lod_resolution_scale(int p_lod_level) const {
+    return 1.0f / (1 << p_lod_level);
+}
+
 float HeightmapLayer::get_chunk_padding() const {
     return 1024.0f;
 }
+
+uint32_t HeightmapLayer::get_settings_hash() const {
+    uint32_t hash = ChunkDiskCache::hash_resource(ResourceLoader::load(GLOBAL_GET("kgame/terrain/height_settings")));
+    hash = hash_murmur3_one_32((int)GLOBAL_GET("kgame/terrain/normal_height_texture_size"), hash);
+    return hash_murmur3_one_float(get_chunk_size(), hash);
+}
+
+void HeightmapLayer::get_settings_resources(LocalVector<Ref<Resource>> &r_resources) const {
+    r_resources.push_back(ResourceLoader::load(GLOBAL_GET("kgame/terrain/height_settings")));
+}
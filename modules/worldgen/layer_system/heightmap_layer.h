@@ -11,6 +11,7 @@
 #include "../thirdparty/taskflow/core/taskflow.hpp"
 #include "worldgen/instance_texture_queue.h"
 #include "worldgen/layer_system/biome_layers.h"
+#include "worldgen/layer_system/build_scratch.h"
 #include "../thirdparty/taskflow/algorithm/for_each.hpp"
 #include "worldgen/worldgen_height.h"
 
@@ -19,48 +20,192 @@ class HeightmapLayer;
 class HeightmapChunk : public ChunkerChunk {
     GDCLASS(HeightmapChunk, ChunkerChunk);
     int heightmap_dimensions;
+    // Quantisation step shared by every chunk of the layer, texels copied from neighbours or the coarse chunk keep their value
+    float height_step = TiledHeightmap::MIN_HEIGHT_STEP;
     Ref<WorldgenHeight> height_source;
-    Ref<WorldBoundBilinearArray> heightmap_array;
+    TiledHeightmap heightmap;
+    // Row major heights while building, they are quantised into the heightmap at the end
+    LocalVector<float> *build_heights = nullptr;
     Ref<BiomeVoronoiTriangulationLayer> biomes_layer;
+    const ChunkerLayer *layer = nullptr;
+    // Loaded neighbours of the same LOD in -x, +x, -y, +y order, only set while building. Their border texels are ours too
+    const HeightmapChunk *neighbors[4] = {};
+
+    // Samples sit on a lattice shared by every chunk of the same LOD. Positions come from integer coordinates,
+    // so both chunks on a border compute bit identical positions for it
+    Vector2 get_sample_position(int p_x, int p_y) const {
+        const int intervals = heightmap_dimensions - 1;
+        return Vector2(chunk * intervals + Vector2i(p_x, p_y)) * (bounds.size.x / intervals);
+    }
+
+    bool get_neighbor_texel(int p_x, int p_y, float &r_height) const {
+        const int last = heightmap_dimensions - 1;
+        if (p_x == 0 && neighbors[0]) {
+            r_height = neighbors[0]->heightmap.get_texel(last, p_y);
+        } else if (p_x == last && neighbors[1]) {
+            r_height = neighbors[1]->heightmap.get_texel(0, p_y);
+        } else if (p_y == 0 && neighbors[2]) {
+            r_height = neighbors[2]->heightmap.get_texel(p_x, last);
+        } else if (p_y == last && neighbors[3]) {
+            r_height = neighbors[3]->heightmap.get_texel(p_x, 0);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void find_neighbors() {
+        const Vector2i offsets[4] = { Vector2i(-1, 0), Vector2i(1, 0), Vector2i(0, -1), Vector2i(0, 1) };
+        for (int i = 0; i < 4; i++) {
+            const HeightmapChunk *neighbor = static_cast<const HeightmapChunk *>(layer->find_current_chunk(chunk + offsets[i], lod_level));
+            const bool matches = neighbor && neighbor->heightmap.get_dimension() == heightmap_dimensions && neighbor->heightmap.get_height_step() == height_step;
+            neighbors[i] = matches ? neighbor : nullptr;
+        }
+    }
+
+    // Heights for a batch of positions. Biome weights are looked up first, then every biome's noise
+    // is evaluated in one go for all the positions it covers
+    void generate_heights(const Vector2 *p_positions, int p_count, float *r_heights) const {
+        BuildScratch<BiomeVoronoiTriangulationChunk::BiomeWeights> weights_scratch;
+        LocalVector<BiomeVoronoiTriangulationChunk::BiomeWeights> &weights = *weights_scratch;
+        weights.resize(p_count);
+        bool biome_used[UINT8_MAX + 1] = {};
+
+        // The voronoi chunk is only looked up again when we leave it
+        const BiomeVoronoiTriangulationChunk *voronoi_chunk = nullptr;
+        Rect2 voronoi_chunk_bounds;
+        for (int i = 0; i < p_count; i++) {
+            r_heights[i] = 0.0f;
+            weights[i].count = 0;
+            if (!voronoi_chunk || !voronoi_chunk_bounds.has_point(p_positions[i])) {
+                voronoi_chunk = static_cast<const BiomeVoronoiTriangulationChunk *>(biomes_layer->find_chunk_at_world_position(p_positions[i]));
+                ERR_CONTINUE(!voronoi_chunk);
+                voronoi_chunk_bounds = voronoi_chunk->get_bounds();
+            }
+            voronoi_chunk->sample_biome_weights(p_positions[i], weights[i]);
+            DEV_ASSERT(weights[i].count > 0);
+            for (int j = 0; j < weights[i].count; j++) {
+                biome_used[weights[i].biomes[j]] = true;
+            }
+        }
+        if (!voronoi_chunk) {
+            return;
+        }
+
+        BuildScratch<Vector2> biome_positions;
+        BuildScratch<uint32_t> biome_samples;
+        BuildScratch<float> biome_weights;
+        BuildScratch<real_t> biome_noise;
+        // Biome indices are the same for every voronoi chunk, going through them in order keeps the sums the same for every sample
+        for (int biome_index = 0; biome_index <= UINT8_MAX; biome_index++) {
+            if (!biome_used[biome_index]) {
+                continue;
+            }
+            biome_positions->clear();
+            biome_samples->clear();
+            biome_weights->clear();
+            for (int i = 0; i < p_count; i++) {
+                for (int j = 0; j < weights[i].count; j++) {
+                    if (weights[i].biomes[j] == biome_index) {
+                        biome_positions->push_back(p_positions[i]);
+                        biome_samples->push_back(i);
+                        biome_weights->push_back(weights[i].weights[j]);
+                        break;
+                    }
+                }
+            }
+
+            const BiomeSettings *biome = voronoi_chunk->get_biome(biome_index);
+            biome_noise->resize(biome_positions->size());
+            biome->get_noise()->get_noise_2d_points(biome_positions->ptr(), biome_positions->size(), biome_noise->ptr());
+            for (uint32_t k = 0; k < biome_samples->size(); k++) {
+                const float biome_height = biome->get_reference_height() + ((*biome_noise)[k] * 0.5 + 0.5) * biome->get_height_multiplier();
+                r_heights[(*biome_samples)[k]] += (*biome_weights)[k] * biome_height;
+            }
+        }
+    }
 public:
-    HeightmapChunk(Ref<BiomeVoronoiTriangulationLayer> p_biomes_layer) {
+    HeightmapChunk(Ref<BiomeVoronoiTriangulationLayer> p_biomes_layer, int p_heightmap_dimensions, float p_height_step, Ref<WorldgenHeightSettings> p_height_settings) {
         biomes_layer = p_biomes_layer;
-        heightmap_dimensions = GLOBAL_GET("kgame/terrain/normal_height_texture_size");
+        heightmap_dimensions = p_heightmap_dimensions;
+        height_step = p_height_step;
         height_source.instantiate();
-        height_source->set_settings(ResourceLoader::load(GLOBAL_GET("kgame/terrain/height_settings")));
+        height_source->set_settings(p_height_settings);
+    }
+    ~HeightmapChunk() {
+        // Only still set if the build never finished
+        BuildScratch<float>::release(build_heights);
     }
     virtual void build(tf::Taskflow &p_taskflow) override {
         tf::Task allocate_task = p_taskflow.emplace([&]() {
-            heightmap_array = WorldBoundBilinearArray::create(heightmap_dimensions, bounds);
+            build_heights = BuildScratch<float>::borrow();
+            build_heights->resize(heightmap_dimensions * heightmap_dimensions);
+            find_neighbors();
         }).name("Allocate heightmap array");
-        tf::Task generate_task = p_taskflow.for_each_index(0, heightmap_dimensions*heightmap_dimensions, 1, [&](int i) {
-            Vector2 progress = Vector2(i % heightmap_dimensions, Math::floor((float)i / heightmap_dimensions-1)) / Vector2(heightmap_dimensions-1, heightmap_dimensions-1);
-            Vector2i pixel_xy = Vector2i(i % heightmap_dimensions, i / heightmap_dimensions);
-            Vector2 sample_pos = bounds.position + ( progress * bounds.size);
-            
-            Ref<BiomeVoronoiTriangulationChunk> voronoi_chunk = biomes_layer->get_chunk_at_world_position(sample_pos);
-            BiomeVoronoiTriangulationChunk::BiomeInterpInfo biome_infos[3];
-            bool found_biomes = voronoi_chunk->get_biomes_at_point(sample_pos, biome_infos);
-            float height = 0.0f;
-            if (found_biomes) {
-                const float weights_pow2[3] = {
-                    biome_infos[0].weight * biome_infos[0].weight,
-                    biome_infos[1].weight * biome_infos[1].weight,
-                    biome_infos[2].weight * biome_infos[2].weight
-                };
-                const float total_weights = weights_pow2[0] + weights_pow2[1] + weights_pow2[2];
-                for (int j = 0; j < 3; j++) {
-                    Ref<BiomeSettings> biome = biome_infos[j].biome;
-                    float biome_height = biome->get_reference_height() + (biome->get_noise()->get_noise_2dv(sample_pos) * 0.5 + 0.5) * biome->get_height_multiplier();
-                    height += (weights_pow2[j]/total_weights) * biome_height;
+        // One row per task
+        tf::Task generate_task = p_taskflow.for_each_index(0, heightmap_dimensions, 1, [&](int y) {
+            float *row = build_heights->ptr() + y * heightmap_dimensions;
+
+            // Sample grids are nested between LODs, so a coarser chunk already has every refine_step-th sample
+            const HeightmapChunk *coarse = static_cast<const HeightmapChunk *>(coarse_chunk.ptr());
+            int refine_step = 0;
+            if (coarse && !coarse->heightmap.is_empty() && coarse->heightmap.get_height_step() == height_step) {
+                const int intervals = heightmap_dimensions - 1;
+                const int coarse_intervals = coarse->heightmap_dimensions - 1;
+                if (intervals % coarse_intervals == 0) {
+                    refine_step = intervals / coarse_intervals;
                 }
             }
-            DEV_ASSERT(found_biomes);
+            const bool copy_coarse_row = refine_step > 0 && y % refine_step == 0;
 
-            heightmap_array->set_pixel(pixel_xy, height);
-            
+            // Samples taken from the coarse chunk or a neighbour are skipped, the rest is generated in one batch
+            BuildScratch<Vector2> positions;
+            BuildScratch<uint32_t> position_columns;
+            for (int x = 0; x < heightmap_dimensions; x++) {
+                if (get_neighbor_texel(x, y, row[x])) {
+                    continue;
+                }
+                if (copy_coarse_row && x % refine_step == 0) {
+                    row[x] = coarse->heightmap.get_texel(x / refine_step, y / refine_step);
+                    continue;
+                }
+                positions->push_back(get_sample_position(x, y));
+                position_columns->push_back(x);
+            }
+
+            BuildScratch<float> heights;
+            heights->resize(positions->size());
+            generate_heights(positions->ptr(), positions->size(), heights->ptr());
+            for (uint32_t i = 0; i < heights->size(); i++) {
+                row[(*position_columns)[i]] = (*heights)[i];
+            }
         }).name("Generate heightmap");
+        tf::Task quantize_task = p_taskflow.emplace([&]() {
+            heightmap.create(build_heights->ptr(), heightmap_dimensions, bounds, height_step);
+            BuildScratch<float>::release(build_heights);
+            build_heights = nullptr;
+            for (const HeightmapChunk *&neighbor : neighbors) {
+                neighbor = nullptr;
+            }
+        }).name("Quantize heightmap");
         allocate_task.precede(generate_task);
+        generate_task.precede(quantize_task);
+    }
+
+    virtual uint64_t get_memory_usage() const override {
+        return heightmap.get_memory_usage();
+    }
+
+    virtual bool is_cacheable() const override {
+        return true;
+    }
+
+    virtual void save_to_cache(const Ref<FileAccess> &p_file) const override {
+        heightmap.save(p_file);
+    }
+
+    virtual bool load_from_cache(const Ref<FileAccess> &p_file) override {
+        return heightmap.load(p_file, heightmap_dimensions, bounds) && heightmap.get_height_step() == height_step;
     }
     friend class HeightmapLayer;
 };
@@ -72,11 +217,23 @@ public:
     HeightmapLayer(Ref<BiomeVoronoiTriangulationLayer> p_biomes_layer);
     virtual float get_chunk_size() const override;
     virtual float get_chunk_padding() const override;
+    virtual float get_lod_resolution_scale(int p_lod_level) const override;
+    virtual bool can_refine_chunks() const override {
+        return true;
+    }
+    virtual uint32_t get_settings_hash() const override;
+    virtual void get_settings_resources(LocalVector<Ref<Resource>> &r_resources) const override;
     virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const override;
+    // Step every chunk quantises its heights to, fine enough for the whole height range the biomes can produce
+    static float get_height_step(const Ref<BiomeGeneratorSettings> &p_biome_settings);
 
     Ref<HeightmapChunk> get_chunk_at_world_position(Vector2 p_world_position) const;
     float sample_height_at_position(Vector2 p_world_position) const;
-    void sample_height_with_derivative_at_position(Vector2 p_world_position, float p_dir_eps, float &r_height, Vector2 &r_derivative) const;
+    virtual void sample_region(const Rect2 &p_region, const Vector2i &p_sample_count, float *r_values) const override;
+    void sample_height_with_derivative_at_position(Vector2 p_world_position, float &r_height, Vector2 &r_derivative) const;
+    // Samples p_count points of a lattice row, point i sits at (p_start.x + i, p_start.y) * p_spacing. Chunks sampling
+    // the same lattice point get the same position and the same result
+    void sample_lattice_row(const Vector2i &p_start, int p_count, float p_spacing, float *r_values) const;
 };
 
 #endif // TERRAIN_LAYERS_H
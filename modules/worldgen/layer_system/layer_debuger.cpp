@@ -27,6 +27,47 @@ void ChunkerDebugger::_draw_ui() {
             }
             ImGui::EndCombo();
         }
+
+        const ChunkerLayerManager::CompletionQueueStats stats = layer_manager->get_completion_queue_stats(layer_manager->layers[selected_layer].name);
+        ImGui::Text("Completion queue: %d queued, %llu committed, %llu deferred", stats.queued, (unsigned long long)stats.committed, (unsigned long long)stats.deferred);
+
+        if (ImGui::CollapsingHeader("Memory")) {
+            uint64_t total_memory_usage = 0;
+            if (ImGui::BeginTable("Memory stats", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+                ImGui::TableSetupColumn("Layer");
+                ImGui::TableSetupColumn("Loaded");
+                ImGui::TableSetupColumn("Cached");
+                ImGui::TableSetupColumn("Memory");
+                ImGui::TableSetupColumn("Cached memory");
+                ImGui::TableSetupColumn("Evicted");
+                ImGui::TableHeadersRow();
+                for (size_t i = 0; i < layer_manager->layers.size(); i++) {
+                    const ChunkerLayerManager::MemoryStats memory_stats = layer_manager->get_memory_stats(layer_manager->layers[i].name);
+                    total_memory_usage += memory_stats.memory_usage;
+                    CharString layer_name = String(layer_manager->layers[i].name).utf8();
+                    CharString memory_usage = String::humanize_size(memory_stats.memory_usage).utf8();
+                    CharString cached_memory_usage = String::humanize_size(memory_stats.cached_memory_usage).utf8();
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(layer_name.get_data());
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%d", memory_stats.loaded);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%d", memory_stats.cached);
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(memory_usage.get_data());
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(cached_memory_usage.get_data());
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%llu", (unsigned long long)memory_stats.evicted);
+                }
+                ImGui::EndTable();
+            }
+            CharString total = String::humanize_size(total_memory_usage).utf8();
+            CharString budget = String::humanize_size(ChunkerLayerManager::get_memory_budget()).utf8();
+            ImGui::Text("Total: %s / %s", total.get_data(), budget.get_data());
+        }
+
         LocalVector<Color> lod_colors;
         lod_colors.resize(layer_manager->lod_max_distances.size());
         for (size_t i = 0; i < lod_colors.size(); i++) {
@@ -34,6 +75,8 @@ void ChunkerDebugger::_draw_ui() {
         }
 
         ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
+
+        MutexLock lock(layer_manager->layers[selected_layer].layer->loaded_chunks_mutex);
         
         float max_distance = 0.0f;
         for (KeyValue<Vector2i, Ref<ChunkerChunk>> chunk : layer_manager->layers[selected_layer].layer->loaded_chunks) {
@@ -1,8 +1,12 @@
 #include "layer_manager.h"
+#include "core/config/project_settings.h"
 #include "core/error/error_macros.h"
+#include "core/io/resource_loader.h"
 #include "core/math/vector2.h"
 #include "core/math/vector2i.h"
+#include "core/os/os.h"
 #include "core/string/print_string.h"
+#include "core/templates/sort_array.h"
 #include "worldgen/thirdparty/taskflow/core/taskflow.hpp"
 
 void ChunkerLayerManager::insert_layer(StringName p_layer_name, Ref<ChunkerLayer> p_layer) {
@@ -26,147 +30,877 @@ void ChunkerLayerManager::add_layer_dependency(StringName p_child_layer_name, St
 }
 
 void ChunkerLayerManager::propagate_layer_chunks_up(size_t p_layer, const Rect2 &p_requested_region, const Vector2 &p_reference_position) {
-    const ChunkerLayerInstance &layer_instance = layers[p_layer];
+    ChunkerLayerInstance &layer_instance = layers[p_layer];
     LocalVector<ChunkerLayer::RequestedChunk> requested_chunks = layer_instance.layer->get_requested_chunks(p_requested_region, p_reference_position);
     Rect2 bounds_for_parent = p_requested_region;
     for (ChunkerLayer::RequestedChunk &requested_chunk : requested_chunks) {
         // No need to generate this layer, since we already have it
         requested_chunk.lod_level = get_lod_level_for_chunk(requested_chunk.bounds, p_reference_position);
+        const ChunkLodKey key = {.chunk = requested_chunk.chunk, .lod_level = requested_chunk.lod_level};
         if (layer_instance.layer->has_chunk(requested_chunk.chunk, requested_chunk.lod_level)) {
-            continue;
+            // Back in range before it got evicted
+            if (layer_instance.cached_chunks.erase(key)) {
+                layer_instance.layer->restore_chunk(key);
+            }
+            // Stale chunks stay loaded until their rebuild takes their place
+            if (!layer_instance.layer->is_chunk_stale(key)) {
+                continue;
+            }
         }
+        // Chunks that are still building need their parents to stay around, so they still count towards the parent region
         bounds_for_parent = bounds_for_parent.merge(requested_chunk.bounds.grow(requested_chunk.padding));
-        tasks[p_layer].chunks_to_build.insert({.chunk = requested_chunk.chunk, .lod_level = requested_chunk.lod_level});
+        if (is_chunk_building(p_layer, key)) {
+            continue;
+        }
+        requests[p_layer].chunks_to_build.insert(key);
     }
     
-    if (tasks[p_layer].total_requested_region == Rect2()) {
-        tasks[p_layer].total_requested_region = p_requested_region;
+    if (requests[p_layer].total_requested_region == Rect2()) {
+        requests[p_layer].total_requested_region = p_requested_region;
     } else {
-        tasks[p_layer].total_requested_region = tasks[p_layer].total_requested_region.merge(p_requested_region);
+        requests[p_layer].total_requested_region = requests[p_layer].total_requested_region.merge(p_requested_region);
     }
 
     for (const size_t &parent : layers[p_layer].parents) {
         propagate_layer_chunks_up(parent, bounds_for_parent, p_reference_position);
     }
 }
-void ChunkerLayerManager::propagate_layer_taskflow_dependencies_up(size_t p_layer) {
-    for (const size_t &parent : layers[p_layer].parents) {
-        tasks[parent].layer_task.precede(tasks[p_layer].layer_task);
+
+void ChunkerLayerManager::update_layer_build_order() {
+    layer_build_order.clear();
+    LocalVector<int> pending_parents;
+    pending_parents.resize(layers.size());
+    for (size_t layer_i = 0; layer_i < layers.size(); layer_i++) {
+        pending_parents[layer_i] = layers[layer_i].parents.size();
+        if (pending_parents[layer_i] == 0) {
+            layer_build_order.push_back(layer_i);
+        }
     }
+
+    for (size_t i = 0; i < layer_build_order.size(); i++) {
+        for (const size_t &child : layers[layer_build_order[i]].children) {
+            pending_parents[child]--;
+            if (pending_parents[child] == 0) {
+                layer_build_order.push_back(child);
+            }
+        }
+    }
+
+    ERR_FAIL_COND_MSG(layer_build_order.size() != layers.size(), "Chunker layer dependencies contain a cycle.");
 }
-void ChunkerLayerManager::build(Rect2 p_user_requested_region, Vector2 p_reference_position) {
-    DEV_ASSERT(!current_future.valid());
-    taskflow = tf::Taskflow("My taskflow");
-    tasks.clear();
-    tasks.resize(layers.size());
-    // Find all leaf chunks and see what chunks they want, we can use those to propagate up a user requested region
+
+void ChunkerLayerManager::update_layer_settings_hashes() {
+    // Parents come first in the build order, so their hashes are always ready
+    for (const size_t &layer_i : layer_build_order) {
+        uint32_t settings_hash = layers[layer_i].layer->get_settings_hash();
+        for (const size_t &parent : layers[layer_i].parents) {
+            settings_hash = hash_murmur3_one_32(layers[parent].settings_hash, settings_hash);
+        }
+        layers[layer_i].settings_hash = hash_fmix32(settings_hash);
+        if (disk_cache.is_valid()) {
+            disk_cache->prepare_layer(layers[layer_i].name, layers[layer_i].settings_hash);
+        }
+    }
+}
+
+void ChunkerLayerManager::collect_settings_resources(const Variant &p_value, LocalVector<Ref<Resource>> &r_resources) {
+    // Same walk as ChunkDiskCache::hash_variant, so everything that goes into the hash is watched
+    switch (p_value.get_type()) {
+        case Variant::OBJECT: {
+            Ref<Resource> resource = p_value;
+            if (resource.is_null() || r_resources.has(resource)) {
+                return;
+            }
+            r_resources.push_back(resource);
+            List<PropertyInfo> properties;
+            resource->get_property_list(&properties);
+            for (const PropertyInfo &property : properties) {
+                if (property.usage & PROPERTY_USAGE_STORAGE) {
+                    collect_settings_resources(resource->get(property.name), r_resources);
+                }
+            }
+        } break;
+        case Variant::ARRAY: {
+            const Array array = p_value;
+            for (int i = 0; i < array.size(); i++) {
+                collect_settings_resources(array[i], r_resources);
+            }
+        } break;
+        case Variant::DICTIONARY: {
+            const Dictionary dictionary = p_value;
+            const Array keys = dictionary.keys();
+            for (int i = 0; i < keys.size(); i++) {
+                collect_settings_resources(keys[i], r_resources);
+                collect_settings_resources(dictionary[keys[i]], r_resources);
+            }
+        } break;
+        default: {
+        } break;
+    }
+}
+
+Variant ChunkerLayerManager::duplicate_settings_variant(const Variant &p_value, HashMap<const Resource *, Ref<Resource>> &r_duplicates) {
+    switch (p_value.get_type()) {
+        case Variant::OBJECT: {
+            const Ref<Resource> resource = p_value;
+            if (resource.is_null()) {
+                return p_value;
+            }
+            HashMap<const Resource *, Ref<Resource>>::ConstIterator it = r_duplicates.find(resource.ptr());
+            if (it != r_duplicates.end()) {
+                return it->value;
+            }
+            Ref<Resource> duplicate = Object::cast_to<Resource>(ClassDB::instantiate(resource->get_class()));
+            ERR_FAIL_COND_V(duplicate.is_null(), p_value);
+            r_duplicates.insert(resource.ptr(), duplicate);
+            List<PropertyInfo> properties;
+            resource->get_property_list(&properties);
+            for (const PropertyInfo &property : properties) {
+                if (property.usage & PROPERTY_USAGE_STORAGE) {
+                    duplicate->set(property.name, duplicate_settings_variant(resource->get(property.name), r_duplicates));
+                }
+            }
+            return duplicate;
+        }
+        case Variant::ARRAY: {
+            const Array array = p_value;
+            // Keeps the type of typed arrays
+            Array duplicate = array.duplicate(false);
+            for (int i = 0; i < array.size(); i++) {
+                duplicate[i] = duplicate_settings_variant(array[i], r_duplicates);
+            }
+            return duplicate;
+        }
+        case Variant::DICTIONARY: {
+            const Dictionary dictionary = p_value;
+            Dictionary duplicate;
+            const Array keys = dictionary.keys();
+            for (int i = 0; i < keys.size(); i++) {
+                duplicate[duplicate_settings_variant(keys[i], r_duplicates)] = duplicate_settings_variant(dictionary[keys[i]], r_duplicates);
+            }
+            return duplicate;
+        }
+        default: {
+            return p_value.duplicate();
+        }
+    }
+}
+
+Ref<Resource> ChunkerLayerManager::get_settings_snapshot(const String &p_project_setting) {
+    HashMap<String, Ref<Resource>>::ConstIterator it = settings_snapshots.find(p_project_setting);
+    if (it != settings_snapshots.end()) {
+        return it->value;
+    }
+    const Ref<Resource> settings = ResourceLoader::load(GLOBAL_GET(p_project_setting));
+    HashMap<const Resource *, Ref<Resource>> duplicates;
+    const Ref<Resource> snapshot = duplicate_settings_variant(settings, duplicates);
+    settings_snapshots.insert(p_project_setting, snapshot);
+    return snapshot;
+}
+
+void ChunkerLayerManager::watch_settings_resources() {
+    const Callable changed_callable = callable_mp(this, &ChunkerLayerManager::_on_settings_resource_changed);
+    for (const Ref<Resource> &resource : watched_settings_resources) {
+        resource->disconnect_changed(changed_callable);
+    }
+    watched_settings_resources.clear();
+
+    for (const ChunkerLayerInstance &layer_instance : layers) {
+        LocalVector<Ref<Resource>> layer_resources;
+        layer_instance.layer->get_settings_resources(layer_resources);
+        for (const Ref<Resource> &resource : layer_resources) {
+            collect_settings_resources(resource, watched_settings_resources);
+        }
+    }
+
+    for (const Ref<Resource> &resource : watched_settings_resources) {
+        resource->connect_changed(changed_callable);
+    }
+}
+
+void ChunkerLayerManager::_on_settings_resource_changed() {
+    // Resources tend to change many times in a row while being edited, the work happens once in the next update
+    settings_changed = true;
+    settings_change_count.fetch_add(1);
+}
+
+void ChunkerLayerManager::apply_settings_changes() {
+    if (!settings_changed || layer_build_order.size() != layers.size()) {
+        return;
+    }
+    settings_changed = false;
+    // Chunks scheduled from now on get copies of the new settings, the old ones stay alive for the builds still using them
+    settings_snapshots.clear();
+    // Sub resources might have been swapped out
+    watch_settings_resources();
+
+    LocalVector<uint32_t> old_settings_hashes;
+    old_settings_hashes.resize(layers.size());
     for (size_t layer_i = 0; layer_i < layers.size(); layer_i++) {
-        if (layers[layer_i].children.size() != 0) {
-            continue;
+        old_settings_hashes[layer_i] = layers[layer_i].settings_hash;
+    }
+    update_layer_settings_hashes();
+
+    // Hashes include the parents, so children of a changed layer are invalidated as well. Children go first,
+    // so the parents see them as cancelled and can drop their cached chunks
+    for (int64_t i = layer_build_order.size() - 1; i >= 0; i--) {
+        const size_t layer_i = layer_build_order[i];
+        if (layers[layer_i].settings_hash != old_settings_hashes[layer_i]) {
+            invalidate_layer(layer_i);
         }
-        propagate_layer_chunks_up(layer_i, p_user_requested_region, p_reference_position);
     }
-    bool has_chunks_to_process = false;
+}
+
+void ChunkerLayerManager::invalidate_layer(size_t p_layer) {
+    ChunkerLayerInstance &layer_instance = layers[p_layer];
+    print_verbose(vformat("Chunker: Settings of %s changed, rebuilding its chunks", layer_instance.name));
+    layer_instance.layer->settings_generation.fetch_add(1);
+
+    // Queued builds would use the old settings, the next build() schedules them again
+    for (KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &kv : layer_instance.building_chunks) {
+        ChunkerChunk::BuildState expected = ChunkerChunk::BUILD_STATE_QUEUED;
+        kv.value->build_state.compare_exchange_strong(expected, ChunkerChunk::BUILD_STATE_CANCELLED);
+    }
+
+    // Cached chunks are out of range, there is no point in rebuilding them before we come back
+    LocalVector<Pair<Vector2i, int>> chunks_to_unload;
+    {
+        MutexLock lock(layer_instance.layer->loaded_chunks_mutex);
+        for (const KeyValue<ChunkLodKey, uint64_t> &kv : layer_instance.cached_chunks) {
+            ChunkLODHashMap::ConstIterator it = layer_instance.layer->loaded_chunks_lod.find(kv.key);
+            if (it == layer_instance.layer->loaded_chunks_lod.end() || is_chunk_needed_by_children(p_layer, it->value->bounds)) {
+                continue;
+            }
+            chunks_to_unload.push_back(Pair<Vector2i, int>(kv.key.chunk, kv.key.lod_level));
+        }
+    }
+    for (const Pair<Vector2i, int> &chunk : chunks_to_unload) {
+        layer_instance.cached_chunks.erase({.chunk = chunk.first, .lod_level = chunk.second});
+    }
+    layer_instance.layer->unload_chunks(chunks_to_unload);
+}
 
-    // build layer taskflows and tasks
+bool ChunkerLayerManager::is_chunk_building(size_t p_layer, const ChunkLodKey &p_chunk) const {
+    ChunkLODHashMap::ConstIterator it = layers[p_layer].building_chunks.find(p_chunk);
+    if (it == layers[p_layer].building_chunks.end()) {
+        return false;
+    }
+    // Builds with outdated settings don't count, they get thrown away when they finish
+    if (it->value->settings_generation != layers[p_layer].layer->settings_generation.load()) {
+        return false;
+    }
+    return it->value->build_state.load() != ChunkerChunk::BUILD_STATE_CANCELLED;
+}
+
+bool ChunkerLayerManager::is_chunk_needed_by_children(size_t p_layer, const Rect2 &p_chunk_bounds) const {
+    for (const size_t &child : layers[p_layer].children) {
+        const float child_padding = layers[child].layer->get_chunk_padding();
+        for (const KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &kv : layers[child].building_chunks) {
+            const ChunkerChunk::BuildState state = kv.value->build_state.load();
+            if (state == ChunkerChunk::BUILD_STATE_QUEUED || state == ChunkerChunk::BUILD_STATE_RUNNING) {
+                if (kv.value->bounds.grow(child_padding).intersects(p_chunk_bounds)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void ChunkerLayerManager::cancel_stale_chunks() {
     for (size_t layer_i = 0; layer_i < layers.size(); layer_i++) {
-        tasks[layer_i].reference_position = p_reference_position;
-        tasks[layer_i].layer_taskflow.name(std::string("Layer ") + std::to_string(layer_i));
-        const float CHUNK_SIZE = layers[layer_i].layer->get_chunk_size();
-        tasks[layer_i].chunk_taskflows.resize(tasks[layer_i].chunks_to_build.size());
+        for (KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &kv : layers[layer_i].building_chunks) {
+            // LOD changes don't cancel, children that are still waiting might depend on this exact chunk
+            if (kv.value->bounds.intersects(requests[layer_i].total_requested_region)) {
+                continue;
+            }
+            // Only chunks that haven't started yet can be cancelled, running ones are left to finish
+            ChunkerChunk::BuildState expected = ChunkerChunk::BUILD_STATE_QUEUED;
+            kv.value->build_state.compare_exchange_strong(expected, ChunkerChunk::BUILD_STATE_CANCELLED);
+        }
+    }
+}
 
-        CharString layer_name = vformat("%s", layers[layer_i].name).utf8();
-        std::string layer_name_std = layer_name.get_data();
+bool ChunkerLayerManager::schedule_chunk(size_t p_layer, const ChunkLodKey &p_chunk) {
+    ChunkerLayerInstance &layer_instance = layers[p_layer];
+    const float chunk_size = layer_instance.layer->get_chunk_size();
 
-        int chunk_taskflow_i = 0;
-        for (const ChunkLodKey &chunk : tasks[layer_i].chunks_to_build) {
-            Ref<ChunkerChunk> chunk_instance = layers[layer_i].layer->create_chunk(chunk.lod_level);
-            chunk_instance->bounds = Rect2(CHUNK_SIZE * Vector2(chunk.chunk), Vector2(CHUNK_SIZE, CHUNK_SIZE));
-            chunk_instance->chunk = chunk.chunk;
-            chunk_instance->lod_level = chunk.lod_level;
-            tasks[layer_i].chunks_being_built.push_back(chunk_instance);
-            chunk_instance->build(tasks[layer_i].chunk_taskflows[chunk_taskflow_i]);
+    // Cached chunks might be holding on to the slots the new chunk needs
+    while (!layer_instance.layer->has_room_for_chunk(p_chunk.lod_level)) {
+        if (!evict_cached_chunk_for_lod(p_layer, p_chunk.lod_level)) {
+            // Everything is in use, the chunk stays requested and gets another try on the next build()
+            return false;
+        }
+    }
+
+    Ref<ChunkerChunk> chunk_instance = layer_instance.layer->create_chunk(p_chunk.lod_level);
+    chunk_instance->bounds = Rect2(chunk_size * Vector2(p_chunk.chunk), Vector2(chunk_size, chunk_size));
+    chunk_instance->chunk = p_chunk.chunk;
+    chunk_instance->lod_level = p_chunk.lod_level;
+    chunk_instance->settings_generation = layer_instance.layer->settings_generation.load();
+    if (layer_instance.layer->can_refine_chunks()) {
+        chunk_instance->coarse_chunk = layer_instance.layer->get_coarser_chunk(p_chunk.chunk, p_chunk.lod_level);
+    }
+    chunk_instance->build(chunk_instance->build_taskflow);
+    if (build_timer) {
+        build_timer->track(chunk_instance->build_taskflow, &chunk_instance->build_time_usec);
+    }
 
-            if (!tasks[layer_i].chunk_taskflows[chunk_taskflow_i].empty()) {
-                has_chunks_to_process = true;
+    CharString layer_name = vformat("%s", layer_instance.name).utf8();
+    const std::string chunk_name = std::string(layer_name.get_data()) + " Chunk (" + std::to_string(p_chunk.chunk.x) + ", " + std::to_string(p_chunk.chunk.y) + ")";
+    chunk_instance->build_taskflow.name(chunk_name);
+
+    // Wait for any parent chunk we overlap that is still being built, parents are always scheduled first
+    LocalVector<tf::AsyncTask> dependencies;
+    const Rect2 padded_bounds = chunk_instance->bounds.grow(layer_instance.layer->get_chunk_padding());
+    for (const size_t &parent : layer_instance.parents) {
+        for (const KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &kv : layers[parent].building_chunks) {
+            if (kv.value->build_state.load() != ChunkerChunk::BUILD_STATE_CANCELLED && kv.value->bounds.intersects(padded_bounds)) {
+                dependencies.push_back(kv.value->build_task);
             }
+        }
+    }
 
-            tasks[layer_i].chunk_taskflows[chunk_taskflow_i].name(layer_name_std + "(CT) Chunk (" + std::to_string(chunk.chunk.x) + ", " + std::to_string(chunk.chunk.y) + ")");
-            tf::Task chunk_task = tasks[layer_i].layer_taskflow.composed_of(tasks[layer_i].chunk_taskflows[chunk_taskflow_i]).name(
-                layer_name_std + " Chunk (" + std::to_string(chunk.chunk.x) + ", " + std::to_string(chunk.chunk.y) + ")"
-            );
+    tf::TaskParams params;
+    params.name = chunk_name;
+    params.priority = (unsigned)get_chunk_priority(p_chunk.lod_level);
 
-            tf::Task store_chunk_task = tasks[layer_i].layer_taskflow.emplace([this, layer_i, chunk_instance]() {
-                MutexLock lock(layers[layer_i].layer->loaded_chunks_mutex);
-                layers[layer_i].layer->loaded_chunks.insert(chunk_instance->chunk, chunk_instance);
-                layers[layer_i].layer->loaded_chunks_lod.insert({.chunk = chunk_instance->chunk, .lod_level = chunk_instance->lod_level}, chunk_instance);
-            }).name("Store chunk");
+    Ref<ChunkDiskCache> cache = chunk_instance->is_cacheable() ? disk_cache : Ref<ChunkDiskCache>();
+    const StringName layer_cache_name = layer_instance.name;
+    const uint32_t settings_hash = layer_instance.settings_hash;
+    const uint32_t scheduled_settings_change_count = settings_change_count.load();
 
-            chunk_task.precede(store_chunk_task);
+    // The task only borrows the chunk, building_chunks or superseded_chunks own it until it's collected on the main
+    // thread. The task node can get freed on a worker, it must never hold the last reference
+    ChunkerChunk *chunk = chunk_instance.ptr();
+    tf::Executor &exec = get_executor();
+    chunk_instance->build_task = exec.silent_dependent_async(params, [this, p_layer, chunk, cache, layer_cache_name, settings_hash, scheduled_settings_change_count, &exec]() {
+        // Other chunks' tasks may run inside of this one while it waits on its taskflow
+        ChunkBuildTimer::detach_current_task();
+        ChunkerChunk::BuildState expected = ChunkerChunk::BUILD_STATE_QUEUED;
+        if (chunk->build_state.compare_exchange_strong(expected, ChunkerChunk::BUILD_STATE_RUNNING)) {
+            // Keeps every chunk snapshot we might read from alive until we are done
+            chunk->snapshot_read_epoch.store(snapshot_epoch.load());
+            // The parent chunks we waited on might not have been published yet
+            for (const size_t &parent : layers[p_layer].parents) {
+                layers[parent].layer->publish_chunk_snapshot_if_dirty();
+            }
+            if (cache.is_valid()) {
+                const uint64_t load_start_usec = OS::get_singleton()->get_ticks_usec();
+                chunk->loaded_from_cache = cache->load_chunk(layer_cache_name, settings_hash, Ref<ChunkerChunk>(chunk));
+                chunk->cache_load_time_usec = OS::get_singleton()->get_ticks_usec() - load_start_usec;
+            }
+            if (!chunk->loaded_from_cache) {
+                if (!chunk->build_taskflow.empty()) {
+                    exec.corun(chunk->build_taskflow);
+                }
+                // Settings changed halfway through, what we built doesn't match settings_hash anymore
+                if (cache.is_valid() && settings_change_count.load() == scheduled_settings_change_count) {
+                    cache->save_chunk(layer_cache_name, settings_hash, Ref<ChunkerChunk>(chunk));
+                }
+            }
 
-            chunk_taskflow_i++;
+            bool stale = false;
+            {
+                ChunkerLayer *layer = layers[p_layer].layer.ptr();
+                MutexLock lock(layer->loaded_chunks_mutex);
+                // A build with the new settings is on its way, keep showing what's loaded until then
+                stale = chunk->settings_generation != layer->settings_generation.load();
+                if (!stale) {
+                    const ChunkLodKey key = {.chunk = chunk->chunk, .lod_level = chunk->lod_level};
+                    ChunkLODHashMap::Iterator replaced_it = layer->loaded_chunks_lod.find(key);
+                    if (replaced_it != layer->loaded_chunks_lod.end()) {
+                        chunk->replaced_chunk = replaced_it->value;
+                    }
+                    const Ref<ChunkerChunk> chunk_ref = chunk;
+                    layer->loaded_chunks.insert(chunk->chunk, chunk_ref);
+                    layer->loaded_chunks_lod.insert(key, chunk_ref);
+                    // Copying loaded_chunks for every stored chunk adds up, they get published together instead
+                    layer->chunk_snapshot_dirty.store(true);
+                }
+            }
+            chunk->snapshot_read_epoch.store(UINT64_MAX);
+            chunk->build_state.store(stale ? ChunkerChunk::BUILD_STATE_CANCELLED : ChunkerChunk::BUILD_STATE_DONE);
         }
-        tasks[layer_i].layer_task = taskflow.composed_of(tasks[layer_i].layer_taskflow).name(layer_name_std);
+
+        MutexLock lock(completed_chunks_mutex);
+        completed_chunks.push_back({
+            .layer = p_layer,
+            .chunk = Ref<ChunkerChunk>(chunk)
+        });
+    }, dependencies.ptr(), dependencies.ptr() + dependencies.size());
+
+    // A cancelled chunk for the same key might still be waiting to be collected, it gets replaced. Its task still has
+    // to run, so it is tracked until then like outdated builds that already started, which might be reading snapshots
+    ChunkLODHashMap::Iterator building_it = layer_instance.building_chunks.find(p_chunk);
+    if (building_it != layer_instance.building_chunks.end()) {
+        layer_instance.superseded_chunks.push_back(building_it->value);
+    }
+    layer_instance.building_chunks[p_chunk] = chunk_instance;
+    return true;
+}
+
+void ChunkerLayerManager::build(Rect2 p_user_requested_region, Vector2 p_reference_position, Vector2 p_velocity) {
+    if (layer_build_order.size() != layers.size()) {
+        update_layer_build_order();
+        update_layer_settings_hashes();
+        watch_settings_resources();
+    }
+
+    if (disk_cache.is_null() && ChunkDiskCache::is_enabled()) {
+        const String cache_path = GLOBAL_GET("kgame/chunker/disk_cache_path");
+        print_verbose(vformat("Chunker: Using disk cache at %s", cache_path));
+        disk_cache.instantiate(cache_path);
+        update_layer_settings_hashes();
+    }
+
+    // Extend the region to where it will be in a few seconds, so chunks are ready by the time we get there
+    const float prefetch_time = GLOBAL_GET("kgame/chunker/prefetch_time");
+    Rect2 prefetch_region = p_user_requested_region;
+    if (!p_velocity.is_zero_approx() && prefetch_time > 0.0f) {
+        Rect2 predicted_region = p_user_requested_region;
+        predicted_region.position += p_velocity * prefetch_time;
+        prefetch_region = prefetch_region.merge(predicted_region);
     }
 
-    // Now connect all of them
+    requests.clear();
+    requests.resize(layers.size());
+    // Find all leaf chunks and see what chunks they want, we can use those to propagate up a user requested region
     for (size_t layer_i = 0; layer_i < layers.size(); layer_i++) {
-        propagate_layer_taskflow_dependencies_up(layer_i);
+        requests[layer_i].reference_position = p_reference_position;
+        if (layers[layer_i].children.size() != 0) {
+            continue;
+        }
+        propagate_layer_chunks_up(layer_i, prefetch_region, p_reference_position);
     }
 
-    if (!has_chunks_to_process) {
-        return;
+    cancel_stale_chunks();
+
+    // Parents go first so their chunks can be waited on by the children
+    for (const size_t &layer_i : layer_build_order) {
+        const float chunk_size = layers[layer_i].layer->get_chunk_size();
+
+        // Schedule the chunks we will reach first first, so they get picked up first
+        LocalVector<ChunkScheduleOrder> sorted_chunks;
+        for (const ChunkLodKey &chunk : requests[layer_i].chunks_to_build) {
+            const Rect2 chunk_bounds = Rect2(Vector2(chunk.chunk) * chunk_size, Vector2(chunk_size, chunk_size));
+            sorted_chunks.push_back({
+                .key = chunk,
+                .time_to_reach = get_time_to_reach(p_user_requested_region, p_velocity, chunk_bounds),
+                .distance_squared = chunk_bounds.get_center().distance_squared_to(p_reference_position)
+            });
+        }
+        SortArray<ChunkScheduleOrder, ChunkScheduleOrderComparator> chunk_sorter;
+        chunk_sorter.sort(sorted_chunks.ptr(), sorted_chunks.size());
+
+        for (const ChunkScheduleOrder &chunk : sorted_chunks) {
+            schedule_chunk(layer_i, chunk.key);
+        }
     }
-    taskflow.name("Generation time");
-    current_future = executor.run(taskflow);
-    
-    return;
 }
 
-void ChunkerLayerManager::on_build_task_completed() {
-    current_future = tf::Future<void>();
-    get_tree()->quit();
-    return;
-    std::string graph = taskflow.dump();
-    Ref<FileAccess> fa = FileAccess::open("res://flowmap.txt", FileAccess::WRITE);
-    fa->store_string(graph.c_str());
-    fa->flush();
-    for (size_t layer_i = 0; layer_i < layers.size(); layer_i++) {
-        for (Ref<ChunkerChunk> chunk : tasks[layer_i].chunks_being_built) {
-            chunk->on_build_completed();
+float ChunkerLayerManager::get_time_to_reach(const Rect2 &p_region, const Vector2 &p_velocity, const Rect2 &p_chunk_bounds) {
+    // Swept AABB test, find the first time the region moving at p_velocity overlaps the chunk
+    float entry_time = 0.0f;
+    float exit_time = INFINITY;
+    for (int axis = 0; axis < 2; axis++) {
+        const float region_start = p_region.position[axis];
+        const float region_end = region_start + p_region.size[axis];
+        const float chunk_start = p_chunk_bounds.position[axis];
+        const float chunk_end = chunk_start + p_chunk_bounds.size[axis];
+
+        if (Math::is_zero_approx(p_velocity[axis])) {
+            if (region_end <= chunk_start || chunk_end <= region_start) {
+                return INFINITY;
+            }
+            continue;
+        }
+
+        float axis_entry = (chunk_start - region_end) / p_velocity[axis];
+        float axis_exit = (chunk_end - region_start) / p_velocity[axis];
+        if (axis_entry > axis_exit) {
+            SWAP(axis_entry, axis_exit);
         }
+        entry_time = MAX(entry_time, axis_entry);
+        exit_time = MIN(exit_time, axis_exit);
     }
+
+    if (entry_time > exit_time) {
+        return INFINITY;
+    }
+    return entry_time;
+}
+
+tf::Executor &ChunkerLayerManager::get_executor() {
+    if (!executor) {
+        const int thread_count = get_worker_thread_count();
+        print_verbose(vformat("Chunker: Starting executor with %d threads", thread_count));
+        executor = std::make_unique<tf::Executor>(thread_count);
+    }
+    return *executor;
 }
 
-void ChunkerLayerManager::update(Rect2 p_user_requested_region, Vector2 p_reference_position) {
-    if (current_future.valid()) {
-        if (current_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
-            on_build_task_completed();
+tf::TaskPriority ChunkerLayerManager::get_chunk_priority(int p_lod_level) const {
+    // Taskflow only has three priority levels, closest LOD gets to go first
+    switch (p_lod_level) {
+        case 0:
+            return tf::TaskPriority::HIGH;
+        case 1:
+            return tf::TaskPriority::NORMAL;
+        default:
+            return tf::TaskPriority::LOW;
+    }
+}
+
+int ChunkerLayerManager::get_worker_thread_count() {
+    const int thread_count = GLOBAL_GET("kgame/chunker/thread_count");
+    if (thread_count <= 0) {
+        return MAX(OS::get_singleton()->get_processor_count(), 1);
+    }
+    return thread_count;
+}
+
+void ChunkerLayerManager::process_completed_chunks() {
+    LocalVector<CompletedChunk> chunks;
+    {
+        MutexLock lock(completed_chunks_mutex);
+        SWAP(chunks, completed_chunks);
+    }
+
+    for (const CompletedChunk &completed : chunks) {
+        const ChunkLodKey key = {.chunk = completed.chunk->chunk, .lod_level = completed.chunk->lod_level};
+        ChunkLODHashMap::Iterator it = layers[completed.layer].building_chunks.find(key);
+        // Might have been replaced by a newer instance after being cancelled
+        if (it != layers[completed.layer].building_chunks.end() && it->value == completed.chunk) {
+            layers[completed.layer].building_chunks.remove(it);
+        } else {
+            layers[completed.layer].superseded_chunks.erase(completed.chunk);
         }
-        return;
+        completed.chunk->build_task.reset();
+        completed.chunk->coarse_chunk.unref();
+        if (build_timer) {
+            build_timer->untrack(completed.chunk->build_taskflow);
+        }
+        // Nothing will ever show cancelled or stale chunks, give their resources back here on the main thread
+        // rather than wherever the last reference happens to go
+        if (completed.chunk->build_state.load() == ChunkerChunk::BUILD_STATE_CANCELLED) {
+            completed.chunk->unload();
+        }
+
+        if (completed.chunk->build_state.load() == ChunkerChunk::BUILD_STATE_DONE) {
+            layers[completed.layer].pending_completions.push_back(completed.chunk);
+            if (record_build_times) {
+                if (completed.chunk->loaded_from_cache) {
+                    layers[completed.layer].cache_load_times_usec.push_back(completed.chunk->cache_load_time_usec);
+                } else {
+                    layers[completed.layer].build_times_usec.push_back(completed.chunk->build_time_usec.load());
+                }
+            }
+        }
+    }
+}
+
+void ChunkerLayerManager::commit_completed_chunks() {
+    for (ChunkerLayerInstance &layer_instance : layers) {
+        if (layer_instance.pending_completions.is_empty()) {
+            continue;
+        }
+
+        const uint64_t budget_usec = layer_instance.layer->get_completion_budget_usec();
+        const uint64_t start_usec = OS::get_singleton()->get_ticks_usec();
+        uint32_t committed = 0;
+
+        // Always commit at least one chunk so a tiny budget can't stall the queue forever
+        while (committed < layer_instance.pending_completions.size()) {
+            if (committed > 0 && OS::get_singleton()->get_ticks_usec() - start_usec >= budget_usec) {
+                break;
+            }
+            Ref<ChunkerChunk> chunk = layer_instance.pending_completions[committed];
+            committed++;
+
+            // Chunks can get unloaded before we get to them
+            ChunkerChunk::BuildState expected = ChunkerChunk::BUILD_STATE_DONE;
+            if (chunk->build_state.compare_exchange_strong(expected, ChunkerChunk::BUILD_STATE_COMMITTED)) {
+                chunk->on_build_completed();
+                layer_instance.committed_count++;
+            }
+            // The rebuild is in place, the old one can go
+            if (chunk->replaced_chunk.is_valid()) {
+                chunk->replaced_chunk->build_state.store(ChunkerChunk::BUILD_STATE_UNLOADED);
+                chunk->replaced_chunk->unload();
+                chunk->replaced_chunk.unref();
+            }
+        }
+
+        const uint32_t remaining = layer_instance.pending_completions.size() - committed;
+        for (uint32_t i = 0; i < remaining; i++) {
+            layer_instance.pending_completions[i] = layer_instance.pending_completions[committed + i];
+        }
+        layer_instance.pending_completions.resize(remaining);
+        layer_instance.deferred_count += remaining;
     }
+}
 
-    build(p_user_requested_region, p_reference_position);
+void ChunkerLayerManager::reclaim_chunk_snapshots() {
+    // Anything retired from now on is newer than this, so it can't be freed by accident
+    uint64_t oldest_epoch_in_use = snapshot_epoch.load();
+    for (const ChunkerLayerInstance &layer_instance : layers) {
+        for (const KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &kv : layer_instance.building_chunks) {
+            oldest_epoch_in_use = MIN(oldest_epoch_in_use, kv.value->snapshot_read_epoch.load());
+        }
+        for (const Ref<ChunkerChunk> &chunk : layer_instance.superseded_chunks) {
+            oldest_epoch_in_use = MIN(oldest_epoch_in_use, chunk->snapshot_read_epoch.load());
+        }
+    }
+
+    for (ChunkerLayerInstance &layer_instance : layers) {
+        layer_instance.layer->reclaim_chunk_snapshots(oldest_epoch_in_use);
+    }
+}
+
+ChunkerLayerManager::CompletionQueueStats ChunkerLayerManager::get_completion_queue_stats(StringName p_layer_name) const {
+    HashMap<StringName, int>::ConstIterator it = layer_name_map.find(p_layer_name);
+    ERR_FAIL_COND_V(it == layer_name_map.end(), CompletionQueueStats());
+    const ChunkerLayerInstance &layer_instance = layers[it->value];
+    return {
+        .queued = (int)layer_instance.pending_completions.size(),
+        .committed = layer_instance.committed_count,
+        .deferred = layer_instance.deferred_count
+    };
+}
+
+void ChunkerLayerManager::update(Rect2 p_user_requested_region, Vector2 p_reference_position, Vector2 p_velocity) {
+    process_completed_chunks();
+    for (ChunkerLayerInstance &layer_instance : layers) {
+        layer_instance.layer->publish_chunk_snapshot_if_dirty();
+    }
+    reclaim_chunk_snapshots();
+    commit_completed_chunks();
+    apply_settings_changes();
+    build(p_user_requested_region, p_reference_position, p_velocity);
     cleanup_chunks();
 }
 
 void ChunkerLayerManager::cleanup_chunks() {
+    const uint64_t now_usec = OS::get_singleton()->get_ticks_usec();
     for (size_t i = 0; i < layers.size(); i++) {
+        ChunkerLayerInstance &layer_instance = layers[i];
+        const bool can_cache = layer_instance.layer->can_cache_chunks();
         LocalVector<Pair<Vector2i, int>> chunks_to_unload;
-        for (KeyValue<Vector2i, Ref<ChunkerChunk>> chunk : layers[i].layer->loaded_chunks) {
-            int desired_lod_level = get_lod_level_for_chunk(chunk.value->bounds, tasks[i].reference_position);
-            if (!chunk.value->bounds.intersects(tasks[i].total_requested_region) || desired_lod_level != chunk.value->lod_level) {
+        layer_instance.memory_usage = 0;
+        layer_instance.cached_memory_usage = 0;
+        {
+            MutexLock lock(layer_instance.layer->loaded_chunks_mutex);
+            for (const KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &chunk : layer_instance.layer->loaded_chunks_lod) {
+                const uint64_t chunk_memory_usage = chunk.value->get_memory_usage();
+                layer_instance.memory_usage += chunk_memory_usage;
+
+                int desired_lod_level = get_lod_level_for_chunk(chunk.value->bounds, requests[i].reference_position);
+                if (chunk.value->bounds.intersects(requests[i].total_requested_region) && desired_lod_level == chunk.value->lod_level) {
+                    layer_instance.cached_chunks.erase(chunk.key);
+                    continue;
+                }
+
+                // Keep it around until the memory budget says otherwise, we might come back
+                if (can_cache) {
+                    if (!layer_instance.cached_chunks.has(chunk.key)) {
+                        layer_instance.cached_chunks.insert(chunk.key, now_usec);
+                    }
+                    layer_instance.cached_memory_usage += chunk_memory_usage;
+                    continue;
+                }
+
+                // Chunks that are still building on other threads might be reading from us
+                if (is_chunk_needed_by_children(i, chunk.value->bounds)) {
+                    continue;
+                }
                 chunks_to_unload.push_back(Pair<Vector2i, int>(chunk.value->chunk, chunk.value->lod_level));
             }
         }
-        layers[i].layer->unload_chunks(chunks_to_unload);
+        layer_instance.layer->unload_chunks(chunks_to_unload);
+    }
+
+    evict_cached_chunks();
+}
+
+void ChunkerLayerManager::evict_cached_chunks() {
+    struct EvictionCandidate {
+        size_t layer;
+        ChunkLodKey key;
+        Rect2 bounds;
+        uint64_t cached_at_usec;
+        uint64_t memory_usage;
+    };
+    struct EvictionCandidateComparator {
+        _FORCE_INLINE_ bool operator()(const EvictionCandidate &p_a, const EvictionCandidate &p_b) const {
+            return p_a.cached_at_usec < p_b.cached_at_usec;
+        }
+    };
+
+    uint64_t total_memory_usage = 0;
+    LocalVector<EvictionCandidate> candidates;
+    for (size_t i = 0; i < layers.size(); i++) {
+        total_memory_usage += layers[i].memory_usage;
+        MutexLock lock(layers[i].layer->loaded_chunks_mutex);
+        for (const KeyValue<ChunkLodKey, uint64_t> &kv : layers[i].cached_chunks) {
+            ChunkLODHashMap::ConstIterator it = layers[i].layer->loaded_chunks_lod.find(kv.key);
+            DEV_ASSERT(it != layers[i].layer->loaded_chunks_lod.end());
+            candidates.push_back({
+                .layer = i,
+                .key = kv.key,
+                .bounds = it->value->bounds,
+                .cached_at_usec = kv.value,
+                .memory_usage = it->value->get_memory_usage()
+            });
+        }
+    }
+
+    const uint64_t memory_budget = get_memory_budget();
+    if (total_memory_usage <= memory_budget) {
+        return;
+    }
+
+    // Least recently used first
+    SortArray<EvictionCandidate, EvictionCandidateComparator> candidate_sorter;
+    candidate_sorter.sort(candidates.ptr(), candidates.size());
+
+    LocalVector<LocalVector<Pair<Vector2i, int>>> chunks_to_unload;
+    chunks_to_unload.resize(layers.size());
+    for (const EvictionCandidate &candidate : candidates) {
+        if (total_memory_usage <= memory_budget) {
+            break;
+        }
+        if (is_chunk_needed_by_children(candidate.layer, candidate.bounds)) {
+            continue;
+        }
+        chunks_to_unload[candidate.layer].push_back(Pair<Vector2i, int>(candidate.key.chunk, candidate.key.lod_level));
+        layers[candidate.layer].cached_chunks.erase(candidate.key);
+        layers[candidate.layer].memory_usage -= candidate.memory_usage;
+        layers[candidate.layer].cached_memory_usage -= MIN(candidate.memory_usage, layers[candidate.layer].cached_memory_usage);
+        layers[candidate.layer].evicted_count++;
+        total_memory_usage -= candidate.memory_usage;
+    }
+
+    for (size_t i = 0; i < layers.size(); i++) {
+        layers[i].layer->unload_chunks(chunks_to_unload[i]);
+    }
+}
+
+bool ChunkerLayerManager::evict_cached_chunk_for_lod(size_t p_layer, int p_lod_level) {
+    ChunkerLayerInstance &layer_instance = layers[p_layer];
+    bool found = false;
+    ChunkLodKey oldest_key;
+    uint64_t oldest_usec = UINT64_MAX;
+    {
+        MutexLock lock(layer_instance.layer->loaded_chunks_mutex);
+        for (const KeyValue<ChunkLodKey, uint64_t> &kv : layer_instance.cached_chunks) {
+            if (kv.key.lod_level != p_lod_level || kv.value >= oldest_usec) {
+                continue;
+            }
+            ChunkLODHashMap::ConstIterator it = layer_instance.layer->loaded_chunks_lod.find(kv.key);
+            if (it == layer_instance.layer->loaded_chunks_lod.end() || is_chunk_needed_by_children(p_layer, it->value->bounds)) {
+                continue;
+            }
+            oldest_key = kv.key;
+            oldest_usec = kv.value;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    LocalVector<Pair<Vector2i, int>> chunks_to_unload;
+    chunks_to_unload.push_back(Pair<Vector2i, int>(oldest_key.chunk, oldest_key.lod_level));
+    layer_instance.cached_chunks.erase(oldest_key);
+    layer_instance.evicted_count++;
+    layer_instance.layer->unload_chunks(chunks_to_unload);
+    return true;
+}
+
+uint64_t ChunkerLayerManager::get_memory_budget() {
+    return (uint64_t)(int64_t)GLOBAL_GET("kgame/chunker/memory_budget_mb") * 1024 * 1024;
+}
+
+uint64_t ChunkerLayerManager::get_total_memory_usage() const {
+    uint64_t total_memory_usage = 0;
+    for (const ChunkerLayerInstance &layer_instance : layers) {
+        total_memory_usage += layer_instance.memory_usage;
+    }
+    return total_memory_usage;
+}
+
+void ChunkerLayerManager::set_record_build_times(bool p_record_build_times) {
+    // Observers can't be added or removed while the executor is running tasks
+    ERR_FAIL_COND_MSG(!is_idle(), "Build time recording can only be toggled while the chunker is idle.");
+    record_build_times = p_record_build_times;
+    if (record_build_times && !build_timer) {
+        build_timer = get_executor().make_observer<ChunkBuildTimer>();
+    } else if (!record_build_times && build_timer) {
+        get_executor().remove_observer(build_timer);
+        build_timer.reset();
+    }
+    if (!record_build_times) {
+        for (ChunkerLayerInstance &layer_instance : layers) {
+            layer_instance.build_times_usec.reset();
+            layer_instance.cache_load_times_usec.reset();
+        }
+    }
+}
+
+LocalVector<uint64_t> ChunkerLayerManager::get_build_times_usec(StringName p_layer_name) const {
+    HashMap<StringName, int>::ConstIterator it = layer_name_map.find(p_layer_name);
+    ERR_FAIL_COND_V(it == layer_name_map.end(), LocalVector<uint64_t>());
+    return layers[it->value].build_times_usec;
+}
+
+LocalVector<uint64_t> ChunkerLayerManager::get_cache_load_times_usec(StringName p_layer_name) const {
+    HashMap<StringName, int>::ConstIterator it = layer_name_map.find(p_layer_name);
+    ERR_FAIL_COND_V(it == layer_name_map.end(), LocalVector<uint64_t>());
+    return layers[it->value].cache_load_times_usec;
+}
+
+bool ChunkerLayerManager::is_idle() const {
+    for (const ChunkerLayerInstance &layer_instance : layers) {
+        if (!layer_instance.building_chunks.is_empty() || !layer_instance.superseded_chunks.is_empty() || !layer_instance.pending_completions.is_empty()) {
+            return false;
+        }
     }
+    return true;
+}
+
+ChunkerLayerManager::MemoryStats ChunkerLayerManager::get_memory_stats(StringName p_layer_name) const {
+    HashMap<StringName, int>::ConstIterator it = layer_name_map.find(p_layer_name);
+    ERR_FAIL_COND_V(it == layer_name_map.end(), MemoryStats());
+    const ChunkerLayerInstance &layer_instance = layers[it->value];
+    int loaded = 0;
+    {
+        MutexLock lock(layer_instance.layer->loaded_chunks_mutex);
+        loaded = layer_instance.layer->loaded_chunks_lod.size();
+    }
+    return {
+        .loaded = loaded,
+        .cached = (int)layer_instance.cached_chunks.size(),
+        .memory_usage = layer_instance.memory_usage,
+        .cached_memory_usage = layer_instance.cached_memory_usage,
+        .evicted = layer_instance.evicted_count
+    };
 }
 
 ChunkerLayerManager* ChunkerLayer::get_manager() const {
     return manager;
 }
 
+Ref<Resource> ChunkerLayer::get_settings_snapshot(const String &p_project_setting) const {
+    ERR_FAIL_NULL_V(manager, Ref<Resource>());
+    return manager->get_settings_snapshot(p_project_setting);
+}
+
+uint64_t ChunkerLayer::get_completion_budget_usec() const {
+    return (int64_t)GLOBAL_GET("kgame/chunker/completion_budget_usec");
+}
+
 LocalVector<ChunkerLayer::RequestedChunk> ChunkerLayer::get_requested_chunks(const Rect2 &p_user_requested_region, const Vector2 &p_reference_position) const {
     const float chunk_size = get_chunk_size();
     const int start_chunk_x = Math::floor(p_user_requested_region.position.x / chunk_size);
@@ -188,19 +922,176 @@ LocalVector<ChunkerLayer::RequestedChunk> ChunkerLayer::get_requested_chunks(con
     return chunks;
 }
 
+Vector2 ChunkerLayer::get_sample_grid_step(const Rect2 &p_region, const Vector2i &p_sample_count) {
+    Vector2 step;
+    step.x = p_sample_count.x > 1 ? p_region.size.x / (p_sample_count.x - 1) : 0.0f;
+    step.y = p_sample_count.y > 1 ? p_region.size.y / (p_sample_count.y - 1) : 0.0f;
+    return step;
+}
+
+LocalVector<ChunkerLayer::SampleGridSpan> ChunkerLayer::get_sample_grid_spans(const Rect2 &p_region, const Vector2i &p_sample_count) const {
+    LocalVector<SampleGridSpan> spans;
+    ERR_FAIL_COND_V(p_sample_count.x <= 0 || p_sample_count.y <= 0, spans);
+    ERR_FAIL_COND_V(p_region.size.x < 0.0f || p_region.size.y < 0.0f, spans);
+
+    const float chunk_size = get_chunk_size();
+    const Vector2 step = get_sample_grid_step(p_region, p_sample_count);
+
+    // Per axis, the range of sample indices that land in each chunk
+    LocalVector<Pair<int, Vector2i>> axis_ranges[2];
+    for (int axis = 0; axis < 2; axis++) {
+        const float origin = p_region.position[axis];
+        if (step[axis] == 0.0f) {
+            axis_ranges[axis].push_back(Pair<int, Vector2i>(Math::floor(origin / chunk_size), Vector2i(0, p_sample_count[axis])));
+            continue;
+        }
+        const int first_chunk = Math::floor(origin / chunk_size);
+        const int last_chunk = Math::floor((origin + step[axis] * (p_sample_count[axis] - 1)) / chunk_size);
+        for (int chunk = first_chunk; chunk <= last_chunk; chunk++) {
+            const int start = CLAMP((int)Math::ceil((chunk * chunk_size - origin) / step[axis]), 0, p_sample_count[axis]);
+            const int end = CLAMP((int)Math::ceil(((chunk + 1) * chunk_size - origin) / step[axis]), 0, p_sample_count[axis]);
+            if (start < end) {
+                axis_ranges[axis].push_back(Pair<int, Vector2i>(chunk, Vector2i(start, end)));
+            }
+        }
+    }
+
+    const HashMap<Vector2i, Ref<ChunkerChunk>> &chunks = get_chunks_snapshot();
+    for (const Pair<int, Vector2i> &range_y : axis_ranges[1]) {
+        for (const Pair<int, Vector2i> &range_x : axis_ranges[0]) {
+            const Vector2i chunk = Vector2i(range_x.first, range_y.first);
+            HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = chunks.find(chunk);
+            SampleGridSpan span;
+            span.start = Vector2i(range_x.second.x, range_y.second.x);
+            span.end = Vector2i(range_x.second.y, range_y.second.y);
+            if (it != chunks.end()) {
+                span.chunk = it->value.ptr();
+            } else {
+                ERR_PRINT(vformat("Tried to sample chunk that doesn't exist %s (%s)", chunk, p_region));
+            }
+            spans.push_back(span);
+        }
+    }
+    return spans;
+}
+
 void ChunkerLayer::unload_chunks(const LocalVector<Pair<Vector2i, int>> &p_chunks_to_unload) {
-    for (Pair<Vector2i, int> chunk : p_chunks_to_unload) {
-        const ChunkLodKey key = {
-            .chunk = chunk.first,
-            .lod_level = chunk.second
-        };
-        ChunkLODHashMap::Iterator it = loaded_chunks_lod.find(key);
-        DEV_ASSERT(it != loaded_chunks_lod.end());
-        print_line("UNLOAD CHUNK!", chunk.first, get_class_name());
-        if (loaded_chunks.find(chunk.first)->value == it->value) {
-            loaded_chunks.erase(chunk.first);
-        }
-        it->value->unload();
-        loaded_chunks_lod.erase(key);
+    if (p_chunks_to_unload.is_empty()) {
+        return;
+    }
+
+    LocalVector<Ref<ChunkerChunk>> unloaded_chunks;
+    {
+        MutexLock lock(loaded_chunks_mutex);
+        for (Pair<Vector2i, int> chunk : p_chunks_to_unload) {
+            const ChunkLodKey key = {
+                .chunk = chunk.first,
+                .lod_level = chunk.second
+            };
+            ChunkLODHashMap::Iterator it = loaded_chunks_lod.find(key);
+            DEV_ASSERT(it != loaded_chunks_lod.end());
+            Ref<ChunkerChunk> chunk_instance = it->value;
+            HashMap<Vector2i, Ref<ChunkerChunk>>::Iterator loaded_it = loaded_chunks.find(chunk.first);
+            if (loaded_it != loaded_chunks.end() && loaded_it->value == chunk_instance) {
+                loaded_chunks.remove(loaded_it);
+            }
+            loaded_chunks_lod.remove(it);
+            unloaded_chunks.push_back(chunk_instance);
+        }
+        publish_chunk_snapshot();
+    }
+
+    for (Ref<ChunkerChunk> &chunk_instance : unloaded_chunks) {
+        print_line("UNLOAD CHUNK!", chunk_instance->chunk, get_class_name());
+        chunk_instance->build_state.store(ChunkerChunk::BUILD_STATE_UNLOADED);
+        chunk_instance->unload();
+    }
+}
+
+void ChunkerLayer::publish_chunk_snapshot() {
+    chunk_snapshot_dirty.store(false);
+    ChunkSnapshot *snapshot = memnew(ChunkSnapshot);
+    snapshot->chunks = loaded_chunks;
+    ChunkSnapshot *old_snapshot = chunk_snapshot.exchange(snapshot);
+    if (old_snapshot) {
+        old_snapshot->retired_epoch = manager->snapshot_epoch.fetch_add(1);
+        retired_snapshots.push_back(old_snapshot);
+    }
+}
+
+void ChunkerLayer::publish_chunk_snapshot_if_dirty() {
+    if (!chunk_snapshot_dirty.load()) {
+        return;
+    }
+    MutexLock lock(loaded_chunks_mutex);
+    if (chunk_snapshot_dirty.load()) {
+        publish_chunk_snapshot();
+    }
+}
+
+void ChunkerLayer::restore_chunk(const ChunkLodKey &p_chunk) {
+    MutexLock lock(loaded_chunks_mutex);
+    ChunkLODHashMap::Iterator it = loaded_chunks_lod.find(p_chunk);
+    ERR_FAIL_COND(it == loaded_chunks_lod.end());
+    // Another LOD of the same chunk might have taken its place in the meantime
+    HashMap<Vector2i, Ref<ChunkerChunk>>::Iterator loaded_it = loaded_chunks.find(p_chunk.chunk);
+    if (loaded_it != loaded_chunks.end() && loaded_it->value == it->value) {
+        return;
+    }
+    loaded_chunks[p_chunk.chunk] = it->value;
+    publish_chunk_snapshot();
+}
+
+bool ChunkerLayer::is_chunk_stale(const ChunkLodKey &p_chunk) const {
+    MutexLock lock(loaded_chunks_mutex);
+    ChunkLODHashMap::ConstIterator it = loaded_chunks_lod.find(p_chunk);
+    return it != loaded_chunks_lod.end() && it->value->settings_generation != settings_generation.load();
+}
+
+Ref<ChunkerChunk> ChunkerLayer::get_coarser_chunk(const Vector2i &p_chunk, int p_lod_level) const {
+    MutexLock lock(loaded_chunks_mutex);
+    HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = loaded_chunks.find(p_chunk);
+    // Stale chunks can't be refined, their samples came from other settings
+    if (it == loaded_chunks.end() || it->value->lod_level <= p_lod_level || it->value->settings_generation != settings_generation.load()) {
+        return Ref<ChunkerChunk>();
+    }
+    return it->value;
+}
+
+void ChunkerLayer::reclaim_chunk_snapshots(uint64_t p_oldest_epoch_in_use) {
+    MutexLock lock(loaded_chunks_mutex);
+    for (uint32_t i = 0; i < retired_snapshots.size();) {
+        // Readers that started at or before the retirement might still be looking at it
+        if (retired_snapshots[i]->retired_epoch < p_oldest_epoch_in_use) {
+            memdelete(retired_snapshots[i]);
+            retired_snapshots.remove_at_unordered(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+ChunkerChunk *ChunkerLayer::find_current_chunk(const Vector2i &p_chunk, int p_lod_level) const {
+    const HashMap<Vector2i, Ref<ChunkerChunk>> &chunks = get_chunks_snapshot();
+    HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = chunks.find(p_chunk);
+    if (it == chunks.end() || (p_lod_level != -1 && it->value->lod_level != p_lod_level) || it->value->settings_generation != settings_generation.load()) {
+        return nullptr;
+    }
+    return it->value.ptr();
+}
+
+const HashMap<Vector2i, Ref<ChunkerChunk>> &ChunkerLayer::get_chunks_snapshot() const {
+    static const HashMap<Vector2i, Ref<ChunkerChunk>> empty_chunks;
+    const ChunkSnapshot *snapshot = chunk_snapshot.load();
+    return snapshot ? snapshot->chunks : empty_chunks;
+}
+
+ChunkerLayer::~ChunkerLayer() {
+    for (ChunkSnapshot *snapshot : retired_snapshots) {
+        memdelete(snapshot);
+    }
+    ChunkSnapshot *snapshot = chunk_snapshot.load();
+    if (snapshot) {
+        memdelete(snapshot);
     }
 }
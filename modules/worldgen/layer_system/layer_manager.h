@@ -10,17 +10,49 @@
 #include "core/templates/hash_set.h"
 #include "core/templates/hashfuncs.h"
 #include "core/variant/variant.h"
+#include "chunk_disk_cache.h"
+#include "chunk_build_timer.h"
 #include "scene/main/node.h"
 #include "worldgen/thirdparty/taskflow/core/executor.hpp"
+#include <atomic>
 #include <future>
+#include <memory>
 #include <string>
 class ChunkerLayerManager;
 class ChunkerDebugger;
 class ChunkerChunk : public RefCounted {
+public:
+    enum BuildState {
+        BUILD_STATE_QUEUED,
+        BUILD_STATE_RUNNING,
+        BUILD_STATE_CANCELLED,
+        BUILD_STATE_DONE,
+        BUILD_STATE_COMMITTED,
+        BUILD_STATE_UNLOADED,
+    };
+private:
+    // Build bookkeeping, owned by the manager
+    tf::Taskflow build_taskflow;
+    tf::AsyncTask build_task;
+    std::atomic<BuildState> build_state = BUILD_STATE_QUEUED;
+    // Snapshot epoch the build started reading at, UINT64_MAX while not building
+    std::atomic<uint64_t> snapshot_read_epoch = UINT64_MAX;
+    // Time spent in the tasks of build_taskflow, only measured while build times are being recorded
+    std::atomic<uint64_t> build_time_usec = 0;
+    // Loading from the disk cache is timed on its own, it has nothing to do with how long building takes
+    uint64_t cache_load_time_usec = 0;
+    bool loaded_from_cache = false;
+    // Settings generation of the layer when this chunk got scheduled, chunks from older generations get rebuilt
+    uint32_t settings_generation = 0;
+    // Older build of the same chunk that this one took the place of, unloaded once we are committed
+    Ref<ChunkerChunk> replaced_chunk;
 protected:
     Rect2 bounds;
     Vector2i chunk;
     int lod_level = 0;
+    // Coarser LOD of this chunk that was loaded when we got scheduled, layers that can refine chunks may reuse its data.
+    // Only valid during build()
+    Ref<ChunkerChunk> coarse_chunk;
 public:
     virtual void build(tf::Taskflow &p_taskflow) {
 
@@ -35,13 +67,33 @@ public:
 
     }
 
+    // Disk cache support, load_from_cache has to leave the chunk in the same state build() would
+    virtual bool is_cacheable() const {
+        return false;
+    }
+
+    virtual void save_to_cache(const Ref<FileAccess> &p_file) const {
+
+    }
+
+    virtual bool load_from_cache(const Ref<FileAccess> &p_file) {
+        return false;
+    }
+
     Rect2 get_bounds() const {
         return bounds;
     }
 
+    // Rough amount of memory held by the chunk, GPU resources included
+    virtual uint64_t get_memory_usage() const {
+        return 0;
+    }
+
     virtual ~ChunkerChunk() {};
+    friend class ChunkerLayer;
     friend class ChunkerLayerManager;
     friend class ChunkerDebugger;
+    friend class ChunkDiskCache;
 };
 
 struct ChunkLodKey {
@@ -62,16 +114,58 @@ struct HashMapComparatorChunkLodKey {
     }
 };
 
+struct ChunkScheduleOrder {
+    ChunkLodKey key;
+    // Seconds until the moving requested region reaches the chunk, INFINITY if it never does
+    float time_to_reach = 0.0f;
+    float distance_squared = 0.0f;
+};
+
+struct ChunkScheduleOrderComparator {
+    _FORCE_INLINE_ bool operator()(const ChunkScheduleOrder &p_a, const ChunkScheduleOrder &p_b) const {
+        if (p_a.time_to_reach != p_b.time_to_reach) {
+            return p_a.time_to_reach < p_b.time_to_reach;
+        }
+        return p_a.distance_squared < p_b.distance_squared;
+    }
+};
+
 typedef HashMap<ChunkLodKey, Ref<ChunkerChunk>, HashMapHasherChunkLodKey, HashMapComparatorChunkLodKey> ChunkLODHashMap;
 typedef HashSet<ChunkLodKey, HashMapHasherChunkLodKey, HashMapComparatorChunkLodKey> ChunkLODHashSet;
 
 class ChunkerLayer : public RefCounted {
 private:
     ChunkerLayerManager* manager;
-    Mutex loaded_chunks_mutex;
 
     ChunkLODHashMap loaded_chunks_lod;
+    // Bumped by the manager whenever the settings of this layer or one of its parents change
+    std::atomic<uint32_t> settings_generation = 0;
+
+    // Immutable copy of loaded_chunks that the executor threads can read without locking
+    struct ChunkSnapshot {
+        HashMap<Vector2i, Ref<ChunkerChunk>> chunks;
+        // Manager snapshot epoch at the time this snapshot was replaced
+        uint64_t retired_epoch = 0;
+    };
+    std::atomic<ChunkSnapshot *> chunk_snapshot = nullptr;
+    // Replaced snapshots that might still be read by chunks that are building, guarded by loaded_chunks_mutex
+    LocalVector<ChunkSnapshot *> retired_snapshots;
+
+    // Set when loaded_chunks changed without publishing, stores from the executor threads are published in bulk
+    std::atomic<bool> chunk_snapshot_dirty = false;
+
+    // Must be called with loaded_chunks_mutex held
+    void publish_chunk_snapshot();
+    void publish_chunk_snapshot_if_dirty();
+    // Makes a chunk that was kept around the one returned by position lookups again
+    void restore_chunk(const ChunkLodKey &p_chunk);
+    Ref<ChunkerChunk> get_coarser_chunk(const Vector2i &p_chunk, int p_lod_level) const;
+    // Whether the loaded chunk was built with settings that have changed since
+    bool is_chunk_stale(const ChunkLodKey &p_chunk) const;
+    void reclaim_chunk_snapshots(uint64_t p_oldest_epoch_in_use);
 protected:
+    // Chunks are stored from the executor threads while the main thread reads them
+    Mutex loaded_chunks_mutex;
     HashMap<Vector2i, Ref<ChunkerChunk>> loaded_chunks;
     ChunkerLayerManager* get_manager() const;
     LocalVector<ChunkerLayer*> children;
@@ -84,6 +178,56 @@ protected:
     virtual float get_chunk_padding() const {
         return 0.0f;
     }
+
+    // How the resolution of a chunk scales with its LOD level
+    virtual float get_lod_resolution_scale(int p_lod_level) const {
+        return 1.0f;
+    }
+
+    int get_lod_resolution(int p_base_resolution, int p_lod_level) const {
+        return MAX(1, (int)(p_base_resolution * get_lod_resolution_scale(p_lod_level)));
+    }
+
+    // Whether chunks get handed the coarser LOD of themselves when the camera gets closer
+    virtual bool can_refine_chunks() const {
+        return false;
+    }
+
+    // Whether chunks that go out of range can be kept loaded in case they are needed again
+    virtual bool can_cache_chunks() const {
+        return true;
+    }
+
+    // Layers with a fixed amount of slots per LOD (like GPU textures) can ask for cached chunks to be evicted
+    virtual bool has_room_for_chunk(int p_lod_level) const {
+        return true;
+    }
+
+    // Main thread time that can be spent in on_build_completed per frame
+    virtual uint64_t get_completion_budget_usec() const;
+
+    struct SampleGridSpan {
+        ChunkerChunk *chunk = nullptr;
+        // Sample indices covered by the chunk, end is exclusive
+        Vector2i start;
+        Vector2i end;
+    };
+    static Vector2 get_sample_grid_step(const Rect2 &p_region, const Vector2i &p_sample_count);
+    // Splits a grid of samples into the block that falls in each chunk, so every chunk only has to be looked up once
+    LocalVector<SampleGridSpan> get_sample_grid_spans(const Rect2 &p_region, const Vector2i &p_sample_count) const;
+
+    // Anything that changes what this layer generates has to go in here, parent layers are already accounted for
+    virtual uint32_t get_settings_hash() const {
+        return HASH_MURMUR3_SEED;
+    }
+
+    // Resources that go into get_settings_hash, sub resources included. Editing any of them rebuilds the layer
+    virtual void get_settings_resources(LocalVector<Ref<Resource>> &r_resources) const {
+
+    }
+
+    // Chunks must get their settings resources from here instead of loading them, see ChunkerLayerManager::get_settings_snapshot
+    Ref<Resource> get_settings_snapshot(const String &p_project_setting) const;
 public:
     struct RequestedChunk {
         Vector2i chunk;
@@ -95,11 +239,23 @@ public:
     virtual LocalVector<RequestedChunk> get_requested_chunks(const Rect2 &p_user_requested_region, const Vector2 &p_reference_position) const;
     void unload_chunks(const LocalVector<Pair<Vector2i, int>> &p_chunks_to_unload);
     
+    // Lock free lookups, these are safe from chunks that are building and from the main thread
+    const HashMap<Vector2i, Ref<ChunkerChunk>> &get_chunks_snapshot() const;
+
+    ChunkerChunk *find_chunk_at_world_position(const Vector2 &p_world_position) const {
+        const Vector2i chunk = Vector2(p_world_position / get_chunk_size()).floor();
+        const HashMap<Vector2i, Ref<ChunkerChunk>> &chunks = get_chunks_snapshot();
+        HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = chunks.find(chunk);
+        ERR_FAIL_COND_V_MSG(it == chunks.end(), nullptr, "Tried to get chunk at position that doesn't exist");
+        return it->value.ptr();
+    }
+
+    // Loaded chunk with the given LOD that was built with the current settings, or null. Used to reuse the borders of neighbours.
+    // A p_lod_level of -1 takes any LOD, for layers whose chunks come out the same at every LOD
+    ChunkerChunk *find_current_chunk(const Vector2i &p_chunk, int p_lod_level) const;
+
     Ref<ChunkerChunk> get_chunk_at_world_position(Vector2 p_world_position) const {
-        Vector2i chunk = Vector2(p_world_position / get_chunk_size()).floor();
-        HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = loaded_chunks.find(chunk);
-        ERR_FAIL_COND_V_MSG(it == loaded_chunks.end(), Ref<ChunkerChunk>(), "Tried to get chunk at position that doesn't exist");
-        return it->value;
+        return Ref<ChunkerChunk>(find_chunk_at_world_position(p_world_position));
     }
 
     LocalVector<Ref<ChunkerChunk>> get_chunks_at_world_bounds(Rect2 p_world_rect) {
@@ -108,12 +264,13 @@ public:
         Vector2i chunk_end = Vector2(p_world_rect.get_end() / chunk_size).floor();
 
         LocalVector<Ref<ChunkerChunk>> chunks;
+        const HashMap<Vector2i, Ref<ChunkerChunk>> &snapshot = get_chunks_snapshot();
 
         for (int x = chunk_start.x; x < chunk_end.x+1; x++) {
-            for (int y = chunk_start.y; x < chunk_end.y+1; y++) {
+            for (int y = chunk_start.y; y < chunk_end.y+1; y++) {
                 const Vector2i chunk = Vector2i(x, y);
-                HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = loaded_chunks.find(chunk);
-                ERR_FAIL_COND_V_MSG(it == loaded_chunks.end(), LocalVector<Ref<ChunkerChunk>>(), vformat("Tried to get chunk at position that doesn't exist %s (%s)", chunk, p_world_rect));
+                HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = snapshot.find(chunk);
+                ERR_FAIL_COND_V_MSG(it == snapshot.end(), LocalVector<Ref<ChunkerChunk>>(), vformat("Tried to get chunk at position that doesn't exist %s (%s)", chunk, p_world_rect));
                 chunks.push_back(it->value);
             }
         }
@@ -121,26 +278,28 @@ public:
         return chunks;
     }
 
+    // Resamples p_region at p_sample_count evenly spaced points, edges included, into r_values in row major order
+    virtual void sample_region(const Rect2 &p_region, const Vector2i &p_sample_count, float *r_values) const {
+        ERR_FAIL_MSG("This layer doesn't support region sampling.");
+    }
+
     bool has_chunk(Vector2i p_chunk, int p_lod_level) const {
         ChunkLodKey key = {
             .chunk = p_chunk,
             .lod_level = p_lod_level
         };
+        MutexLock lock(loaded_chunks_mutex);
         return loaded_chunks_lod.has(key);
     }
 
     virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const = 0;
+    virtual ~ChunkerLayer();
     friend class ChunkerLayerManager;
     friend class ChunkerDebugger;
 };
 
-struct ChunkerLayerTask {
+struct ChunkerLayerRequest {
     ChunkLODHashSet chunks_to_build;
-    LocalVector<Ref<ChunkerChunk>> chunks_being_built;
-    tf::Taskflow layer_taskflow;
-    tf::Task layer_task;
-    LocalVector<tf::Taskflow> chunk_taskflows;
-    LocalVector<tf::Task> chunk_tasks;
     Rect2 total_requested_region;
     Vector2 reference_position;
 };
@@ -152,14 +311,52 @@ class ChunkerLayerManager : public Node {
         LocalVector<size_t> children;
         Ref<ChunkerLayer> layer;
         StringName name;
+        // Chunks handed to the executor that haven't been collected by the main thread yet
+        ChunkLODHashMap building_chunks;
+        // Chunks whose task hadn't finished when a newer build took their place in building_chunks, kept until collected
+        LocalVector<Ref<ChunkerChunk>> superseded_chunks;
+        // Built chunks waiting for their on_build_completed, in order of completion
+        LocalVector<Ref<ChunkerChunk>> pending_completions;
+        uint64_t committed_count = 0;
+        uint64_t deferred_count = 0;
+        // Out of range chunks that are kept loaded until the memory budget needs them gone, with the time they went out of range
+        HashMap<ChunkLodKey, uint64_t, HashMapHasherChunkLodKey, HashMapComparatorChunkLodKey> cached_chunks;
+        uint64_t memory_usage = 0;
+        uint64_t cached_memory_usage = 0;
+        uint64_t evicted_count = 0;
+        // Only filled in while build times are being recorded
+        LocalVector<uint64_t> build_times_usec;
+        LocalVector<uint64_t> cache_load_times_usec;
+        // Includes the hashes of all parents, used to key the disk cache
+        uint32_t settings_hash = 0;
+    };
+    struct CompletedChunk {
+        size_t layer;
+        Ref<ChunkerChunk> chunk;
     };
     LocalVector<ChunkerLayerInstance> layers;
     HashMap<StringName, int> layer_name_map;
-    LocalVector<ChunkerLayerTask> tasks;
-    tf::Taskflow taskflow;
-    tf::Future<void> current_future;
-    tf::Executor executor;
+    LocalVector<ChunkerLayerRequest> requests;
+    // Layers sorted so that parents always come before their children
+    LocalVector<size_t> layer_build_order;
+    Mutex completed_chunks_mutex;
+    LocalVector<CompletedChunk> completed_chunks;
+    // Created lazily so instances made by ClassDB/the editor don't spawn worker threads
+    std::unique_ptr<tf::Executor> executor;
+    // Bumped every time a layer replaces its chunk snapshot
+    std::atomic<uint64_t> snapshot_epoch = 0;
+    Ref<ChunkDiskCache> disk_cache;
     PackedFloat32Array lod_max_distances;
+    bool record_build_times = false;
+    // Attached to the executor while build times are being recorded
+    std::shared_ptr<ChunkBuildTimer> build_timer;
+    // Settings resources of all layers and their sub resources, we rebuild whatever they affect when they change
+    LocalVector<Ref<Resource>> watched_settings_resources;
+    // Copies of the settings resources handed to chunks, keyed by project setting. Dropped on every change
+    HashMap<String, Ref<Resource>> settings_snapshots;
+    bool settings_changed = false;
+    // Bumped as soon as a settings resource changes, builds that saw it change don't go into the disk cache
+    std::atomic<uint32_t> settings_change_count = 0;
 public:
     void insert_layer(StringName p_layer_name, Ref<ChunkerLayer> p_layer);
 
@@ -167,13 +364,71 @@ public:
 private:
     void propagate_layer_chunks_up(size_t p_layer, const Rect2 &p_requested_region, const Vector2 &p_reference_position);
 
-    void propagate_layer_taskflow_dependencies_up(size_t p_layer);
+    void update_layer_build_order();
+    void update_layer_settings_hashes();
+
+    static void collect_settings_resources(const Variant &p_value, LocalVector<Ref<Resource>> &r_resources);
+    // Like Resource::duplicate(true), but also copies the resources inside arrays and dictionaries
+    static Variant duplicate_settings_variant(const Variant &p_value, HashMap<const Resource *, Ref<Resource>> &r_duplicates);
+    void watch_settings_resources();
+    void _on_settings_resource_changed();
+    // Rebuilds the chunks of every layer whose settings hash changed, stale chunks stay visible until they are replaced
+    void apply_settings_changes();
+    void invalidate_layer(size_t p_layer);
+
+    void build(Rect2 p_user_requested_region, Vector2 p_reference_position, Vector2 p_velocity);
+    void cancel_stale_chunks();
+    // Returns false if the layer has no room for the chunk, even after evicting cached ones
+    bool schedule_chunk(size_t p_layer, const ChunkLodKey &p_chunk);
+
+    tf::Executor &get_executor();
+    tf::TaskPriority get_chunk_priority(int p_lod_level) const;
+
+    bool is_chunk_building(size_t p_layer, const ChunkLodKey &p_chunk) const;
+    bool is_chunk_needed_by_children(size_t p_layer, const Rect2 &p_chunk_bounds) const;
+    void evict_cached_chunks();
+    bool evict_cached_chunk_for_lod(size_t p_layer, int p_lod_level);
+    void process_completed_chunks();
+    void commit_completed_chunks();
+    void reclaim_chunk_snapshots();
+public:
+    struct CompletionQueueStats {
+        int queued = 0;
+        uint64_t committed = 0;
+        // Counts every frame a chunk had to wait for the next one
+        uint64_t deferred = 0;
+    };
+    CompletionQueueStats get_completion_queue_stats(StringName p_layer_name) const;
+
+    struct MemoryStats {
+        int loaded = 0;
+        int cached = 0;
+        uint64_t memory_usage = 0;
+        uint64_t cached_memory_usage = 0;
+        uint64_t evicted = 0;
+    };
+    MemoryStats get_memory_stats(StringName p_layer_name) const;
+    static uint64_t get_memory_budget();
+    uint64_t get_total_memory_usage() const;
+
+    // Used by the benchmark, records how long every chunk took to build
+    void set_record_build_times(bool p_record_build_times);
+    LocalVector<uint64_t> get_build_times_usec(StringName p_layer_name) const;
+    LocalVector<uint64_t> get_cache_load_times_usec(StringName p_layer_name) const;
 
-    void build(Rect2 p_user_requested_region, Vector2 p_reference_position);
+    // Settings resources are edited on the main thread at any time, builds reading them would race with the
+    // editor. Builds read a deep copy instead, nothing ever writes to it and a new one is made after every change.
+    // Main thread only
+    Ref<Resource> get_settings_snapshot(const String &p_project_setting);
+    // Nothing building and nothing waiting to be committed
+    bool is_idle() const;
 
-    void on_build_task_completed();
-public:
-    void update(Rect2 p_user_requested_region, Vector2 p_reference_position);
+    static int get_worker_thread_count();
+
+    static float get_time_to_reach(const Rect2 &p_region, const Vector2 &p_velocity, const Rect2 &p_chunk_bounds);
+
+    // p_velocity is used to prefetch chunks ahead of the reference position and build them in the order they will be reached
+    void update(Rect2 p_user_requested_region, Vector2 p_reference_position, Vector2 p_velocity = Vector2());
     void cleanup_chunks();
 
     void set_lod_max_distances(const PackedFloat32Array &p_lod_distances) {
@@ -194,10 +449,28 @@ public:
         return target_lod_level;
     }
 
-    ChunkerLayerManager() : executor(2) {};
+    ChunkerLayerManager() {};
     ~ChunkerLayerManager() {
+        if (executor) {
+            for (ChunkerLayerInstance &layer : layers) {
+                for (KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &kv : layer.building_chunks) {
+                    ChunkerChunk::BuildState expected = ChunkerChunk::BUILD_STATE_QUEUED;
+                    kv.value->build_state.compare_exchange_strong(expected, ChunkerChunk::BUILD_STATE_CANCELLED);
+                }
+            }
+            executor->wait_for_all();
+            for (ChunkerLayerInstance &layer : layers) {
+                for (KeyValue<ChunkLodKey, Ref<ChunkerChunk>> &kv : layer.building_chunks) {
+                    kv.value->build_task.reset();
+                }
+                for (Ref<ChunkerChunk> &chunk : layer.superseded_chunks) {
+                    chunk->build_task.reset();
+                }
+            }
+        }
     }
 
+    friend class ChunkerLayer;
     friend class ChunkerDebugger;
 };
 
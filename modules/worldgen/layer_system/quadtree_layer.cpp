@@ -9,8 +9,9 @@
 #include "worldgen/instance_texture_queue.h"
 #include "worldgen/render_layers.h"
 
-QuadTreeTerrainLayer::QuadTreeTerrainLayer(Ref<RoadLayer> p_road_layer) {
+QuadTreeTerrainLayer::QuadTreeTerrainLayer(Ref<RoadLayer> p_road_layer, Ref<BiomeVoronoiTriangulationLayer> p_biome_layer) {
     road_layer = p_road_layer;
+    biome_layer = p_biome_layer;
     quad_tree_settings.instantiate();
 
     // Terrain shader variants
@@ -22,7 +23,10 @@ QuadTreeTerrainLayer::QuadTreeTerrainLayer(Ref<RoadLayer> p_road_layer) {
     for (int i = 0; i < lod_count; i++) {
         // Need me global constants
         StringName shader_parameter_name = vformat("terrain_normal_heightmaps_lod_%d", i);
-        String lod_code = String(vformat("shader_type spatial;\n#define TERRAIN_NORMAL_HEIGHTMAPS_GLOBAL_UNIFORM %s\n", shader_parameter_name)) + code;
+        StringName road_sdf_parameter_name = vformat("terrain_road_sdfs_lod_%d", i);
+        String lod_code = String(vformat("shader_type spatial;\n#define TERRAIN_NORMAL_HEIGHTMAPS_GLOBAL_UNIFORM %s\n#define TERRAIN_ROAD_SDFS_GLOBAL_UNIFORM %s\n", shader_parameter_name, road_sdf_parameter_name));
+        lod_code += "#define TERRAIN_BIOME_INDICES_GLOBAL_UNIFORM terrain_biome_indices\n#define TERRAIN_BIOME_WEIGHTS_GLOBAL_UNIFORM terrain_biome_weights\n";
+        lod_code += code;
         Ref<Shader> lod_shader;
         lod_shader.instantiate();
         lod_shader->set_code(lod_code);
@@ -79,8 +83,14 @@ Vector2 QuadTreeTerrainLayer::get_camera_position() const { return camera_positi
 void QuadTreeTerrainLayer::set_camera_position(const Vector2 &p_camera_position) { camera_position = p_camera_position; }
 
 void QuadTreeTerrainLayer::update_terrain_chunks() {
-    for (KeyValue<Vector2i, Ref<ChunkerChunk>> kv : loaded_chunks) {
-        Ref<QuadTreeTerrainChunk> terrain_chunk = kv.value;
+    LocalVector<Ref<QuadTreeTerrainChunk>> terrain_chunks;
+    {
+        MutexLock lock(loaded_chunks_mutex);
+        for (const KeyValue<Vector2i, Ref<ChunkerChunk>> &kv : loaded_chunks) {
+            terrain_chunks.push_back(kv.value);
+        }
+    }
+    for (Ref<QuadTreeTerrainChunk> terrain_chunk : terrain_chunks) {
         terrain_chunk->camera_position = get_camera_position();
         terrain_chunk->update_quadtree();
         terrain_chunk->update_mesh_instances();
@@ -141,6 +151,16 @@ void QuadTreeTerrainChunk::update_mesh_instances() {
     // Create new ones
     for (int node_i : nodes_to_create) {
         const ChunkerQuadTree::LeafNodeInfo &node_info = node_infos[node_i];
+        // Without its textures the node can't be drawn, it's left out and tried again on the next update
+        Ref<RoadChunk> road_chunk = layer->road_layer->get_chunk_at_world_position(node_info.bounds.get_center());
+        if (road_chunk.is_null()) {
+            continue;
+        }
+        const Ref<InstanceTextureHandle> height_texture_handle = road_chunk->get_heightmap_texture_handle();
+        const Ref<InstanceTextureHandle> road_sdf_texture_handle = road_chunk->get_texture_handle();
+        if (height_texture_handle.is_null() || road_sdf_texture_handle.is_null()) {
+            continue;
+        }
         Ref<Mesh> new_mesh = get_mesh_for_lods(node_info.lod_level, node_info.neighbor_lods);
         MeshInstance3D *mi = memnew(MeshInstance3D);
         mi->set_layer_mask(RENDER_LAYER_TERRAIN);
@@ -153,11 +173,22 @@ void QuadTreeTerrainChunk::update_mesh_instances() {
         chunk_aabb.size = Vector3(node_info.bounds.size.x, 750.0, node_info.bounds.size.y);
         mi->set_custom_aabb(chunk_aabb);
         mi->set_instance_shader_parameter(SNAME("sector_size"), node_info.bounds.size.x);
-        Ref<RoadChunk> road_chunk = layer->road_layer->get_chunk_at_world_position(node_info.bounds.get_center());
         mi->set_instance_shader_parameter(SNAME("height_texture_start"), road_chunk->get_bounds().position);
         mi->set_instance_shader_parameter(SNAME("height_texture_end"), road_chunk->get_bounds().get_end());
-        Ref<InstanceTextureHandle> texture_handle = road_chunk->get_heightmap_texture_handle();
-        mi->set_instance_shader_parameter(SNAME("height_normal_texture_idx"), texture_handle->get_idx());
+        mi->set_instance_shader_parameter(SNAME("height_normal_texture_idx"), height_texture_handle->get_idx());
+        mi->set_instance_shader_parameter(SNAME("road_sdf_texture_idx"), road_sdf_texture_handle->get_idx());
+        const Ref<ChunkerChunk> biome_chunk = layer->biome_layer->get_chunk_at_world_position(node_info.bounds.get_center());
+        if (biome_chunk.is_valid()) {
+            const BiomeVoronoiTriangulationChunk *biome_weights = static_cast<const BiomeVoronoiTriangulationChunk *>(biome_chunk.ptr());
+            const Ref<InstanceTextureHandle> biome_index_texture_handle = biome_weights->get_biome_index_texture_handle();
+            const Ref<InstanceTextureHandle> biome_weight_texture_handle = biome_weights->get_biome_weight_texture_handle();
+            if (biome_index_texture_handle.is_valid() && biome_weight_texture_handle.is_valid()) {
+                mi->set_instance_shader_parameter(SNAME("biome_texture_start"), biome_weights->get_bounds().position);
+                mi->set_instance_shader_parameter(SNAME("biome_texture_end"), biome_weights->get_bounds().get_end());
+                mi->set_instance_shader_parameter(SNAME("biome_index_texture_idx"), biome_index_texture_handle->get_idx());
+                mi->set_instance_shader_parameter(SNAME("biome_weight_texture_idx"), biome_weight_texture_handle->get_idx());
+            }
+        }
         loaded_grid_nodes.insert(node_infos[node_i].bounds, {
             .mi = mi,
             .lod_level = node_infos[node_i].lod_level,
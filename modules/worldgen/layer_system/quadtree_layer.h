@@ -9,6 +9,7 @@
 #include "scene/3d/mesh_instance_3d.h"
 #include "worldgen/chunker.h"
 #include "worldgen/instance_texture_queue.h"
+#include "worldgen/layer_system/biome_layers.h"
 #include "worldgen/layer_system/road_layer.h"
 
 class QuadTreeTerrainChunk;
@@ -21,12 +22,17 @@ class QuadTreeTerrainLayer : public ChunkerLayer {
     Vector2 camera_position;
     LocalVector<Ref<Material>> terrain_materials_per_lod;
     Ref<RoadLayer> road_layer;
+    Ref<BiomeVoronoiTriangulationLayer> biome_layer;
 public:
-    QuadTreeTerrainLayer(Ref<RoadLayer> p_road_layer);
+    QuadTreeTerrainLayer(Ref<RoadLayer> p_road_layer, Ref<BiomeVoronoiTriangulationLayer> p_biome_layer);
     virtual float get_chunk_size() const override {
         return GLOBAL_GET("kgame/terrain/terrain_chunk_size");
     }
     virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const  override;
+    // Chunks own scene nodes, keeping them around would keep them on screen
+    virtual bool can_cache_chunks() const override {
+        return false;
+    }
     Vector2 get_camera_position() const;
     void set_camera_position(const Vector2 &p_camera_position);
     void update_terrain_chunks();
@@ -10,52 +10,244 @@
 #include "../bilinear_array.h"
 #include "worldgen/instance_texture_queue.h"
 #include "heightmap_layer.h"
+#include "build_scratch.h"
+#include "terrain_texture_baker.h"
+#include "road_network_layers.h"
+#include "road_sdf_rasterizer.h"
 class RoadLayer;
 class RoadChunk : public ChunkerChunk {
     GDCLASS(RoadChunk, ChunkerChunk);
-    Ref<BilinearVector> road_sdf_array;
     Ref<Image> road_sdf_image;
     Ref<Image> heightmap_image;
+    // Borrowed scratch buffers, only set while building
+    LocalVector<GridRoad::Segment> *road_segments = nullptr;
+    // Closest segment of every road texel, flooding passes ping-pong between the two
+    LocalVector<int32_t> *closest_segments[2] = {};
+    LocalVector<float> *road_distances = nullptr;
+    // Has a one texel border all around for the normals
+    LocalVector<float> *heightmap_heights = nullptr;
+    // Texels get baked straight into this, it becomes the heightmap image without another copy
+    Vector<uint8_t> heightmap_data;
+    uint16_t *heightmap_texels = nullptr;
     int road_dimensions;
     int heightmap_dimensions;
     Ref<HeightmapLayer> heightmap_layer;
+    Ref<RoadNetworkLayer> road_network_layer;
+    float road_half_width = 0.0f;
+    float road_sdf_range = 0.0f;
     Ref<InstanceTextureHandle> texture_handle;
     Ref<InstanceTextureHandle> height_texture_handle;
+    const ChunkerLayer *layer = nullptr;
+    // Heightmap texels of loaded neighbours of the same LOD in -x, +x, -y, +y order, only set while building
+    Vector<uint8_t> neighbor_heightmaps[4];
+
+    // The heightmap texture spans dimensions-2 texel intervals over the chunk, so its last two columns and rows
+    // are the first two of the next chunk. Those, and the border around the texture the normals need, get copied
+    // from the neighbours that are loaded. p_x and p_y go from -1 to heightmap_dimensions
+    bool get_neighbor_heightmap_texel(int p_x, int p_y, float &r_height) const {
+        const int intervals = heightmap_dimensions - 2;
+        const Vector2i offsets[4] = { Vector2i(intervals, 0), Vector2i(-intervals, 0), Vector2i(0, intervals), Vector2i(0, -intervals) };
+        for (int i = 0; i < 4; i++) {
+            if (neighbor_heightmaps[i].is_empty()) {
+                continue;
+            }
+            const Vector2i texel = Vector2i(p_x, p_y) + offsets[i];
+            if (texel.x < 0 || texel.y < 0 || texel.x >= heightmap_dimensions || texel.y >= heightmap_dimensions) {
+                continue;
+            }
+            const uint16_t *half_data = (const uint16_t *)neighbor_heightmaps[i].ptr();
+            r_height = Math::half_to_float(half_data[(texel.y * heightmap_dimensions + texel.x) * TerrainTextureBaker::HEIGHT_NORMAL_CHANNELS]);
+            return true;
+        }
+        return false;
+    }
+
+    void find_neighbors() {
+        const Vector2i offsets[4] = { Vector2i(-1, 0), Vector2i(1, 0), Vector2i(0, -1), Vector2i(0, 1) };
+        for (int i = 0; i < 4; i++) {
+            const RoadChunk *neighbor = static_cast<const RoadChunk *>(layer->find_current_chunk(chunk + offsets[i], lod_level));
+            if (neighbor && neighbor->heightmap_image.is_valid() && neighbor->heightmap_dimensions == heightmap_dimensions) {
+                neighbor_heightmaps[i] = neighbor->heightmap_image->get_data();
+            }
+        }
+    }
 public:
-    RoadChunk() {
-        road_dimensions = GLOBAL_GET("kgame/road_sdf_dimensions");
+    RoadChunk(int p_road_dimensions) {
+        road_dimensions = p_road_dimensions;
+    }
+
+    ~RoadChunk() {
+        // Only still set if the build never finished
+        release_road_buffers();
+        BuildScratch<float>::release(heightmap_heights);
+    }
+
+    void release_road_buffers() {
+        BuildScratch<GridRoad::Segment>::release(road_segments);
+        BuildScratch<int32_t>::release(closest_segments[0]);
+        BuildScratch<int32_t>::release(closest_segments[1]);
+        BuildScratch<float>::release(road_distances);
+        road_segments = nullptr;
+        closest_segments[0] = nullptr;
+        closest_segments[1] = nullptr;
+        road_distances = nullptr;
+    }
+
+    RoadSDFRasterizer::Grid get_road_sdf_grid() const {
+        return {
+            .origin = bounds.position,
+            .spacing = bounds.size.x / (road_dimensions - 1),
+            .dimensions = road_dimensions
+        };
+    }
+
+    static Ref<Image> create_height_image(int p_dimensions, const LocalVector<float> &p_heights) {
+        Vector<uint8_t> data;
+        data.resize(p_heights.size() * sizeof(uint16_t));
+        TerrainTextureBaker::encode_half_floats(p_heights.ptr(), p_heights.size(), (uint16_t *)data.ptrw());
+        return Image::create_from_data(p_dimensions, p_dimensions, false, Image::FORMAT_RH, data);
     }
 
     virtual void build(tf::Taskflow &p_taskflow) override {
         heightmap_dimensions = height_texture_handle->get_texture_dimensions();
         tf::Task allocate_task = p_taskflow.emplace([&]() {
-            road_sdf_array = BilinearVector::create_xy(road_dimensions);
-            road_sdf_image = Image::create_empty(road_dimensions, road_dimensions, false, Image::FORMAT_RH);
-            heightmap_image = Image::create_empty(heightmap_dimensions, heightmap_dimensions, false, Image::FORMAT_RH);
-        }).name("Allocate road array and image");
-        tf::Task generate_task = p_taskflow.for_each_index(0, road_dimensions*road_dimensions, 1, [&](int i) {
-            Vector2 progress = Vector2(i % road_dimensions, Math::floor((float)i / road_dimensions)) / Vector2(road_dimensions-1, road_dimensions-1);
-            Vector2i pixel_xy = Vector2i(i % road_dimensions, i / road_dimensions);
-            Vector2 sample_pos = bounds.position + (progress * bounds.size);
-            float height = heightmap_layer->sample_height_at_position(sample_pos);
-            road_sdf_image->set_pixelv(pixel_xy, Color(height, 0.0f, 0.0f, 0.0f));
-
-        }).name("Generate road map");
-        tf::Task generate_heightmap_task = p_taskflow.for_each_index(0, heightmap_dimensions*heightmap_dimensions, 1, [&] (int i){
-            Vector2i pixel_xy = Vector2i(i % heightmap_dimensions, i / heightmap_dimensions);
-            Vector2 progress = Vector2(i % heightmap_dimensions, Math::floor((float)i / heightmap_dimensions)) / Vector2(heightmap_dimensions-2, heightmap_dimensions-2);
-            Vector2 sample_pos = bounds.position + (progress * bounds.size);
-            float height = heightmap_layer->sample_height_at_position(sample_pos);
-            heightmap_image->set_pixelv(pixel_xy, Color(height, 0.0, 0.0, 1.0));
+            road_segments = BuildScratch<GridRoad::Segment>::borrow();
+            closest_segments[0] = BuildScratch<int32_t>::borrow();
+            closest_segments[1] = BuildScratch<int32_t>::borrow();
+            road_distances = BuildScratch<float>::borrow();
+            heightmap_heights = BuildScratch<float>::borrow();
+            // Roads just outside the chunk still reach into it
+            road_network_layer->get_segments_in_rect(bounds.grow(road_sdf_range + road_half_width), *road_segments);
+            closest_segments[0]->resize(road_dimensions * road_dimensions);
+            closest_segments[1]->resize(road_dimensions * road_dimensions);
+            road_distances->resize(road_dimensions * road_dimensions);
+            heightmap_heights->resize((heightmap_dimensions + 2) * (heightmap_dimensions + 2));
+            heightmap_data.resize(Image::get_image_data_size(heightmap_dimensions, heightmap_dimensions, TerrainTextureBaker::HEIGHT_NORMAL_FORMAT, false));
+            // Taken once here, the bake tasks write disjoint rows through it
+            heightmap_texels = (uint16_t *)heightmap_data.ptrw();
+            find_neighbors();
+        }).name("Borrow build buffers");
+        // Jump flooding, every pass is done a row per task and only reads what the previous pass wrote
+        tf::Task seed_task = p_taskflow.emplace([&]() {
+            RoadSDFRasterizer::seed(get_road_sdf_grid(), road_segments->ptr(), road_segments->size(), closest_segments[0]->ptr());
+        }).name("Seed road SDF");
+        tf::Task previous_pass_task = seed_task;
+        int closest_source = 0;
+        for (const int step : RoadSDFRasterizer::get_pass_steps(road_dimensions)) {
+            tf::Task pass_task = p_taskflow.for_each_index(0, road_dimensions, 1, [this, step, closest_source](int y) {
+                RoadSDFRasterizer::flood_row(get_road_sdf_grid(), road_segments->ptr(), step, y, closest_segments[closest_source]->ptr(), closest_segments[1 - closest_source]->ptr());
+            }).name(vformat("Flood road SDF, step %d", step).utf8().get_data());
+            previous_pass_task.precede(pass_task);
+            previous_pass_task = pass_task;
+            closest_source = 1 - closest_source;
+        }
+        tf::Task generate_task = p_taskflow.for_each_index(0, road_dimensions, 1, [this, closest_source](int y) {
+            RoadSDFRasterizer::resolve_row(get_road_sdf_grid(), road_segments->ptr(), y, closest_segments[closest_source]->ptr(), road_half_width, road_sdf_range, road_distances->ptr() + y * road_dimensions);
+        }).name("Resolve road SDF");
+        previous_pass_task.precede(generate_task);
+        tf::Task generate_heightmap_task = p_taskflow.for_each_index(0, heightmap_dimensions + 2, 1, [&](int row_index) {
+            const int intervals = heightmap_dimensions - 2;
+            const int row_size = heightmap_dimensions + 2;
+            const Vector2i origin = chunk * intervals - Vector2i(1, 1);
+            const int y = row_index - 1;
+            float *row = heightmap_heights->ptr() + row_index * row_size;
+            int i = 0;
+            while (i < row_size) {
+                if (get_neighbor_heightmap_texel(i - 1, y, row[i])) {
+                    i++;
+                    continue;
+                }
+                // Sample everything up to the next texel a neighbour has
+                int run_end = i + 1;
+                float neighbor_height;
+                while (run_end < row_size && !get_neighbor_heightmap_texel(run_end - 1, y, neighbor_height)) {
+                    run_end++;
+                }
+                heightmap_layer->sample_lattice_row(Vector2i(origin.x + i, origin.y + row_index), run_end - i, bounds.size.x / intervals, row + i);
+                i = run_end;
+            }
         }).name("Generate heightmap");
+        // Heights and normals go straight into the final pixel buffer, the image is only created once everything's baked
+        tf::Task bake_heightmap_task = p_taskflow.for_each_index(0, heightmap_dimensions, 1, [&](int y) {
+            const int row_size = heightmap_dimensions * TerrainTextureBaker::HEIGHT_NORMAL_CHANNELS;
+            TerrainTextureBaker::bake_height_normal_row(heightmap_heights->ptr(), heightmap_dimensions, y, bounds.size.x / (heightmap_dimensions - 2), heightmap_texels + y * row_size);
+        }).name("Bake heightmap texels");
+        tf::Task create_images_task = p_taskflow.emplace([&]() {
+            road_sdf_image = create_height_image(road_dimensions, *road_distances);
+            heightmap_image = Image::create_from_data(heightmap_dimensions, heightmap_dimensions, false, TerrainTextureBaker::HEIGHT_NORMAL_FORMAT, heightmap_data);
+            heightmap_data.clear();
+            heightmap_texels = nullptr;
+            release_road_buffers();
+            BuildScratch<float>::release(heightmap_heights);
+            heightmap_heights = nullptr;
+            for (Vector<uint8_t> &neighbor_heightmap : neighbor_heightmaps) {
+                neighbor_heightmap.clear();
+            }
+        }).name("Create road and heightmap images");
         tf::Task upload_task = p_taskflow.emplace([&]() {
-            //texture_handle->upload_image(road_sdf_image);
+            texture_handle->upload_image(road_sdf_image);
             height_texture_handle->upload_image(heightmap_image);
         }).name("Upload to the GPU");
 
-        allocate_task.precede(generate_task);
-        generate_task.precede(generate_heightmap_task);
-        generate_heightmap_task.precede(upload_task);
+        allocate_task.precede(seed_task, generate_heightmap_task);
+        generate_heightmap_task.precede(bake_heightmap_task);
+        create_images_task.succeed(generate_task, bake_heightmap_task);
+        create_images_task.precede(upload_task);
+    }
+
+    virtual uint64_t get_memory_usage() const override {
+        uint64_t memory_usage = 0;
+        if (road_sdf_image.is_valid()) {
+            memory_usage += road_sdf_image->get_data_size();
+        }
+        if (heightmap_image.is_valid()) {
+            memory_usage += heightmap_image->get_data_size();
+        }
+        // The slots in the texture arrays we hold
+        if (height_texture_handle.is_valid()) {
+            memory_usage += Image::get_image_data_size(heightmap_dimensions, heightmap_dimensions, TerrainTextureBaker::HEIGHT_NORMAL_FORMAT, false);
+        }
+        if (texture_handle.is_valid()) {
+            memory_usage += Image::get_image_data_size(road_dimensions, road_dimensions, Image::FORMAT_RH, false);
+        }
+        return memory_usage;
+    }
+
+    virtual void unload() override {
+        // Give the texture slots back right away, the chunk itself might live a bit longer in a snapshot
+        height_texture_handle.unref();
+        texture_handle.unref();
+    }
+
+    virtual bool is_cacheable() const override {
+        return true;
+    }
+
+    virtual void save_to_cache(const Ref<FileAccess> &p_file) const override {
+        p_file->store_32(road_dimensions);
+        p_file->store_buffer(road_sdf_image->get_data());
+        p_file->store_32(heightmap_dimensions);
+        p_file->store_buffer(heightmap_image->get_data());
+    }
+
+    virtual bool load_from_cache(const Ref<FileAccess> &p_file) override {
+        if (p_file->get_32() != (uint32_t)road_dimensions) {
+            return false;
+        }
+        const Vector<uint8_t> road_data = p_file->get_buffer(Image::get_image_data_size(road_dimensions, road_dimensions, Image::FORMAT_RH, false));
+        if (p_file->get_32() != (uint32_t)heightmap_dimensions) {
+            return false;
+        }
+        const Vector<uint8_t> cached_heightmap_data = p_file->get_buffer(Image::get_image_data_size(heightmap_dimensions, heightmap_dimensions, TerrainTextureBaker::HEIGHT_NORMAL_FORMAT, false));
+        if (p_file->get_error() != OK) {
+            return false;
+        }
+
+        road_sdf_image = Image::create_from_data(road_dimensions, road_dimensions, false, Image::FORMAT_RH, road_data);
+        heightmap_image = Image::create_from_data(heightmap_dimensions, heightmap_dimensions, false, TerrainTextureBaker::HEIGHT_NORMAL_FORMAT, cached_heightmap_data);
+        texture_handle->upload_image(road_sdf_image);
+        height_texture_handle->upload_image(heightmap_image);
+        return true;
     }
     Ref<InstanceTextureHandle> get_texture_handle() const {
         return texture_handle;
@@ -69,11 +261,15 @@ public:
 class RoadLayer : public ChunkerLayer {
     GDCLASS(RoadLayer, ChunkerLayer);
     LocalVector<Ref<InstanceTextureQueue>> heightmap_texture_queues;
+    LocalVector<Ref<InstanceTextureQueue>> road_sdf_texture_queues;
     Ref<HeightmapLayer> heightmap_layer;
+    Ref<RoadNetworkLayer> road_network_layer;
     PackedInt32Array per_lod_heightmap_dimensions;
 public:
-    RoadLayer(Ref<HeightmapLayer> p_heightmap_layer) {
+    RoadLayer(Ref<HeightmapLayer> p_heightmap_layer, Ref<RoadNetworkLayer> p_road_network_layer) {
         heightmap_layer = p_heightmap_layer;
+        road_network_layer = p_road_network_layer;
+        const int road_sdf_dimensions = GLOBAL_GET("kgame/road_sdf_dimensions");
         const PackedFloat32Array lod_max_distances =  GLOBAL_GET("kgame/terrain/lod_max_distances");
         const int height_texture_dimensions = GLOBAL_GET("kgame/terrain/normal_height_texture_size");
         const PackedInt32Array texture_count_per_lod = GLOBAL_GET("kgame/terrain/normal_height_texture_count_per_lod");
@@ -81,7 +277,7 @@ public:
         DEV_ASSERT(lod_max_distances.size() == texture_count_per_lod.size());
 
         for (int i = 0; i < lod_max_distances.size(); i++) {
-            const int texture_dimension = height_texture_dimensions/MAX(1, 2 * i);
+            const int texture_dimension = get_lod_resolution(height_texture_dimensions, i);
             const int texture_count = texture_count_per_lod[i];
             per_lod_heightmap_dimensions.push_back(texture_dimension);
             Ref<InstanceTextureQueue> texture_queue;
@@ -91,25 +287,62 @@ public:
             texture_queue.instantiate(InstanceTextureQueue::InstanceTextureQueueCreateParams {
                 .texture_count = texture_count,
                 .texture_dimensions = Vector2i(texture_dimension, texture_dimension),
-                .format = Image::FORMAT_RH,
+                .format = TerrainTextureBaker::HEIGHT_NORMAL_FORMAT,
                 .uses_global_uniform = true,
                 .uniform_name = shader_parameter_name
             });
             heightmap_texture_queues.push_back(texture_queue);
+
+            const StringName road_sdf_parameter_name = vformat("terrain_road_sdfs_lod_%d", i);
+            RenderingServer::get_singleton()->global_shader_parameter_add(road_sdf_parameter_name, RenderingServer::GLOBAL_VAR_TYPE_SAMPLER2DARRAY, Variant());
+            const int road_sdf_dimension = get_lod_resolution(road_sdf_dimensions, i);
+            Ref<InstanceTextureQueue> road_sdf_queue;
+            road_sdf_queue.instantiate(InstanceTextureQueue::InstanceTextureQueueCreateParams {
+                .texture_count = texture_count,
+                .texture_dimensions = Vector2i(road_sdf_dimension, road_sdf_dimension),
+                .format = Image::FORMAT_RH,
+                .uses_global_uniform = true,
+                .uniform_name = road_sdf_parameter_name
+            });
+            road_sdf_texture_queues.push_back(road_sdf_queue);
         }
     }
     virtual float get_chunk_size() const override {
         return GLOBAL_GET("kgame/terrain/terrain_chunk_size");
     }
+    // Roads this close to a chunk show up in its SDF
     virtual float get_chunk_padding() const override {
-        return 32.0f;
+        return GLOBAL_GET("kgame/roads/road_sdf_range");
+    }
+    // Same as the heightmap layer, so the LOD grids stay nested and line up with the heights we copy
+    virtual float get_lod_resolution_scale(int p_lod_level) const override {
+        return 1.0f / (1 << p_lod_level);
+    }
+    virtual bool has_room_for_chunk(int p_lod_level) const override {
+        ERR_FAIL_INDEX_V(p_lod_level, (int)heightmap_texture_queues.size(), true);
+        return heightmap_texture_queues[p_lod_level]->get_available_count() > 0 && road_sdf_texture_queues[p_lod_level]->get_available_count() > 0;
+    }
+    virtual uint32_t get_settings_hash() const override {
+        uint32_t hash = hash_murmur3_one_32((int)GLOBAL_GET("kgame/road_sdf_dimensions"));
+        hash = hash_murmur3_one_float(GLOBAL_GET("kgame/roads/road_width"), hash);
+        hash = hash_murmur3_one_float(get_chunk_padding(), hash);
+        hash = hash_murmur3_one_32(per_lod_heightmap_dimensions.size(), hash);
+        for (const int32_t &dimensions : per_lod_heightmap_dimensions) {
+            hash = hash_murmur3_one_32(dimensions, hash);
+        }
+        return hash_murmur3_one_float(get_chunk_size(), hash);
     }
     virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const override {
         Ref<RoadChunk> chunk;
-        chunk.instantiate();
+        chunk.instantiate(get_lod_resolution(GLOBAL_GET("kgame/road_sdf_dimensions"), p_lod_level));
         chunk->heightmap_layer = heightmap_layer;
+        chunk->road_network_layer = road_network_layer;
+        chunk->road_half_width = (float)GLOBAL_GET("kgame/roads/road_width") * 0.5f;
+        chunk->road_sdf_range = get_chunk_padding();
+        chunk->layer = this;
         print_line("GRAB HANDLE FOR CHUNK LOD", p_lod_level);
         chunk->height_texture_handle = heightmap_texture_queues[p_lod_level]->get_available_handle();
+        chunk->texture_handle = road_sdf_texture_queues[p_lod_level]->get_available_handle();
         return chunk;
     }
 };
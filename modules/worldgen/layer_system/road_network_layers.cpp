@@ -0,0 +1,259 @@
+#include "road_network_layers.h"
+#include "alpha_model.h"
+#include "core/math/geometry_2d.h"
+
+LocalVector<SettlementChunk::Settlement> SettlementLayer::get_settlements_in_rect(const Rect2 &p_rect) const {
+    LocalVector<SettlementChunk::Settlement> out;
+    const Vector2 rect_end = p_rect.get_end();
+    for (const KeyValue<Vector2i, Ref<ChunkerChunk>> &kv : get_chunks_snapshot()) {
+        const SettlementChunk *chunk = static_cast<const SettlementChunk *>(kv.value.ptr());
+        if (!chunk->get_bounds().intersects(p_rect, true)) {
+            continue;
+        }
+        for (const SettlementChunk::Settlement &settlement : chunk->get_settlements()) {
+            const Vector2 &position = settlement.position;
+            if (position.x >= p_rect.position.x && position.y >= p_rect.position.y && position.x < rect_end.x && position.y < rect_end.y) {
+                out.push_back(settlement);
+            }
+        }
+    }
+    return out;
+}
+
+// Routes in the unit square of a road network chunk, heights come from the world position it maps to
+class RoadNetworkChunkRouter : public AlphaModelRoadGenerator {
+    const WorldgenHeight *height_source = nullptr;
+    Rect2 bounds;
+protected:
+    virtual void get_heights(const std::vector<RoadGraph::Point> &p_points, std::vector<float> &r_heights) const override {
+        LocalVector<Vector2> positions;
+        positions.resize(p_points.size());
+        for (uint32_t i = 0; i < positions.size(); i++) {
+            positions[i] = bounds.position + Vector2(p_points[i].x, p_points[i].y) * bounds.size;
+        }
+        r_heights.resize(p_points.size());
+        height_source->get_heights(positions.ptr(), positions.size(), r_heights.data());
+    }
+    // Chunks are already built in parallel, so each one routes on its own thread
+    virtual void run_parallel(int p_count, const std::function<void(int)> &p_function) const override {
+        for (int i = 0; i < p_count; i++) {
+            p_function(i);
+        }
+    }
+public:
+    RoadNetworkChunkRouter(const WorldgenHeight *p_height_source, const Rect2 &p_bounds) {
+        height_source = p_height_source;
+        bounds = p_bounds;
+    }
+};
+
+RoadNetworkChunk::RoadNetworkChunk(int p_point_count, Ref<WorldgenHeightSettings> p_height_settings) {
+    point_count = p_point_count;
+    height_source.instantiate();
+    height_source->set_settings(p_height_settings);
+}
+
+void RoadNetworkChunk::route_roads() {
+    // Same roads at every LOD, take them from whichever one is loaded
+    const RoadNetworkChunk *loaded = static_cast<const RoadNetworkChunk *>(layer->find_current_chunk(chunk, -1));
+    if (!loaded && coarse_chunk.is_valid()) {
+        loaded = static_cast<const RoadNetworkChunk *>(coarse_chunk.ptr());
+    }
+    if (loaded && loaded != this) {
+        segments = loaded->segments;
+        return;
+    }
+
+    std::vector<RoadGraph::Vertex> cities;
+    const auto add_city = [&](const Vector2 &p_position, float p_mass) {
+        const Vector2 point = (p_position - bounds.position) / bounds.size;
+        cities.push_back({
+            .point = { point.x, point.y },
+            .mass = p_mass,
+            .is_city = true
+        });
+    };
+    for (int side = 0; side < 4; side++) {
+        const RoadNetworkLayer::Portal portal = layer->get_portal(chunk, side);
+        add_city(portal.position, portal.mass);
+    }
+    for (const SettlementChunk::Settlement &settlement : settlement_layer->get_settlements_in_rect(bounds)) {
+        add_city(settlement.position, settlement.mass);
+    }
+
+    // Keeps the dummy points off the borders, so roads only cross them at the portals
+    const float margin = 0.01f;
+    RoadNetworkChunkRouter router = RoadNetworkChunkRouter(height_source.ptr(), bounds);
+    router.initialize({
+        .bounds_start_x = margin,
+        .bounds_start_y = margin,
+        .bounds_end_x = 1.0f - margin,
+        .bounds_end_y = 1.0f - margin,
+        .dummy_point_count = point_count
+    }, cities);
+
+    AlphaModelRoadGenerator::RoadGenerationOutput output;
+    router.generate_roads({
+        .road_straightening_factor = 1.0,
+        .alpha = 0.7,
+        .heightmap_weight = 0.1f,
+        .trip_batch_size = 1
+    }, output);
+
+    segments.reserve(output.edges.size());
+    for (const RoadGraph::Edge &edge : output.edges) {
+        const RoadGraph::Point &from = output.vertices[edge.v1].point;
+        const RoadGraph::Point &to = output.vertices[edge.v2].point;
+        segments.push_back({
+            .from = bounds.position + Vector2(from.x, from.y) * bounds.size,
+            .to = bounds.position + Vector2(to.x, to.y) * bounds.size
+        });
+    }
+}
+
+void RoadNetworkChunk::create_grid_road() {
+    grid_road = GridRoad::create({
+        .bounds = bounds,
+        .grid_element_count = 16
+    });
+    for (const GridRoad::Segment &segment : segments) {
+        grid_road->insert_segment(segment.from, segment.to);
+    }
+}
+
+void RoadNetworkChunk::build(tf::Taskflow &p_taskflow) {
+    tf::Task route_task = p_taskflow.emplace([&]() {
+        route_roads();
+    }).name("Route roads");
+    tf::Task grid_task = p_taskflow.emplace([&]() {
+        create_grid_road();
+    }).name("Create road grid");
+    route_task.precede(grid_task);
+}
+
+void RoadNetworkChunk::save_to_cache(const Ref<FileAccess> &p_file) const {
+    p_file->store_32(segments.size());
+    for (const GridRoad::Segment &segment : segments) {
+        p_file->store_float(segment.from.x);
+        p_file->store_float(segment.from.y);
+        p_file->store_float(segment.to.x);
+        p_file->store_float(segment.to.y);
+    }
+}
+
+bool RoadNetworkChunk::load_from_cache(const Ref<FileAccess> &p_file) {
+    const uint32_t segment_count = p_file->get_32();
+    segments.resize(segment_count);
+    for (GridRoad::Segment &segment : segments) {
+        segment.from.x = p_file->get_float();
+        segment.from.y = p_file->get_float();
+        segment.to.x = p_file->get_float();
+        segment.to.y = p_file->get_float();
+    }
+    if (p_file->get_error() != OK) {
+        return false;
+    }
+    create_grid_road();
+    return true;
+}
+
+RoadNetworkLayer::Portal RoadNetworkLayer::get_portal(const Vector2i &p_chunk, int p_side) const {
+    // Borders are named after the chunk on their -x/-y side and which axis they run along
+    Vector2i border_chunk = p_chunk;
+    if (p_side == 1) {
+        border_chunk.x += 1;
+    } else if (p_side == 3) {
+        border_chunk.y += 1;
+    }
+    const bool runs_along_y = p_side <= 1;
+    uint32_t hash = hash_murmur3_one_32(border_chunk.x);
+    hash = hash_murmur3_one_32(border_chunk.y, hash);
+    hash = hash_fmix32(hash_murmur3_one_32(runs_along_y, hash));
+
+    // Kept away from the corners so portals of different borders don't end up next to each other
+    const float along = 0.25f + 0.5f * (hash & 0xFFFF) / (float)0xFFFF;
+    const float chunk_size = get_chunk_size();
+    Portal portal;
+    portal.position = Vector2(border_chunk) * chunk_size;
+    if (runs_along_y) {
+        portal.position.y += along * chunk_size;
+    } else {
+        portal.position.x += along * chunk_size;
+    }
+    portal.mass = 0.1f + 0.4f * (hash >> 16) / (float)0xFFFF;
+    return portal;
+}
+
+void RoadNetworkLayer::get_segments_in_rect(const Rect2 &p_rect, LocalVector<GridRoad::Segment> &r_segments) const {
+    const float chunk_size = get_chunk_size();
+    const Vector2i chunk_start = (p_rect.position / chunk_size).floor();
+    const Vector2i chunk_end = (p_rect.get_end() / chunk_size).floor();
+    const HashMap<Vector2i, Ref<ChunkerChunk>> &chunks = get_chunks_snapshot();
+    for (int y = chunk_start.y; y <= chunk_end.y; y++) {
+        for (int x = chunk_start.x; x <= chunk_end.x; x++) {
+            HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = chunks.find(Vector2i(x, y));
+            if (it == chunks.end()) {
+                continue;
+            }
+            const RoadNetworkChunk *chunk = static_cast<const RoadNetworkChunk *>(it->value.ptr());
+            for (const GridRoad::Segment &segment : chunk->get_segments()) {
+                Rect2 segment_bounds = Rect2(segment.from, Vector2());
+                segment_bounds.expand_to(segment.to);
+                if (segment_bounds.intersects(p_rect, true)) {
+                    r_segments.push_back(segment);
+                }
+            }
+        }
+    }
+}
+
+bool RoadNetworkLayer::get_closest_road_point(const Vector2 &p_position, float p_max_distance, float &r_distance, Vector2 &r_point) const {
+    const float chunk_size = get_chunk_size();
+    const Vector2i chunk_start = ((p_position - Vector2(p_max_distance, p_max_distance)) / chunk_size).floor();
+    const Vector2i chunk_end = ((p_position + Vector2(p_max_distance, p_max_distance)) / chunk_size).floor();
+    const HashMap<Vector2i, Ref<ChunkerChunk>> &chunks = get_chunks_snapshot();
+
+    bool found = false;
+    r_distance = p_max_distance;
+    for (int y = chunk_start.y; y <= chunk_end.y; y++) {
+        for (int x = chunk_start.x; x <= chunk_end.x; x++) {
+            HashMap<Vector2i, Ref<ChunkerChunk>>::ConstIterator it = chunks.find(Vector2i(x, y));
+            if (it == chunks.end()) {
+                continue;
+            }
+            const RoadNetworkChunk *chunk = static_cast<const RoadNetworkChunk *>(it->value.ptr());
+            if (chunk->grid_road.is_null()) {
+                continue;
+            }
+            float distance_squared;
+            const int segment_index = chunk->grid_road->find_closest_segment(p_position, r_distance, distance_squared);
+            if (segment_index == -1) {
+                continue;
+            }
+            const GridRoad::Segment segment = chunk->grid_road->get_segment(segment_index);
+            const Vector2 points[2] = { segment.from, segment.to };
+            r_point = Geometry2D::get_closest_point_to_segment(p_position, points);
+            r_distance = Math::sqrt(distance_squared);
+            found = true;
+        }
+    }
+    return found;
+}
+
+uint32_t RoadNetworkLayer::get_settings_hash() const {
+    uint32_t hash = ChunkDiskCache::hash_resource(ResourceLoader::load(GLOBAL_GET("kgame/terrain/height_settings")));
+    hash = hash_murmur3_one_32((int)GLOBAL_GET("kgame/roads/road_network_chunk_points"), hash);
+    return hash_murmur3_one_float(get_chunk_size(), hash);
+}
+
+void RoadNetworkLayer::get_settings_resources(LocalVector<Ref<Resource>> &r_resources) const {
+    r_resources.push_back(ResourceLoader::load(GLOBAL_GET("kgame/terrain/height_settings")));
+}
+
+Ref<ChunkerChunk> RoadNetworkLayer::create_chunk(int p_lod_level) const {
+    Ref<RoadNetworkChunk> chunk;
+    chunk.instantiate((int)GLOBAL_GET("kgame/roads/road_network_chunk_points"), get_settings_snapshot("kgame/terrain/height_settings"));
+    chunk->layer = this;
+    chunk->settlement_layer = settlement_layer;
+    return chunk;
+}
@@ -0,0 +1,153 @@
+#ifndef ROAD_NETWORK_LAYERS_H
+#define ROAD_NETWORK_LAYERS_H
+
+#include "core/config/project_settings.h"
+#include "core/math/random_number_generator.h"
+#include "core/math/rect2.h"
+#include "core/templates/hashfuncs.h"
+#include "layer_manager.h"
+#include "worldgen/roads/quadtree_road.h"
+#include "worldgen/thirdparty/taskflow/core/taskflow.hpp"
+#include "worldgen/worldgen_height.h"
+
+class SettlementChunk : public ChunkerChunk {
+public:
+    struct Settlement {
+        Vector2 position;
+        float mass = 0.0f;
+    };
+private:
+    int settlement_count = 0;
+    LocalVector<Settlement> settlements;
+    virtual void build(tf::Taskflow &p_taskflow) override {
+        p_taskflow.emplace([&]() {
+            Ref<RandomNumberGenerator> rng;
+            rng.instantiate();
+            rng->set_seed(HashMapHasherDefault::hash(chunk));
+            for (int i = 0; i < settlement_count; i++) {
+                const Vector2 offset = Vector2(rng->randf(), rng->randf());
+                settlements.push_back({
+                    .position = bounds.position + offset * bounds.size,
+                    .mass = rng->randf_range(0.1f, 1.0f)
+                });
+            }
+        }).name("Place settlements");
+    }
+public:
+    SettlementChunk(int p_settlement_count) {
+        settlement_count = p_settlement_count;
+    }
+
+    const LocalVector<Settlement> &get_settlements() const {
+        return settlements;
+    }
+
+    virtual uint64_t get_memory_usage() const override {
+        return settlements.size() * sizeof(Settlement);
+    }
+};
+
+// Coarse regions with a few settlements each, the road network routes between them
+class SettlementLayer : public ChunkerLayer {
+    GDCLASS(SettlementLayer, ChunkerLayer);
+public:
+    // Settlements that fall in p_rect, the end of the rect is exclusive so neighbouring rects never share one
+    LocalVector<SettlementChunk::Settlement> get_settlements_in_rect(const Rect2 &p_rect) const;
+
+    virtual float get_chunk_size() const override {
+        return GLOBAL_GET("kgame/roads/settlement_region_size");
+    }
+
+    virtual uint32_t get_settings_hash() const override {
+        const uint32_t hash = hash_murmur3_one_32((int)GLOBAL_GET("kgame/roads/settlements_per_region"));
+        return hash_murmur3_one_float(get_chunk_size(), hash);
+    }
+
+    virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const override {
+        Ref<SettlementChunk> chunk;
+        chunk.instantiate((int)GLOBAL_GET("kgame/roads/settlements_per_region"));
+        return chunk;
+    }
+};
+
+class RoadNetworkLayer;
+
+// Roads of one chunk, routed with the alpha model between the settlements inside it and a portal on every side.
+// Portals only depend on the border they sit on, so the roads of neighbouring chunks meet there without
+// either chunk having to know about the other
+class RoadNetworkChunk : public ChunkerChunk {
+    GDCLASS(RoadNetworkChunk, ChunkerChunk);
+    const RoadNetworkLayer *layer = nullptr;
+    Ref<SettlementLayer> settlement_layer;
+    Ref<WorldgenHeight> height_source;
+    int point_count = 0;
+    LocalVector<GridRoad::Segment> segments;
+    Ref<GridRoad> grid_road;
+
+    void route_roads();
+    void create_grid_road();
+public:
+    RoadNetworkChunk(int p_point_count, Ref<WorldgenHeightSettings> p_height_settings);
+
+    virtual void build(tf::Taskflow &p_taskflow) override;
+
+    const LocalVector<GridRoad::Segment> &get_segments() const {
+        return segments;
+    }
+
+    Ref<GridRoad> get_grid_road() const {
+        return grid_road;
+    }
+
+    virtual uint64_t get_memory_usage() const override {
+        uint64_t memory_usage = segments.size() * sizeof(GridRoad::Segment);
+        if (grid_road.is_valid()) {
+            memory_usage += grid_road->get_memory_usage();
+        }
+        return memory_usage;
+    }
+
+    virtual bool is_cacheable() const override {
+        return true;
+    }
+
+    virtual void save_to_cache(const Ref<FileAccess> &p_file) const override;
+    virtual bool load_from_cache(const Ref<FileAccess> &p_file) override;
+    friend class RoadNetworkLayer;
+};
+
+class RoadNetworkLayer : public ChunkerLayer {
+    GDCLASS(RoadNetworkLayer, ChunkerLayer);
+    Ref<SettlementLayer> settlement_layer;
+public:
+    RoadNetworkLayer(Ref<SettlementLayer> p_settlement_layer) {
+        settlement_layer = p_settlement_layer;
+    }
+
+    struct Portal {
+        Vector2 position;
+        float mass = 0.0f;
+    };
+    // Where the roads cross the border on the given side of a chunk, 0 to 3 are -x, +x, -y, +y.
+    // Both chunks sharing the border get the same portal
+    Portal get_portal(const Vector2i &p_chunk, int p_side) const;
+
+    // Segments of the loaded chunks whose bounding box touches p_rect
+    void get_segments_in_rect(const Rect2 &p_rect, LocalVector<GridRoad::Segment> &r_segments) const;
+
+    // Closest point on any road of the loaded chunks within p_max_distance
+    bool get_closest_road_point(const Vector2 &p_position, float p_max_distance, float &r_distance, Vector2 &r_point) const;
+
+    virtual float get_chunk_size() const override {
+        return GLOBAL_GET("kgame/roads/road_network_chunk_size");
+    }
+    // The roads come out the same at every LOD, chunks of another LOD get copied instead of routed again
+    virtual bool can_refine_chunks() const override {
+        return true;
+    }
+    virtual uint32_t get_settings_hash() const override;
+    virtual void get_settings_resources(LocalVector<Ref<Resource>> &r_resources) const override;
+    virtual Ref<ChunkerChunk> create_chunk(int p_lod_level) const override;
+};
+
+#endif // ROAD_NETWORK_LAYERS_H
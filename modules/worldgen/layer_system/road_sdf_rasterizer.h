@@ -0,0 +1,128 @@
+#ifndef ROAD_SDF_RASTERIZER_H
+#define ROAD_SDF_RASTERIZER_H
+
+#include "core/math/math_funcs.h"
+#include "core/math/vector2.h"
+#include "core/templates/local_vector.h"
+#include "worldgen/roads/quadtree_road.h"
+
+// Rasterises road segments into a signed distance field with jump flooding. Every texel ends up with the segment
+// closest to it, the cost only depends on the texture size and not on how many roads there are.
+// Texels sit on a corner aligned grid, texel (x, y) is at origin + (x, y) * spacing
+class RoadSDFRasterizer {
+public:
+    struct Grid {
+        Vector2 origin;
+        float spacing = 1.0f;
+        int dimensions = 0;
+
+        _FORCE_INLINE_ Vector2 get_texel_position(int p_x, int p_y) const {
+            return origin + Vector2(p_x, p_y) * spacing;
+        }
+    };
+
+    static constexpr int32_t NO_SEGMENT = -1;
+
+    static _FORCE_INLINE_ float get_segment_distance_squared(const GridRoad::Segment &p_segment, const Vector2 &p_position) {
+        const Vector2 direction = p_segment.to - p_segment.from;
+        const Vector2 relative = p_position - p_segment.from;
+        const float length_squared = direction.length_squared();
+        float t = 0.0f;
+        if (length_squared > 0.0f) {
+            t = CLAMP(relative.dot(direction) / length_squared, 0.0f, 1.0f);
+        }
+        return (relative - direction * t).length_squared();
+    }
+
+    // Step sizes of the flooding passes, halving down to 1 with one more pass of 1 at the end to fix up what the
+    // big steps got wrong
+    static LocalVector<int> get_pass_steps(int p_dimensions) {
+        LocalVector<int> steps;
+        int step = 1;
+        while (step * 2 < p_dimensions) {
+            step *= 2;
+        }
+        for (; step >= 1; step /= 2) {
+            steps.push_back(step);
+        }
+        steps.push_back(1);
+        return steps;
+    }
+
+    // Walks every segment in half texel steps and hands the texels it passes over to it. Segments outside the grid
+    // seed the closest texels on its border, so roads right next to the chunk still show up
+    static void seed(const Grid &p_grid, const GridRoad::Segment *p_segments, int p_segment_count, int32_t *r_closest) {
+        const int texel_count = p_grid.dimensions * p_grid.dimensions;
+        for (int i = 0; i < texel_count; i++) {
+            r_closest[i] = NO_SEGMENT;
+        }
+        const float inv_spacing = 1.0f / p_grid.spacing;
+        for (int segment_index = 0; segment_index < p_segment_count; segment_index++) {
+            const GridRoad::Segment &segment = p_segments[segment_index];
+            const Vector2 from = (segment.from - p_grid.origin) * inv_spacing;
+            const Vector2 to = (segment.to - p_grid.origin) * inv_spacing;
+            const int steps = MAX(1, (int)Math::ceil(from.distance_to(to) * 2.0f));
+            for (int step = 0; step <= steps; step++) {
+                const Vector2 texel_position = from.lerp(to, step / (float)steps);
+                const int x = CLAMP((int)Math::round(texel_position.x), 0, p_grid.dimensions - 1);
+                const int y = CLAMP((int)Math::round(texel_position.y), 0, p_grid.dimensions - 1);
+                int32_t &closest = r_closest[y * p_grid.dimensions + x];
+                if (closest == segment_index) {
+                    continue;
+                }
+                const Vector2 position = p_grid.get_texel_position(x, y);
+                if (closest == NO_SEGMENT || get_segment_distance_squared(segment, position) < get_segment_distance_squared(p_segments[closest], position)) {
+                    closest = segment_index;
+                }
+            }
+        }
+    }
+
+    // One row of a flooding pass, every texel takes the closest segment of itself and the texels p_step away
+    static void flood_row(const Grid &p_grid, const GridRoad::Segment *p_segments, int p_step, int p_y, const int32_t *p_closest, int32_t *r_closest) {
+        const int dimensions = p_grid.dimensions;
+        for (int x = 0; x < dimensions; x++) {
+            const Vector2 position = p_grid.get_texel_position(x, p_y);
+            int32_t best = p_closest[p_y * dimensions + x];
+            float best_distance_squared = best == NO_SEGMENT ? INFINITY : get_segment_distance_squared(p_segments[best], position);
+            for (int offset_y = -1; offset_y <= 1; offset_y++) {
+                const int y = p_y + offset_y * p_step;
+                if (y < 0 || y >= dimensions) {
+                    continue;
+                }
+                for (int offset_x = -1; offset_x <= 1; offset_x++) {
+                    const int neighbor_x = x + offset_x * p_step;
+                    if (neighbor_x < 0 || neighbor_x >= dimensions || (offset_x == 0 && offset_y == 0)) {
+                        continue;
+                    }
+                    const int32_t candidate = p_closest[y * dimensions + neighbor_x];
+                    if (candidate == NO_SEGMENT || candidate == best) {
+                        continue;
+                    }
+                    const float distance_squared = get_segment_distance_squared(p_segments[candidate], position);
+                    if (distance_squared < best_distance_squared) {
+                        best = candidate;
+                        best_distance_squared = distance_squared;
+                    }
+                }
+            }
+            r_closest[p_y * dimensions + x] = best;
+        }
+    }
+
+    // Distance from the edge of the road for one row, negative on the road itself and clamped to p_max_distance
+    static void resolve_row(const Grid &p_grid, const GridRoad::Segment *p_segments, int p_y, const int32_t *p_closest, float p_road_half_width, float p_max_distance, float *r_distances) {
+        const int dimensions = p_grid.dimensions;
+        for (int x = 0; x < dimensions; x++) {
+            const int32_t closest = p_closest[p_y * dimensions + x];
+            if (closest == NO_SEGMENT) {
+                r_distances[x] = p_max_distance;
+                continue;
+            }
+            const float distance = Math::sqrt(get_segment_distance_squared(p_segments[closest], p_grid.get_texel_position(x, p_y)));
+            r_distances[x] = CLAMP(distance - p_road_half_width, -p_road_half_width, p_max_distance);
+        }
+    }
+};
+
+#endif // ROAD_SDF_RASTERIZER_H
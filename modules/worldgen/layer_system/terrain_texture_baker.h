@@ -0,0 +1,84 @@
+#ifndef TERRAIN_TEXTURE_BAKER_H
+#define TERRAIN_TEXTURE_BAKER_H
+
+#include "core/io/image.h"
+#include "core/math/math_funcs.h"
+#include "core/math/vector3.h"
+#include "worldgen/layer_system/build_scratch.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Bakes terrain textures straight into their final pixel buffer, so the Image only has to be created once at the end
+class TerrainTextureBaker {
+public:
+    // Height, the normal in Vector3::octahedron_encode() layout, and 1.0 in alpha
+    static constexpr Image::Format HEIGHT_NORMAL_FORMAT = Image::FORMAT_RGBAH;
+    static constexpr int HEIGHT_NORMAL_CHANNELS = 4;
+
+    // Same results as Math::make_half_float, 8 at a time when SSE2 is around
+    static void encode_half_floats(const float *p_values, int p_count, uint16_t *r_halfs) {
+        int i = 0;
+#ifdef __SSE2__
+        const __m128i sign_mask = _mm_set1_epi32(0x8000);
+        const __m128i exponent_mask = _mm_set1_epi32(0x7F800000);
+        const __m128i mantissa_mask = _mm_set1_epi32(0x7FFFFF);
+        const __m128i exponent_bias = _mm_set1_epi32(0x38000000);
+        const __m128i infinity = _mm_set1_epi32(0x7C00);
+        const __m128i nan_mantissa = _mm_set1_epi32(0x3FF);
+        const auto encode = [&](__m128i p_bits) -> __m128i {
+            const __m128i sign = _mm_and_si128(_mm_srli_epi32(p_bits, 16), sign_mask);
+            const __m128i exponent = _mm_and_si128(p_bits, exponent_mask);
+            const __m128i mantissa = _mm_and_si128(p_bits, mantissa_mask);
+
+            const __m128i normal = _mm_or_si128(_mm_srli_epi32(_mm_sub_epi32(exponent, exponent_bias), 13), _mm_srli_epi32(mantissa, 13));
+            // Too big turns into infinity, NaNs keep a full mantissa
+            const __m128i is_nan = _mm_andnot_si128(_mm_cmpeq_epi32(mantissa, _mm_setzero_si128()), _mm_cmpeq_epi32(exponent, exponent_mask));
+            const __m128i overflow = _mm_or_si128(infinity, _mm_and_si128(is_nan, nan_mantissa));
+            const __m128i is_overflow = _mm_cmpgt_epi32(exponent, _mm_set1_epi32(0x477FFFFF));
+            // Denormals and zero become a positive zero
+            const __m128i is_underflow = _mm_cmplt_epi32(exponent, _mm_set1_epi32(0x38000001));
+
+            __m128i half = _mm_or_si128(sign, _mm_or_si128(_mm_andnot_si128(is_overflow, normal), _mm_and_si128(is_overflow, overflow)));
+            half = _mm_andnot_si128(is_underflow, half);
+            // Sign extend from 16 bits so the saturating pack below leaves the values alone
+            return _mm_srai_epi32(_mm_slli_epi32(half, 16), 16);
+        };
+        for (; i + 8 <= p_count; i += 8) {
+            const __m128i low = encode(_mm_castps_si128(_mm_loadu_ps(p_values + i)));
+            const __m128i high = encode(_mm_castps_si128(_mm_loadu_ps(p_values + i + 4)));
+            _mm_storeu_si128((__m128i *)(r_halfs + i), _mm_packs_epi32(low, high));
+        }
+#endif
+        for (; i < p_count; i++) {
+            r_halfs[i] = Math::make_half_float(p_values[i]);
+        }
+    }
+
+    // Bakes row p_y of a height and normal texture p_width texels wide. p_heights has a one texel border all around
+    // (rows of p_width + 2), so the normals on the edges use central differences like everywhere else
+    static void bake_height_normal_row(const float *p_heights, int p_width, int p_y, float p_spacing, uint16_t *r_texels) {
+        const int stride = p_width + 2;
+        const float inv_two_spacing = 1.0f / (2.0f * p_spacing);
+        const float *center_row = p_heights + (p_y + 1) * stride + 1;
+
+        BuildScratch<float> texels;
+        texels->resize(p_width * HEIGHT_NORMAL_CHANNELS);
+        float *texels_ptr = texels->ptr();
+        for (int x = 0; x < p_width; x++) {
+            const float *center = center_row + x;
+            const float dx = (center[1] - center[-1]) * inv_two_spacing;
+            const float dy = (center[stride] - center[-stride]) * inv_two_spacing;
+            const Vector2 normal = Vector3(-dx, 1.0f, -dy).normalized().octahedron_encode();
+            float *texel = texels_ptr + x * HEIGHT_NORMAL_CHANNELS;
+            texel[0] = *center;
+            texel[1] = normal.x;
+            texel[2] = normal.y;
+            texel[3] = 1.0f;
+        }
+        encode_half_floats(texels_ptr, p_width * HEIGHT_NORMAL_CHANNELS, r_texels);
+    }
+};
+
+#endif // TERRAIN_TEXTURE_BAKER_H
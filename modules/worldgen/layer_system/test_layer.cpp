@@ -12,28 +12,7 @@ void TestManager::_notification(int p_what) {
 
             chunker_debugger->set_layer_manager(chunker);
 
-            const StringName biome_voronoi_points_layer_name = SNAME("Biome Points");
-            const StringName biome_voronoi_layer_name = SNAME("Biome Voronoi");
-            const StringName heightmap_layer_name = SNAME("Heightmap Layer");
-            const StringName quadtree_layer_name = SNAME("Terrain QuadTree");
-            const StringName road_layer_name = SNAME("Road SDF");
-            biome_point_layer.instantiate();
-            biome_layer.instantiate(biome_point_layer);
-            heightmap_layer.instantiate(biome_layer);
-            road_layer.instantiate(heightmap_layer);
-            quadtree_layer.instantiate(road_layer);
-
-            chunker->insert_layer(quadtree_layer_name, quadtree_layer);
-            chunker->insert_layer(heightmap_layer_name, heightmap_layer);
-            chunker->insert_layer(road_layer_name, road_layer);
-            chunker->insert_layer(biome_voronoi_layer_name, biome_layer);
-            chunker->insert_layer(biome_voronoi_points_layer_name, biome_point_layer);
-
-            chunker->add_layer_dependency(road_layer_name, heightmap_layer_name);
-            chunker->add_layer_dependency(quadtree_layer_name, road_layer_name);
-            chunker->add_layer_dependency(heightmap_layer_name, biome_voronoi_layer_name);
-            chunker->add_layer_dependency(biome_voronoi_layer_name, biome_voronoi_points_layer_name);
-            chunker->set_lod_max_distances(GLOBAL_GET("kgame/terrain/lod_max_distances"));
+            layer_stack.create(chunker);
 
             set_process(true);
         } break;
@@ -41,17 +20,72 @@ void TestManager::_notification(int p_what) {
             Camera3D *cam = get_viewport()->get_camera_3d();
             if (cam) {
                 const Vector3 cam_pos = cam->get_global_position();
-                update_camera_position(Vector2(cam_pos.x, cam_pos.z));
+                const Vector2 camera_position = Vector2(cam_pos.x, cam_pos.z);
+                Vector2 camera_velocity;
+                const double delta = get_process_delta_time();
+                if (has_last_camera_position && delta > 0.0) {
+                    camera_velocity = (camera_position - last_camera_position) / delta;
+                }
+                last_camera_position = camera_position;
+                has_last_camera_position = true;
+                update_camera_position(camera_position, camera_velocity);
             }
         } break;
     }
 }
 
-void TestManager::update_camera_position(Vector2 p_camera_position) {
+void TestManager::update_camera_position(Vector2 p_camera_position, Vector2 p_camera_velocity) {
+    layer_stack.update(chunker, p_camera_position, p_camera_velocity);
+}
+
+void TerrainLayerStack::create(ChunkerLayerManager *p_chunker) {
+    const StringName biome_voronoi_points_layer_name = SNAME("Biome Points");
+    const StringName biome_voronoi_layer_name = SNAME("Biome Voronoi");
+    const StringName heightmap_layer_name = SNAME("Heightmap Layer");
+    const StringName quadtree_layer_name = SNAME("Terrain QuadTree");
+    const StringName road_layer_name = SNAME("Road SDF");
+    const StringName settlement_layer_name = SNAME("Settlements");
+    const StringName road_network_layer_name = SNAME("Road Network");
+    biome_point_layer.instantiate();
+    biome_layer.instantiate(biome_point_layer);
+    heightmap_layer.instantiate(biome_layer);
+    settlement_layer.instantiate();
+    road_network_layer.instantiate(settlement_layer);
+    road_layer.instantiate(heightmap_layer, road_network_layer);
+    quadtree_layer.instantiate(road_layer, biome_layer);
+
+    p_chunker->insert_layer(quadtree_layer_name, quadtree_layer);
+    p_chunker->insert_layer(heightmap_layer_name, heightmap_layer);
+    p_chunker->insert_layer(road_layer_name, road_layer);
+    p_chunker->insert_layer(biome_voronoi_layer_name, biome_layer);
+    p_chunker->insert_layer(biome_voronoi_points_layer_name, biome_point_layer);
+    p_chunker->insert_layer(settlement_layer_name, settlement_layer);
+    p_chunker->insert_layer(road_network_layer_name, road_network_layer);
+
+    p_chunker->add_layer_dependency(road_layer_name, heightmap_layer_name);
+    p_chunker->add_layer_dependency(road_layer_name, road_network_layer_name);
+    p_chunker->add_layer_dependency(quadtree_layer_name, road_layer_name);
+    p_chunker->add_layer_dependency(quadtree_layer_name, biome_voronoi_layer_name);
+    p_chunker->add_layer_dependency(heightmap_layer_name, biome_voronoi_layer_name);
+    p_chunker->add_layer_dependency(biome_voronoi_layer_name, biome_voronoi_points_layer_name);
+    p_chunker->add_layer_dependency(road_network_layer_name, settlement_layer_name);
+    p_chunker->set_lod_max_distances(GLOBAL_GET("kgame/terrain/lod_max_distances"));
+
+    layer_names.clear();
+    layer_names.push_back(biome_voronoi_points_layer_name);
+    layer_names.push_back(biome_voronoi_layer_name);
+    layer_names.push_back(heightmap_layer_name);
+    layer_names.push_back(road_layer_name);
+    layer_names.push_back(quadtree_layer_name);
+    layer_names.push_back(settlement_layer_name);
+    layer_names.push_back(road_network_layer_name);
+}
+
+void TerrainLayerStack::update(ChunkerLayerManager *p_chunker, Vector2 p_camera_position, Vector2 p_camera_velocity) {
     const float render_distance = GLOBAL_GET("kgame/render_distance");
     const float half_render_distance = render_distance * 0.5f;
     Rect2 request_rect = Rect2(p_camera_position - Vector2(half_render_distance, half_render_distance), Vector2(render_distance, render_distance));
-    chunker->update(request_rect, p_camera_position);
+    p_chunker->update(request_rect, p_camera_position, p_camera_velocity);
     quadtree_layer->set_camera_position(p_camera_position);
     quadtree_layer->update_terrain_chunks();
 }
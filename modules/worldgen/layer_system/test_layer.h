@@ -11,23 +11,37 @@
 #include "layer_manager.h"
 #include "quadtree_layer.h"
 #include "road_layer.h"
+#include "road_network_layers.h"
 #include "heightmap_layer.h"
 #include "worldgen/layer_system/biome_layers.h"
 
-class TestManager : public Node3D {
-    GDCLASS(TestManager, Node3D);
-
-    ChunkerLayerManager *chunker = nullptr;
-    ChunkerDebugger *chunker_debugger = nullptr;
+// The terrain layers and their dependencies, shared by the test scene and the benchmark
+struct TerrainLayerStack {
     Ref<BiomeVoronoiPointsLayer> biome_point_layer;
     Ref<BiomeVoronoiTriangulationLayer> biome_layer;
     Ref<QuadTreeTerrainLayer> quadtree_layer;
     Ref<HeightmapLayer> heightmap_layer;
     Ref<RoadLayer> road_layer;
+    Ref<SettlementLayer> settlement_layer;
+    Ref<RoadNetworkLayer> road_network_layer;
+    LocalVector<StringName> layer_names;
+
+    void create(ChunkerLayerManager *p_chunker);
+    void update(ChunkerLayerManager *p_chunker, Vector2 p_camera_position, Vector2 p_camera_velocity);
+};
+
+class TestManager : public Node3D {
+    GDCLASS(TestManager, Node3D);
+
+    ChunkerLayerManager *chunker = nullptr;
+    ChunkerDebugger *chunker_debugger = nullptr;
+    TerrainLayerStack layer_stack;
+    Vector2 last_camera_position;
+    bool has_last_camera_position = false;
 
     void _notification(int p_what);
 
-    void update_camera_position(Vector2 p_camera_position);
+    void update_camera_position(Vector2 p_camera_position, Vector2 p_camera_velocity);
     ~TestManager() {
         print_line("UNLOAD TEST MANAGER!");
     }
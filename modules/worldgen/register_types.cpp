@@ -12,6 +12,7 @@
 #include "poisson_disk_sampling.h"
 #include "worldgen/heightmap_processor.h"
 #include "worldgen/layer_system/biome_layers.h"
+#include "worldgen/layer_system/chunker_benchmark.h"
 #include "worldgen/layer_system/test_layer.h"
 #include "worldgen/quadtree.h"
 #include "worldgen/road_astar.h"
@@ -48,6 +49,7 @@ void initialize_worldgen_module(ModuleInitializationLevel p_level) {
     GDREGISTER_CLASS(VehicleDebugger);
     GDREGISTER_CLASS(VehicleClutch);
     GDREGISTER_CLASS(TestManager);
+    GDREGISTER_CLASS(ChunkerBenchmark);
     GDREGISTER_CLASS(WorldgenHeightSettings);
     GDREGISTER_CLASS(BiomeGeneratorSettings);
     GDREGISTER_CLASS(BiomeSettings);
@@ -63,12 +65,22 @@ void initialize_worldgen_module(ModuleInitializationLevel p_level) {
     GLOBAL_DEF("kgame/chunk_heightmap_size", 128);
     GLOBAL_DEF("kgame/render_distance", 2048.0f);
 
+    // 0 means use all available cores
+    GLOBAL_DEF(PropertyInfo(Variant::INT, "kgame/chunker/thread_count", PROPERTY_HINT_RANGE, "0,256,1"), 0);
+    GLOBAL_DEF(PropertyInfo(Variant::INT, "kgame/chunker/completion_budget_usec", PROPERTY_HINT_RANGE, "0,100000,1,suffix:us"), 2000);
+    GLOBAL_DEF(PropertyInfo(Variant::FLOAT, "kgame/chunker/prefetch_time", PROPERTY_HINT_RANGE, "0,30,0.1,suffix:s"), 3.0f);
+    GLOBAL_DEF(PropertyInfo(Variant::INT, "kgame/chunker/memory_budget_mb", PROPERTY_HINT_RANGE, "0,65536,1,suffix:MiB"), 1024);
+    GLOBAL_DEF("kgame/chunker/disk_cache_enabled", false);
+    GLOBAL_DEF(PropertyInfo(Variant::STRING, "kgame/chunker/disk_cache_path", PROPERTY_HINT_DIR), "user://chunk_cache");
+
 	GLOBAL_DEF(PropertyInfo(Variant::STRING, "kgame/terrain/terrain_base_material", PROPERTY_HINT_FILE, "*.tres,*.res"), "");
 	GLOBAL_DEF(PropertyInfo(Variant::STRING, "kgame/terrain/terrain_shader", PROPERTY_HINT_FILE, "*.tres,*.res,*.gdshaderinc"), "");
 	GLOBAL_DEF(PropertyInfo(Variant::STRING, "kgame/terrain/height_settings", PROPERTY_HINT_FILE, "*.tres,*.res"), "");
 	GLOBAL_DEF(PropertyInfo(Variant::STRING, "kgame/terrain/biome_settings", PROPERTY_HINT_FILE, "*.tres,*.res"), "");
     
     GLOBAL_DEF("kgame/terrain/normal_height_texture_size", 128);
+    GLOBAL_DEF("kgame/terrain/biome_weight_map_resolution", 256);
+    GLOBAL_DEF(PropertyInfo(Variant::INT, "kgame/terrain/biome_weight_map_texture_count", PROPERTY_HINT_RANGE, "1,1024,1"), 64);
     GLOBAL_DEF(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "kgame/terrain/lod_max_distances"), PackedFloat32Array());
     GLOBAL_DEF(PropertyInfo(Variant::PACKED_INT32_ARRAY, "kgame/terrain/normal_height_texture_count_per_lod"), PackedInt32Array());
     GLOBAL_DEF("kgame/terrain/normal_epsilon", 1.0f);
@@ -83,6 +95,11 @@ void initialize_worldgen_module(ModuleInitializationLevel p_level) {
     GLOBAL_DEF("kgame/wind/windmap_resolution", 512);
     GLOBAL_DEF("kgame/roads/road_width", 10.0f);
     GLOBAL_DEF("kgame/roads/road_skirt", 5.0f);
+    GLOBAL_DEF(PropertyInfo(Variant::FLOAT, "kgame/roads/road_sdf_range", PROPERTY_HINT_RANGE, "1,1024,0.1,suffix:m"), 32.0f);
+    GLOBAL_DEF(PropertyInfo(Variant::FLOAT, "kgame/roads/settlement_region_size", PROPERTY_HINT_RANGE, "256,65536,1,suffix:m"), 8192.0f);
+    GLOBAL_DEF(PropertyInfo(Variant::INT, "kgame/roads/settlements_per_region", PROPERTY_HINT_RANGE, "0,64,1"), 4);
+    GLOBAL_DEF(PropertyInfo(Variant::FLOAT, "kgame/roads/road_network_chunk_size", PROPERTY_HINT_RANGE, "256,65536,1,suffix:m"), 4096.0f);
+    GLOBAL_DEF(PropertyInfo(Variant::INT, "kgame/roads/road_network_chunk_points", PROPERTY_HINT_RANGE, "16,100000,1"), 1500);
 
 
     
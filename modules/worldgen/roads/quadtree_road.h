@@ -9,11 +9,10 @@
 #include "core/object/ref_counted.h"
 #include "core/variant/variant.h"
 #include "servers/rendering/renderer_scene_cull.h"
-#include <queue>
-#include <vector>
 
-// Strategy (for now) is to keep a completely subdivided quad tree in memory, it might be too
-// memory intensive, so perhaps we could change it later
+// Strategy (for now) is to keep a completely subdivided grid in memory, it might be too
+// memory intensive, so perhaps we could change it later.
+// Segments are stored once as flat coordinate arrays, cells only list the indices of the segments crossing them
 class GridRoad : public RefCounted {
     GDCLASS(GridRoad, RefCounted);
 
@@ -27,6 +26,79 @@ private:
     QuadTreeRoadSettings settings;
 
     Vector2i chunk_dimensions;
+
+    LocalVector<float> segment_from_x;
+    LocalVector<float> segment_from_y;
+    LocalVector<float> segment_to_x;
+    LocalVector<float> segment_to_y;
+
+    _FORCE_INLINE_ float get_segment_distance_squared(uint32_t p_segment, const Vector2 &p_position) const {
+        const float from_x = segment_from_x[p_segment];
+        const float from_y = segment_from_y[p_segment];
+        const float dir_x = segment_to_x[p_segment] - from_x;
+        const float dir_y = segment_to_y[p_segment] - from_y;
+        const float rel_x = p_position.x - from_x;
+        const float rel_y = p_position.y - from_y;
+        const float length_squared = dir_x * dir_x + dir_y * dir_y;
+        float t = 0.0f;
+        if (length_squared > 0.0f) {
+            t = CLAMP((rel_x * dir_x + rel_y * dir_y) / length_squared, 0.0f, 1.0f);
+        }
+        const float diff_x = rel_x - dir_x * t;
+        const float diff_y = rel_y - dir_y * t;
+        return diff_x * diff_x + diff_y * diff_y;
+    }
+
+    _FORCE_INLINE_ void check_cell(int p_x, int p_y, const Vector2 &p_position, int &r_segment, float &r_distance_squared) const {
+        for (const uint32_t &segment : data[p_x + p_y * chunk_dimensions.x].segments) {
+            const float distance_squared = get_segment_distance_squared(segment, p_position);
+            if (distance_squared < r_distance_squared) {
+                r_distance_squared = distance_squared;
+                r_segment = segment;
+            }
+        }
+    }
+
+    // Searches rings of cells around the position, starting from the one it is in, until no cell of the next ring can be
+    // closer than what we have. r_segment and r_distance_squared come in as the best candidate so far
+    void find_closest_segment_from(const Vector2 &p_position, int &r_segment, float &r_distance_squared) const {
+        const Vector2 local = (p_position - settings.bounds.position) / grid_element_size;
+        const Vector2i center = local.floor();
+        // Rings past this one don't touch the grid anymore
+        const int max_ring = MAX(MAX(center.x, chunk_dimensions.x - 1 - center.x), MAX(center.y, chunk_dimensions.y - 1 - center.y));
+        // Distance from the position to the sides of its own cell, everything in ring r is at least (r - 1) cells further
+        const Vector2 in_cell = local - Vector2(center);
+        const float to_cell_side = MIN(MIN(in_cell.x, 1.0f - in_cell.x), MIN(in_cell.y, 1.0f - in_cell.y)) * grid_element_size;
+
+        for (int ring = 0; ring <= max_ring; ring++) {
+            if (ring > 0) {
+                const float ring_distance = MAX(0.0f, (ring - 1) * grid_element_size + to_cell_side);
+                if (ring_distance * ring_distance >= r_distance_squared) {
+                    break;
+                }
+            }
+            const int start_y = MAX(center.y - ring, 0);
+            const int end_y = MIN(center.y + ring, chunk_dimensions.y - 1);
+            for (int y = start_y; y <= end_y; y++) {
+                if (y == center.y - ring || y == center.y + ring) {
+                    // Top and bottom rows of the ring
+                    const int start_x = MAX(center.x - ring, 0);
+                    const int end_x = MIN(center.x + ring, chunk_dimensions.x - 1);
+                    for (int x = start_x; x <= end_x; x++) {
+                        check_cell(x, y, p_position, r_segment, r_distance_squared);
+                    }
+                    continue;
+                }
+                if (center.x - ring >= 0 && center.x - ring < chunk_dimensions.x) {
+                    check_cell(center.x - ring, y, p_position, r_segment, r_distance_squared);
+                }
+                if (ring > 0 && center.x + ring >= 0 && center.x + ring < chunk_dimensions.x) {
+                    check_cell(center.x + ring, y, p_position, r_segment, r_distance_squared);
+                }
+            }
+        }
+    }
+
 public:
     static Ref<GridRoad> create(QuadTreeRoadSettings p_settings) {
         Ref<GridRoad> road;
@@ -39,7 +111,7 @@ public:
 
         for (size_t i = 0; i < road->data.size(); i++) {
             Vector2i chunk_xy = Vector2i(i % p_settings.grid_element_count, i / p_settings.grid_element_count);
-            Rect2 chunk_rect = Rect2(Vector2(chunk_xy) * road->grid_element_size, Vector2(road->grid_element_size, road->grid_element_size));
+            Rect2 chunk_rect = Rect2(p_settings.bounds.position + Vector2(chunk_xy) * road->grid_element_size, Vector2(road->grid_element_size, road->grid_element_size));
             road->data[i].bounds = chunk_rect;
         }
 
@@ -53,69 +125,91 @@ public:
 
     struct Chunk {
         Rect2 bounds;
-        LocalVector<Segment> segments;
+        // Indices of the segments crossing this cell
+        LocalVector<uint32_t> segments;
     };
 
     LocalVector<Chunk> data;
 
-    Vector<int> get_chunks_in_rect(Rect2 p_bbox) const {
-        int start_chunk_x = Math::floor(p_bbox.position.x / grid_element_size);
-        start_chunk_x = MAX(0, start_chunk_x);
-        int start_chunk_y = Math::floor(p_bbox.position.y / grid_element_size);
-        start_chunk_y = MAX(0, start_chunk_y);
-        int end_chunk_x = Math::ceil((p_bbox.position.x + p_bbox.size.x) / grid_element_size);
-        end_chunk_x = MIN(chunk_dimensions.x, end_chunk_x+1);
-        int end_chunk_y = Math::ceil((p_bbox.position.y + p_bbox.size.y) / grid_element_size);
-        end_chunk_y = MIN(chunk_dimensions.y, end_chunk_y+1);
-        Vector<int> out;
-        for (int x = start_chunk_x; x < end_chunk_x; x++) {
-            for (int y = start_chunk_y; y < end_chunk_y; y++) {
-                int chunk_idx = x + y * chunk_dimensions.y;
-                out.push_back(chunk_idx);
-            }
+    uint32_t get_segment_count() const {
+        return segment_from_x.size();
+    }
+
+    Segment get_segment(uint32_t p_segment) const {
+        return {
+            .from = Vector2(segment_from_x[p_segment], segment_from_y[p_segment]),
+            .to = Vector2(segment_to_x[p_segment], segment_to_y[p_segment])
+        };
+    }
+
+    uint64_t get_memory_usage() const {
+        uint64_t memory_usage = get_segment_count() * 4 * sizeof(float);
+        for (const Chunk &chunk : data) {
+            memory_usage += sizeof(Chunk) + chunk.segments.size() * sizeof(uint32_t);
         }
-        return out;
+        return memory_usage;
     }
 
     void insert_segment(const Vector2 &p_start, const Vector2 &p_end) {
-        Rect2 segment_bounding_box = Rect2(p_start, Vector2());
-        segment_bounding_box.expand_to(p_end);
-        Vector<int> chunks = get_chunks_in_rect(segment_bounding_box);
-        for (const int &chunk_idx : chunks) {
-            if (data[chunk_idx].bounds.intersects_segment(p_start, p_end)) {
-                data[chunk_idx].segments.push_back({
-                    .from = p_start,
-                    .to = p_end
-                });
+        const uint32_t segment = segment_from_x.size();
+        segment_from_x.push_back(p_start.x);
+        segment_from_y.push_back(p_start.y);
+        segment_to_x.push_back(p_end.x);
+        segment_to_y.push_back(p_end.y);
+
+        const Vector2 start_cell = ((p_start.min(p_end) - settings.bounds.position) / grid_element_size).floor();
+        const Vector2 end_cell = ((p_start.max(p_end) - settings.bounds.position) / grid_element_size).floor();
+        const int start_x = MAX((int)start_cell.x, 0);
+        const int start_y = MAX((int)start_cell.y, 0);
+        const int end_x = MIN((int)end_cell.x, chunk_dimensions.x - 1);
+        const int end_y = MIN((int)end_cell.y, chunk_dimensions.y - 1);
+        for (int y = start_y; y <= end_y; y++) {
+            for (int x = start_x; x <= end_x; x++) {
+                Chunk &chunk = data[x + y * chunk_dimensions.x];
+                if (chunk.bounds.intersects_segment(p_start, p_end)) {
+                    chunk.segments.push_back(segment);
+                }
             }
         }
     }
 
+    // Closest segment within p_max_distance, or -1. Doesn't allocate
+    int find_closest_segment(const Vector2 &p_position, float p_max_distance, float &r_distance_squared) const {
+        int segment = -1;
+        r_distance_squared = p_max_distance * p_max_distance;
+        find_closest_segment_from(p_position, segment, r_distance_squared);
+        return segment;
+    }
+
     bool sample_closest_segment(const Vector2 p_position, const float p_max_distance, Segment &r_segment) const {
-        Vector<const Segment*> found_segments;
-        std::priority_queue<std::pair<float, int> , std::vector<std::pair<float, int>>, std::greater<std::pair<float, int>>> distance_queue;
-        Rect2 sample_bbox = Rect2(p_position - Vector2(p_max_distance, p_max_distance), Vector2(p_max_distance, p_max_distance) * 2.0f);
-        Vector<int> chunks = get_chunks_in_rect(sample_bbox);
-        for (const int &chunk_idx : chunks) {
-            for  (const Segment &segment : data[chunk_idx].segments) {
-                Vector2 segment_ptr[2] = {
-                    segment.from,
-                    segment.to,
-                };
-                Vector2 closest_point = Geometry2D::get_closest_point_to_segment(p_position, segment_ptr);
-                distance_queue.emplace(std::make_pair(p_position.distance_squared_to(closest_point), found_segments.size()));
-                found_segments.push_back(&segment);
-            }
+        float distance_squared;
+        const int segment = find_closest_segment(p_position, p_max_distance, distance_squared);
+        if (segment == -1) {
+            return false;
         }
+        r_segment = get_segment(segment);
+        return true;
+    }
 
-        if (!distance_queue.empty()) {
-            if (distance_queue.top().first < (p_max_distance * p_max_distance)) {
-                r_segment = *found_segments[distance_queue.top().second];
-                return true;
+    // Distance to the closest segment for every position, p_max_distance where there is none closer.
+    // Meant for rasterising, neighbouring positions start from the segment the previous one found
+    void get_distances(const Vector2 *p_positions, int p_count, float p_max_distance, float *r_distances) const {
+        const float max_distance_squared = p_max_distance * p_max_distance;
+        int previous_segment = -1;
+        for (int i = 0; i < p_count; i++) {
+            int segment = -1;
+            float distance_squared = max_distance_squared;
+            if (previous_segment != -1) {
+                const float previous_distance_squared = get_segment_distance_squared(previous_segment, p_positions[i]);
+                if (previous_distance_squared < distance_squared) {
+                    segment = previous_segment;
+                    distance_squared = previous_distance_squared;
+                }
             }
+            find_closest_segment_from(p_positions[i], segment, distance_squared);
+            previous_segment = segment;
+            r_distances[i] = segment == -1 ? p_max_distance : Math::sqrt(distance_squared);
         }
-
-        return false;
     }
 };
 
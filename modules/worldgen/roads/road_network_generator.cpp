@@ -1,11 +1,18 @@
 #include "road_network_generator.h"
 #include "alpha_model.h"
 #include "core/math/geometry_2d.h"
+#include "core/object/worker_thread_pool.h"
 #include "worldgen/roads/quadtree_road.h"
 #include "scene/resources/curve.h"
 
-float RoadNetworkGenerator::sample_height(Vector2 p_position) const {
-    return height->get_height(map_alpha_to_world(p_position));
+void RoadNetworkGenerator::sample_heights(const std::vector<RoadGraph::Point> &p_points, std::vector<float> &r_heights) const {
+    LocalVector<Vector2> positions;
+    positions.resize(p_points.size());
+    for (uint32_t i = 0; i < positions.size(); i++) {
+        positions[i] = map_alpha_to_world(Vector2(p_points[i].x, p_points[i].y));
+    }
+    r_heights.resize(p_points.size());
+    height->get_heights(positions.ptr(), positions.size(), r_heights.data());
 }
 
 RoadNetworkGenerator::RoadNetworkGenerator(RoadNetworkSettings p_settings, Ref<WorldgenHeight> p_height_provider) {
@@ -86,26 +93,35 @@ float RoadNetworkGenerator::get_distance_to_road(Vector2 p_position) const {
 
 bool RoadNetworkGenerator::get_distance_to_road_clamped(const Vector2 &p_position, const float &p_max_distance_squared, float &r_distance) const {
     Vector2 point;
-    bool found = get_closest_road_point(p_position, Math::sqrt(p_max_distance_squared), r_distance, point);
+    bool found = get_closest_road_point(p_position, p_max_distance_squared, r_distance, point);
     return found;
 }
 
 bool RoadNetworkGenerator::get_closest_road_point(const Vector2 &p_position, const float &p_max_distance_squared, float &r_distance, Vector2 &r_point) const {
-    // Remap position to alpha model coords
-    GridRoad::Segment closest;
-    bool found = grid_road->sample_closest_segment(p_position, Math::sqrt(p_max_distance_squared), closest);
+    float distance_squared;
+    const int segment_index = grid_road->find_closest_segment(p_position, Math::sqrt(p_max_distance_squared), distance_squared);
+    if (segment_index == -1) {
+        return false;
+    }
+    const GridRoad::Segment segment = grid_road->get_segment(segment_index);
     Vector2 points[2] = {
-        closest.from,
-        closest.to,
+        segment.from,
+        segment.to,
     };
-    Vector2 closest_point = Geometry2D::get_closest_point_to_segment(p_position, points);
-    r_distance = closest_point.distance_to(p_position);
-    r_point = closest_point;
-    return found;
+    r_point = Geometry2D::get_closest_point_to_segment(p_position, points);
+    r_distance = Math::sqrt(distance_squared);
+    return true;
+}
+
+void AlphaModelRoadGeneratorWithHeight::get_heights(const std::vector<RoadGraph::Point> &p_points, std::vector<float> &r_heights) const {
+    network_generator->sample_heights(p_points, r_heights);
 }
 
-float AlphaModelRoadGeneratorWithHeight::get_height(float p_x, float p_y) const {
-    return network_generator->sample_height(Vector2(p_x, p_y));
+void AlphaModelRoadGeneratorWithHeight::run_parallel(int p_count, const std::function<void(int)> &p_function) const {
+    const WorkerThreadPool::GroupID group = WorkerThreadPool::get_singleton()->add_native_group_task([](void *p_userdata, uint32_t p_index) {
+        (*static_cast<const std::function<void(int)> *>(p_userdata))(p_index);
+    }, (void *)&p_function, p_count, -1, true, "Route road trips");
+    WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group);
 }
 
 AlphaModelRoadGeneratorWithHeight::AlphaModelRoadGeneratorWithHeight(Ref<RoadNetworkGenerator> p_network_generator) {
@@ -11,7 +11,8 @@ class RoadNetworkGenerator;
 
 class AlphaModelRoadGeneratorWithHeight : public AlphaModelRoadGenerator {
     Ref<RoadNetworkGenerator> network_generator;
-    virtual float get_height(float p_x, float p_y) const override;
+    virtual void get_heights(const std::vector<RoadGraph::Point> &p_points, std::vector<float> &r_heights) const override;
+    virtual void run_parallel(int p_count, const std::function<void(int)> &p_function) const override;
 public:
     AlphaModelRoadGeneratorWithHeight() {};
     AlphaModelRoadGeneratorWithHeight(Ref<RoadNetworkGenerator> p_network_generator);
@@ -29,7 +30,7 @@ private:
     AlphaModelRoadGeneratorWithHeight alpha_model;
     Ref<GridRoad> grid_road;
     Ref<WorldgenHeight> height;
-    float sample_height(Vector2 p_position) const;
+    void sample_heights(const std::vector<RoadGraph::Point> &p_points, std::vector<float> &r_heights) const;
 public:
     RoadNetworkGenerator(RoadNetworkSettings p_settings, Ref<WorldgenHeight> p_height_provider);
 
@@ -0,0 +1,191 @@
+// Checks that trip batching keeps the generated roads reproducible:
+// - trip_batch_size 1 gives the same roads as the original sequential model
+// - the result doesn't depend on how many threads route a batch, or in which order they finish
+// Build with `scons bin/determinism_check` from example/ and run it, exits with 1 on a mismatch
+#include "alpha_model.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum class RunMode {
+    DEFAULT,
+    SERIAL,
+    REVERSED,
+    // One thread per batch entry, so they all race
+    THREAD_PER_TRIP,
+};
+
+class CheckRoadGenerator : public AlphaModelRoadGenerator {
+    bool hilly = false;
+    RunMode run_mode = RunMode::DEFAULT;
+
+protected:
+    virtual float get_height(float p_x, float p_y) const override {
+        if (!hilly) {
+            return 0.0f;
+        }
+        return std::sin(p_x * 10.0f) * std::cos(p_y * 7.0f);
+    }
+
+    virtual void run_parallel(int p_count, const std::function<void(int)> &p_function) const override {
+        switch (run_mode) {
+            case RunMode::DEFAULT: {
+                AlphaModelRoadGenerator::run_parallel(p_count, p_function);
+            } break;
+            case RunMode::SERIAL: {
+                for (int i = 0; i < p_count; i++) {
+                    p_function(i);
+                }
+            } break;
+            case RunMode::REVERSED: {
+                for (int i = p_count - 1; i >= 0; i--) {
+                    p_function(i);
+                }
+            } break;
+            case RunMode::THREAD_PER_TRIP: {
+                std::vector<std::thread> threads;
+                threads.reserve(p_count);
+                for (int i = 0; i < p_count; i++) {
+                    threads.emplace_back(p_function, i);
+                }
+                for (std::thread &thread : threads) {
+                    thread.join();
+                }
+            } break;
+        }
+    }
+
+public:
+    CheckRoadGenerator(bool p_hilly, RunMode p_run_mode) :
+            hilly(p_hilly), run_mode(p_run_mode) {}
+};
+
+struct Scene {
+    const char *name;
+    std::vector<RoadGraph::Vertex> cities;
+    bool hilly;
+    float heightmap_weight;
+    // Digest of the roads the sequential model produced before trips were batched
+    uint64_t reference_digest;
+};
+
+void hash_bytes(uint64_t &r_hash, const void *p_data, std::size_t p_size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(p_data);
+    for (std::size_t i = 0; i < p_size; i++) {
+        r_hash = (r_hash ^ bytes[i]) * 1099511628211ull;
+    }
+}
+
+// FNV-1a over the distinct road segments by their end points, sorted so the order of the output doesn't matter
+uint64_t get_roads_digest(const AlphaModelRoadGenerator::RoadGenerationOutput &p_output) {
+    std::vector<std::array<double, 4>> segments;
+    segments.reserve(p_output.edges.size());
+    for (const RoadGraph::Edge &edge : p_output.edges) {
+        RoadGraph::Point a = p_output.vertices[edge.v1].point;
+        RoadGraph::Point b = p_output.vertices[edge.v2].point;
+        if (b.x < a.x || (b.x == a.x && b.y < a.y)) {
+            std::swap(a, b);
+        }
+        segments.push_back({ a.x, a.y, b.x, b.y });
+    }
+    std::sort(segments.begin(), segments.end());
+    // The original model stored both half edges of a road, so it can list the same segment twice
+    segments.erase(std::unique(segments.begin(), segments.end()), segments.end());
+
+    uint64_t hash = 14695981039346656037ull;
+    for (const std::array<double, 4> &segment : segments) {
+        hash_bytes(hash, segment.data(), sizeof(double) * segment.size());
+    }
+    return hash;
+}
+
+uint64_t generate(const Scene &p_scene, int p_trip_batch_size, RunMode p_run_mode) {
+    CheckRoadGenerator generator(p_scene.hilly, p_run_mode);
+    generator.initialize({}, p_scene.cities);
+    AlphaModelRoadGenerator::RoadGenerationOutput output;
+    AlphaModelRoadGenerator::RoadGenerationSettings settings;
+    // Straightening averages over the neighbors of a vertex and the original model listed every road twice,
+    // so it only matches up to rounding. Compare the routed roads themselves
+    settings.road_straightening_factor = 0.0f;
+    settings.heightmap_weight = p_scene.heightmap_weight;
+    settings.trip_batch_size = p_trip_batch_size;
+    generator.generate_roads(settings, output);
+    return get_roads_digest(output);
+}
+
+std::vector<RoadGraph::Vertex> make_random_cities(int p_count, unsigned int p_seed) {
+    std::mt19937 random(p_seed);
+    std::uniform_real_distribution<double> distribution(0.1, 0.9);
+    std::vector<RoadGraph::Vertex> cities;
+    for (int i = 0; i < p_count; i++) {
+        RoadGraph::Vertex city;
+        city.point.x = distribution(random);
+        city.point.y = distribution(random);
+        city.mass = distribution(random);
+        city.is_city = true;
+        cities.push_back(city);
+    }
+    return cities;
+}
+
+std::vector<RoadGraph::Vertex> make_example_cities() {
+    const double cities_data[][3] = {
+        { 0.5, 0.5, 0.26 },
+        { 0.86, 0.85, 0.50 },
+        { 0.16, 0.9, 0.45 },
+        { 0.1, 0.25, 0.7 },
+        { 0.6, 0.7, 0.4 },
+        { 0.23, 0.2, 0.1 },
+        { 0.15, 0.13, 0.5 },
+        { 0.88, 0.3, 0.25 },
+        { 0.1, 0.5, 0.35 },
+        { 0.9, 0.43, 5.0 },
+    };
+    std::vector<RoadGraph::Vertex> cities;
+    for (const double *city_data : cities_data) {
+        RoadGraph::Vertex city;
+        city.point.x = city_data[0];
+        city.point.y = city_data[1];
+        city.mass = city_data[2];
+        city.is_city = true;
+        cities.push_back(city);
+    }
+    return cities;
+}
+
+} // namespace
+
+int main() {
+    const std::vector<Scene> scenes = {
+        { "example cities, flat", make_example_cities(), false, 100.0f, 0x7d11c0d734a43a67ull },
+        { "example cities, hilly", make_example_cities(), true, 100.0f, 0x3d1fdf9dd7a6a73bull },
+        { "30 random cities, hilly", make_random_cities(30, 3), true, 0.1f, 0xe8d7742f71de61f5ull },
+    };
+
+    bool success = true;
+    const auto check = [&](const char *p_scene, const char *p_what, uint64_t p_expected, uint64_t p_got) {
+        const bool match = p_expected == p_got;
+        std::printf("%s %s: %s: expected %016llx, got %016llx\n", match ? "PASS" : "FAIL", p_scene, p_what,
+                (unsigned long long)p_expected, (unsigned long long)p_got);
+        success = success && match;
+    };
+
+    for (const Scene &scene : scenes) {
+        check(scene.name, "batch size 1 matches the sequential model", scene.reference_digest, generate(scene, 1, RunMode::DEFAULT));
+
+        const int batch_size = 16;
+        const uint64_t serial_digest = generate(scene, batch_size, RunMode::SERIAL);
+        check(scene.name, "batches on the default threads match a single thread", serial_digest, generate(scene, batch_size, RunMode::DEFAULT));
+        check(scene.name, "batches run in reverse match a single thread", serial_digest, generate(scene, batch_size, RunMode::REVERSED));
+        check(scene.name, "batches with a thread per trip match a single thread", serial_digest, generate(scene, batch_size, RunMode::THREAD_PER_TRIP));
+    }
+
+    return success ? 0 : 1;
+}
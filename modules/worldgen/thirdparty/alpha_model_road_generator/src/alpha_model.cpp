@@ -1,7 +1,8 @@
 #include "alpha_model.h"
 #include <algorithm>
+#include <atomic>
 #include <limits>
-#include <queue>
+#include <thread>
 #include <unordered_map>
 #include "delaunator.hpp"
 
@@ -32,28 +33,63 @@ int RoadGraph::get_vertex_count() const {
     return vertices.size();
 }
 
-// Dijkstra-based pathfinding function
-std::vector<int> RoadGraph::pathfind(int p_a_node, int p_b_node, const std::vector<std::vector<float>>& p_weight, float p_alpha, float p_height_weight) {
-    // Priority queue to store (cost, vertex index), sorted by lowest cost
-    using PQElement = std::pair<double, int>;
-    std::priority_queue<PQElement, std::vector<PQElement>, std::greater<PQElement>> frontier;
+float RoadGraph::get_edge_cost(int p_edge_index, float p_height_weight) const {
+    const Edge &edge = edges[p_edge_index];
+    float height_v1 = vertices[edge.v1].height;
+    float height_v2 = vertices[edge.v2].height;
+    float m = (edge.length*edge.length) + p_height_weight * (height_v1 - height_v2);
+    float cost = std::pow(m*m, 0.5f);
+    if (edge.is_two_way) {
+        float m_reverse = (edge.length*edge.length) + p_height_weight * (height_v2 - height_v1);
+        cost = std::min(cost, std::pow(m_reverse*m_reverse, 0.5f));
+    }
+    return cost;
+}
+
+bool RoadGraph::pathfind(int p_a_node, int p_b_node, const std::vector<double> &p_edge_flow, float p_alpha, float p_height_weight, PathfindScratch &r_scratch, std::vector<int> &r_edge_path) const {
+    r_edge_path.clear();
 
-    // Cost to reach each node
-    std::vector<double> cost_so_far(vertices.size(), std::numeric_limits<double>::infinity());
-    cost_so_far[p_a_node] = 0;
+    if (r_scratch.search_ids.size() != vertices.size()) {
+        r_scratch.cost_so_far.resize(vertices.size());
+        r_scratch.came_from_edge.resize(vertices.size());
+        r_scratch.search_ids.assign(vertices.size(), 0);
+        r_scratch.search_id = 0;
+    }
+    r_scratch.search_id++;
+    if (r_scratch.search_id == 0) {
+        // Wrapped around, old ids could look current again
+        std::fill(r_scratch.search_ids.begin(), r_scratch.search_ids.end(), 0);
+        r_scratch.search_id = 1;
+    }
+    const uint32_t search_id = r_scratch.search_id;
+    const auto cost_so_far = [&](int p_vertex) {
+        return r_scratch.search_ids[p_vertex] == search_id ? r_scratch.cost_so_far[p_vertex] : std::numeric_limits<double>::infinity();
+    };
 
-    // To reconstruct the path
-    std::vector<int> came_from(vertices.size(), -1);
+    std::vector<PathfindScratch::FrontierElement> &frontier = r_scratch.frontier;
+    const std::greater<PathfindScratch::FrontierElement> compare;
+    frontier.clear();
 
-    // Start with the initial node
-    frontier.emplace(0.0, p_a_node);
+    r_scratch.search_ids[p_a_node] = search_id;
+    r_scratch.cost_so_far[p_a_node] = 0.0;
+    r_scratch.came_from_edge[p_a_node] = -1;
+    frontier.push_back({ 0.0, p_a_node });
 
+    bool found = false;
     while (!frontier.empty()) {
-        int current = frontier.top().second;
-        frontier.pop();
+        std::pop_heap(frontier.begin(), frontier.end(), compare);
+        const PathfindScratch::FrontierElement element = frontier.back();
+        frontier.pop_back();
+        const int current = element.vertex;
+
+        // A cheaper way here was found after this got queued
+        if (element.cost > cost_so_far(current)) {
+            continue;
+        }
 
         // If we reached the goal
         if (current == p_b_node) {
+            found = true;
             break;
         }
 
@@ -61,44 +97,39 @@ std::vector<int> RoadGraph::pathfind(int p_a_node, int p_b_node, const std::vect
         for (int edge_index : adjacent_edges[current]) {
             const Edge& edge = edges[edge_index];
             int next_node = (edge.v1 == current) ? edge.v2 : edge.v1;
-            float height_v1 = vertices[edge.v1].height;
-            float height_v2 = vertices[edge.v2].height;
-            float m = (edge.length*edge.length) + p_height_weight * (height_v1 - height_v2);
-            
-            float d = std::pow(m*m, 0.5f);
 
             float coeff = 1.0f;
-
-            if (p_weight[current][next_node] > 0.0f) {
+            if (p_edge_flow[edge_index] > 0.0) {
                 coeff = p_alpha;
             }
 
-            float weight = d * coeff;
+            float weight = get_edge_cost(edge_index, p_height_weight) * coeff;
 
-            double new_cost = cost_so_far[current] + weight;
+            double new_cost = element.cost + weight;
 
             // If a cheaper path to the next node is found
-            if (new_cost < cost_so_far[next_node]) {
-                cost_so_far[next_node] = new_cost;
-                frontier.emplace(new_cost, next_node);
-                came_from[next_node] = current;
+            if (new_cost < cost_so_far(next_node)) {
+                r_scratch.search_ids[next_node] = search_id;
+                r_scratch.cost_so_far[next_node] = new_cost;
+                r_scratch.came_from_edge[next_node] = edge_index;
+                frontier.push_back({ new_cost, next_node });
+                std::push_heap(frontier.begin(), frontier.end(), compare);
             }
         }
     }
 
-    // Reconstruct the path from the `came_from` map
-    std::vector<int> path;
-    if (came_from[p_b_node] == -1) {
-        return path;  // No path found
+    if (!found || p_a_node == p_b_node) {
+        return found;
     }
 
-    for (int current = p_b_node; current != p_a_node; current = came_from[current]) {
-        path.push_back(current);
+    for (int current = p_b_node; current != p_a_node;) {
+        const int edge_index = r_scratch.came_from_edge[current];
+        r_edge_path.push_back(edge_index);
+        current = edges[edge_index].v1 == current ? edges[edge_index].v2 : edges[edge_index].v1;
     }
-    path.push_back(p_a_node);
-    std::reverse(path.begin(), path.end());
+    std::reverse(r_edge_path.begin(), r_edge_path.end());
 
-    return path;
+    return true;
 }
 
 const std::vector<RoadGraph::Vertex> &RoadGraph::get_vertices() const {
@@ -168,56 +199,97 @@ void AlphaModelRoadGenerator::initialize(AlphaModelRoadGeneratorSettings p_setti
             continue;
         }
 
-        RoadGraph::Vertex v2 = v;
-        v2.height = get_height(v.point.x, v.point.y);
-        cities.push_back(v2);
-        road_graph.insert_vertex(v2);
+        cities.push_back(v);
     }
 
     // Generate dummy points
     {
-        std::vector<double> coords;
-        coords.reserve((p_settings.dummy_point_count * 2) + (cities.size() * 2));
+        std::vector<HaltonPoint> dummy_points = generate_halton_points(settings.dummy_point_count, 2, 3);
+        dummy_points = map_to_bounding_box(dummy_points, settings.bounds_start_x, settings.bounds_start_y, settings.bounds_end_x, settings.bounds_end_y);
 
+        // Cities first, then the dummy points, in the order they become vertices
+        std::vector<RoadGraph::Point> points;
+        points.reserve(cities.size() + dummy_points.size());
         for (const RoadGraph::Vertex &city : cities) {
-            coords.push_back(city.point.x);
-            coords.push_back(city.point.y);
+            points.push_back(city.point);
         }
-
-        std::vector<HaltonPoint> dummy_points = generate_halton_points(settings.dummy_point_count, 2, 3);
-        dummy_points = map_to_bounding_box(dummy_points, settings.bounds_start_x, settings.bounds_start_y, settings.bounds_end_x, settings.bounds_end_y);
         for (const HaltonPoint &p_point : dummy_points) {
-            coords.emplace_back(p_point.x);
-            coords.emplace_back(p_point.y);
-            road_graph.insert_vertex({
-                .point = RoadGraph::Point {
-                    .x = p_point.x,
-                    .y = p_point.y
-                },
-                .height = get_height(p_point.x, p_point.y)
+            points.push_back({
+                .x = p_point.x,
+                .y = p_point.y
             });
         }
+        std::vector<float> heights;
+        get_heights(points, heights);
+
+        std::vector<double> coords;
+        coords.reserve(points.size() * 2);
+        for (std::size_t i = 0; i < points.size(); i++) {
+            coords.push_back(points[i].x);
+            coords.push_back(points[i].y);
+            if (i < cities.size()) {
+                cities[i].height = heights[i];
+                road_graph.insert_vertex(cities[i]);
+            } else {
+                road_graph.insert_vertex({
+                    .point = points[i],
+                    .height = heights[i]
+                });
+            }
+        }
 
         delaunator::Delaunator delaunator(coords);
-        road_graph.reserve_edges(delaunator.triangles.size() * 3);
-        for (int i = 0; i < delaunator.triangles.size(); i+=3) {
+        road_graph.reserve_edges(delaunator.triangles.size() / 2 + 1);
+        // Every inner edge shows up as two half edges, one per triangle. Only keep one of them so each edge
+        // has a single slot for its flow, and let it cost whichever direction is cheaper like the pair did
+        for (std::size_t i = 0; i < delaunator.triangles.size(); i++) {
+            const std::size_t opposite = delaunator.halfedges[i];
+            if (opposite != delaunator::INVALID_INDEX && opposite < i) {
+                continue;
+            }
+            const std::size_t next = (i % 3 == 2) ? i - 2 : i + 1;
             road_graph.insert_edge({
                 .v1 = static_cast<int>(delaunator.triangles[i]),
-                .v2 = static_cast<int>(delaunator.triangles[i+1])
-            });
-            road_graph.insert_edge({
-                .v1 = static_cast<int>(delaunator.triangles[i+1]),
-                .v2 = static_cast<int>(delaunator.triangles[i+2])
-            });
-            road_graph.insert_edge({
-                .v1 = static_cast<int>(delaunator.triangles[i+2]),
-                .v2 = static_cast<int>(delaunator.triangles[i])
+                .v2 = static_cast<int>(delaunator.triangles[next]),
+                .is_two_way = opposite != delaunator::INVALID_INDEX
             });
         }
     }
 
 }
 
+void AlphaModelRoadGenerator::get_heights(const std::vector<RoadGraph::Point> &p_points, std::vector<float> &r_heights) const {
+    r_heights.resize(p_points.size());
+    for (std::size_t i = 0; i < p_points.size(); i++) {
+        r_heights[i] = get_height(p_points[i].x, p_points[i].y);
+    }
+}
+
+void AlphaModelRoadGenerator::run_parallel(int p_count, const std::function<void(int)> &p_function) const {
+    const int thread_count = std::min<int>(p_count, std::max(1u, std::thread::hardware_concurrency()));
+    if (thread_count <= 1) {
+        for (int i = 0; i < p_count; i++) {
+            p_function(i);
+        }
+        return;
+    }
+    std::atomic<int> next_index = 0;
+    const auto work = [&]() {
+        for (int i = next_index++; i < p_count; i = next_index++) {
+            p_function(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (int i = 0; i < thread_count - 1; i++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
 void AlphaModelRoadGenerator::generate_roads(RoadGenerationSettings p_settings, RoadGenerationOutput &p_output) {
     
     struct NumberOfTrips {
@@ -247,15 +319,24 @@ void AlphaModelRoadGenerator::generate_roads(RoadGenerationSettings p_settings,
     });
     
     const int vertex_count = road_graph.get_vertex_count();
-    std::vector<std::vector<float>> is_road(vertex_count, std::vector<float>(vertex_count, 0.0f));
-
-    for (int i = 0; i < number_of_trips.size(); i++) {
-        std::vector<int> path = road_graph.pathfind(number_of_trips[i].city_a, number_of_trips[i].city_b, is_road, p_settings.alpha, p_settings.heightmap_weight);
-        for (int j = 0; j < path.size()-1; j++) {
-            int curr = path[j];
-            int next = path[j+1];
-            is_road[curr][next] += number_of_trips[i].number_of_trips;
-            is_road[next][curr] += number_of_trips[i].number_of_trips;
+    // Trips routed over each edge, lines up with the graph's edges
+    std::vector<double> edge_flow(road_graph.get_edges().size(), 0.0);
+
+    const int batch_size = std::max(p_settings.trip_batch_size, 1);
+    std::vector<std::vector<int>> batch_paths(batch_size);
+    for (int batch_start = 0; batch_start < number_of_trips.size(); batch_start += batch_size) {
+        const int batch_count = std::min<int>(batch_size, number_of_trips.size() - batch_start);
+        // Everything in the batch sees the same flow, it's only written once they're all done
+        run_parallel(batch_count, [&](int p_index) {
+            static thread_local RoadGraph::PathfindScratch scratch;
+            const NumberOfTrips &trip = number_of_trips[batch_start + p_index];
+            road_graph.pathfind(trip.city_a, trip.city_b, edge_flow, p_settings.alpha, p_settings.heightmap_weight, scratch, batch_paths[p_index]);
+        });
+        // Merged in trip order so the result is the same no matter which thread finished first
+        for (int i = 0; i < batch_count; i++) {
+            for (int edge_index : batch_paths[i]) {
+                edge_flow[edge_index] += number_of_trips[batch_start + i].number_of_trips;
+            }
         }
     }
 
@@ -267,8 +348,7 @@ void AlphaModelRoadGenerator::generate_roads(RoadGenerationSettings p_settings,
 
     for (int i = 0; i < vertex_count; i++) {
         for (int adjacent : adjacency_list[i]) {
-            const RoadGraph::Edge &edge = edge_list[adjacent];
-            if (is_road[edge.v1][edge.v2] == 0.0f) {
+            if (edge_flow[adjacent] == 0.0) {
                 continue;
             }
 
@@ -283,7 +363,7 @@ void AlphaModelRoadGenerator::generate_roads(RoadGenerationSettings p_settings,
 
     for (int i = 0; i < edge_list.size(); i++) {
         const RoadGraph::Edge &edge = edge_list[i];
-        if (is_road[edge.v1][edge.v2] == 0.0f) {
+        if (edge_flow[i] == 0.0) {
             continue;
         }
         int new_v1 = vertex_remap[edge.v1];
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <vector>
 
@@ -45,6 +46,8 @@ public:
     struct Edge {
         int v1, v2; // Indices of vertices
         double length;
+        // Inner edges used to be stored once per direction, either one could be taken
+        bool is_two_way = false;
     };
 
     std::vector<Vertex> vertices;
@@ -57,7 +60,33 @@ public:
     void insert_edge(Edge p_edge);
     int get_vertex_count() const;
 
-    std::vector<int> pathfind(int p_a_node, int p_b_node, const std::vector<std::vector<float>>& p_weight, float p_alpha, float p_height_weight = 100.0f);
+    // Search state that gets reused between pathfinds, keep one per thread
+    struct PathfindScratch {
+        struct FrontierElement {
+            double cost;
+            int vertex;
+            bool operator>(const FrontierElement &p_other) const {
+                return cost != p_other.cost ? cost > p_other.cost : vertex > p_other.vertex;
+            }
+        };
+        std::vector<double> cost_so_far;
+        std::vector<int> came_from_edge;
+        // Entries are only valid where they match the current search, saves clearing everything every time
+        std::vector<uint32_t> search_ids;
+        uint32_t search_id = 0;
+        std::vector<FrontierElement> frontier;
+    };
+
+    // Cost of traveling over an edge that isn't a road yet
+    float get_edge_cost(int p_edge_index, float p_height_weight) const;
+
+    // Dijkstra from p_a_node to p_b_node, r_edge_path receives the edges of the path in order. p_edge_flow holds the traffic
+    // routed over each edge so far, indexed like edges, edges that already carry some are discounted by p_alpha.
+    // Stops as soon as p_b_node is settled. There is no A* heuristic: the cost of an edge is |length^4 + w * dh|
+    // and dh can have either sign, so any edge can cost about nothing and the straight line distance to the goal
+    // gives no lower bound that would prune anything.
+    // Only reads the graph, so it can run on several threads at once
+    bool pathfind(int p_a_node, int p_b_node, const std::vector<double> &p_edge_flow, float p_alpha, float p_height_weight, PathfindScratch &r_scratch, std::vector<int> &r_edge_path) const;
 
     const std::vector<Vertex> &get_vertices() const;
     const std::vector<Edge> &get_edges() const;
@@ -82,6 +111,10 @@ protected:
     virtual float get_height(float p_x, float p_y) const {
         return 0.0f;
     }
+    // Heights of all graph vertices at once, override this instead of get_height when sampling in bulk is cheaper
+    virtual void get_heights(const std::vector<RoadGraph::Point> &p_points, std::vector<float> &r_heights) const;
+    // Calls p_function for every index in [0, p_count) and returns once all of them are done, in any order and on any thread
+    virtual void run_parallel(int p_count, const std::function<void(int)> &p_function) const;
 public:
     AlphaModelRoadGenerator() {};
     void initialize(AlphaModelRoadGeneratorSettings p_settings, const std::vector<RoadGraph::Vertex> &p_cities);
@@ -96,6 +129,10 @@ public:
         float road_straightening_factor = 0.9f;
         float alpha = 0.7f;
         float heightmap_weight = 100.0f;
+        // Trips are routed in batches on several threads, each batch only sees the roads of the ones before it.
+        // 1 routes every trip on top of the previous one like the original model. The result doesn't depend
+        // on the thread count either way, example/determinism_check.cpp checks both
+        int trip_batch_size = 16;
     };
     float heightmap_weight = 100.0f;
     void generate_roads(const RoadGenerationSettings p_settings, RoadGenerationOutput &p_output);
@@ -127,6 +127,16 @@ Vector<PackedInt32Array> VoronoiGraph::get_site_triangles(int p_site) const {
     return out;
 }
 
+uint64_t VoronoiGraph::get_memory_usage() const {
+    uint64_t memory_usage = site_positions.size() * sizeof(Vector2);
+    for (const LocalVector<SiteTriangle> &triangles : site_triangles) {
+        memory_usage += triangles.size() * sizeof(SiteTriangle) + sizeof(LocalVector<SiteTriangle>);
+    }
+    // Voronoi cells average six edges
+    memory_usage += diagram.numsites * (sizeof(jcv_site) + 6 * (sizeof(jcv_graphedge) + sizeof(jcv_edge)));
+    return memory_usage;
+}
+
 Vector2 VoronoiGraph::get_site_position(int p_site) const {
     ERR_FAIL_INDEX_V(p_site, diagram.numsites, Vector2());
     return site_positions[p_site];
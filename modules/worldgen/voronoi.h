@@ -31,6 +31,8 @@ public:
     TypedArray<PackedInt32Array> get_site_triangles_bind(int p_site) const;
     Vector<PackedInt32Array> get_site_triangles(int p_site) const;
     Vector2 get_site_position(int p_site) const;
+    // Estimate, jcv allocates its own memory
+    uint64_t get_memory_usage() const;
     void delaunay_iter_begin();
     Dictionary delaunay_iter_next();
 
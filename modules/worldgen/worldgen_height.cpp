@@ -3,27 +3,123 @@
 #include "core/object/object.h"
 #include "scene/resources/curve.h"
 
-float WorldgenHeight::get_height(const Vector2 &p_position) const {
-    float f = settings->get_frequency();
-    float t = settings->get_noise()->get_noise_2dv(p_position * f) * 0.5f + 0.5f; 
+template <int BLOCK_SIZE>
+void WorldgenHeight::get_heights_block(const Vector2 *p_positions, int p_count, float *r_heights) const {
+    const FastNoiseLite *noise = settings->get_noise_ptr();
+    const float warp_amplitude = settings->get_domain_warp_amplitude();
+    const float warp_frequency = settings->get_domain_warp_frequency();
+    const bool ridged = settings->is_ridged();
+
+    Vector2 positions[BLOCK_SIZE];
+    Vector2 sample_positions[BLOCK_SIZE];
+    real_t noise_values[BLOCK_SIZE];
+
+    for (int i = 0; i < p_count; i++) {
+        positions[i] = p_positions[i];
+    }
+    if (warp_amplitude != 0.0f) {
+        for (int axis = 0; axis < 2; axis++) {
+            const float warp_offset = axis == 0 ? WARP_OFFSET_X : WARP_OFFSET_Y;
+            for (int i = 0; i < p_count; i++) {
+                sample_positions[i] = p_positions[i] * warp_frequency + Vector2(warp_offset, warp_offset);
+            }
+            noise->get_noise_2d_points(sample_positions, p_count, noise_values);
+            for (int i = 0; i < p_count; i++) {
+                positions[i][axis] += warp_amplitude * noise_values[i];
+            }
+        }
+    }
 
-    const Ref<Curve> height_curve = settings->get_height_curve();
+    for (int i = 0; i < p_count; i++) {
+        r_heights[i] = 0.0f;
+    }
+    float amplitude = 1.0f;
+    float amplitude_sum = 0.0f;
+    float octave_frequency = settings->get_frequency();
+    for (int octave = 0; octave < MAX(1, settings->get_octaves()); octave++) {
+        const Vector2 octave_offset = Vector2(octave * OCTAVE_OFFSET, octave * OCTAVE_OFFSET);
+        for (int i = 0; i < p_count; i++) {
+            sample_positions[i] = positions[i] * octave_frequency + octave_offset;
+        }
+        noise->get_noise_2d_points(sample_positions, p_count, noise_values);
+        for (int i = 0; i < p_count; i++) {
+            const float value = ridged ? 1.0f - 2.0f * Math::abs((float)noise_values[i]) : noise_values[i];
+            r_heights[i] += amplitude * value;
+        }
+        amplitude_sum += amplitude;
+        amplitude *= settings->get_gain();
+        octave_frequency *= settings->get_lacunarity();
+    }
+
+    const float scale = settings->get_base_amplitude() / amplitude_sum;
     const float height_multiplier = settings->get_height_multiplier();
+    for (int i = 0; i < p_count; i++) {
+        const float t = r_heights[i] * scale * 0.5f + 0.5f;
+        r_heights[i] = settings->sample_height_curve(t) * t * height_multiplier;
+    }
+}
 
+void WorldgenHeight::get_heights(const Vector2 *p_positions, int p_count, float *r_heights) const {
+    for (int offset = 0; offset < p_count; offset += HEIGHT_BATCH_SIZE) {
+        get_heights_block<HEIGHT_BATCH_SIZE>(p_positions + offset, MIN(HEIGHT_BATCH_SIZE, p_count - offset), r_heights + offset);
+    }
+}
 
-    return height_curve->sample(t) * t * height_multiplier;
+float WorldgenHeight::get_height(const Vector2 &p_position) const {
+    float height;
+    get_heights_block<1>(&p_position, 1, &height);
+    return height;
 }
 
-void WorldgenHeight::get_height_with_derivative(const Vector2 &p_position, float &r_height, Vector2 &r_derivative, float p_dir_eps) const {
-    float sample_height = get_height(p_position);
-    float h2 = get_height(p_position + Vector2(p_dir_eps, 0.0f));
-    float h3 = get_height(p_position + Vector2(0.0f, p_dir_eps));
+void WorldgenHeight::get_height_with_derivative(const Vector2 &p_position, float &r_height, Vector2 &r_derivative) const {
+    const FastNoiseLite *noise = settings->get_noise_ptr();
+    const float warp_amplitude = settings->get_domain_warp_amplitude();
+    const float warp_frequency = settings->get_domain_warp_frequency();
 
-    r_height = sample_height;
+    // Rows of the jacobian of the warped position, used to bring the gradient back to unwarped space
+    Vector2 position = p_position;
+    Vector2 warp_jacobian_x = Vector2(1.0f, 0.0f);
+    Vector2 warp_jacobian_y = Vector2(0.0f, 1.0f);
+    if (warp_amplitude != 0.0f) {
+        Vector2 warp_gradient;
+        position.x += warp_amplitude * noise->get_noise_2dv_with_gradient(p_position * warp_frequency + Vector2(WARP_OFFSET_X, WARP_OFFSET_X), warp_gradient);
+        warp_jacobian_x += warp_gradient * (warp_amplitude * warp_frequency);
+        position.y += warp_amplitude * noise->get_noise_2dv_with_gradient(p_position * warp_frequency + Vector2(WARP_OFFSET_Y, WARP_OFFSET_Y), warp_gradient);
+        warp_jacobian_y += warp_gradient * (warp_amplitude * warp_frequency);
+    }
+
+    float sum = 0.0f;
+    Vector2 sum_gradient;
+    float amplitude = 1.0f;
+    float amplitude_sum = 0.0f;
+    float octave_frequency = settings->get_frequency();
+    for (int octave = 0; octave < MAX(1, settings->get_octaves()); octave++) {
+        const Vector2 octave_offset = Vector2(octave * OCTAVE_OFFSET, octave * OCTAVE_OFFSET);
+        Vector2 gradient;
+        float value = noise->get_noise_2dv_with_gradient(position * octave_frequency + octave_offset, gradient);
+        gradient *= octave_frequency;
+        if (settings->is_ridged()) {
+            gradient *= value < 0.0f ? 2.0f : -2.0f;
+            value = 1.0f - 2.0f * Math::abs(value);
+        }
+        sum += amplitude * value;
+        sum_gradient += gradient * amplitude;
+        amplitude_sum += amplitude;
+        amplitude *= settings->get_gain();
+        octave_frequency *= settings->get_lacunarity();
+    }
 
-    float slope_x = h2 - sample_height;
-    float slope_z = h3 - sample_height;
-    r_derivative = Vector2(slope_x, slope_z) / p_dir_eps;
+    const float scale = settings->get_base_amplitude() / amplitude_sum;
+    const float t = sum * scale * 0.5f + 0.5f;
+    const Vector2 warped_t_gradient = sum_gradient * (scale * 0.5f);
+    const Vector2 t_gradient = warp_jacobian_x * warped_t_gradient.x + warp_jacobian_y * warped_t_gradient.y;
+
+    // height = curve(t) * t * multiplier
+    const float height_multiplier = settings->get_height_multiplier();
+    float curve_slope;
+    const float curve_value = settings->sample_height_curve(t, &curve_slope);
+    r_height = curve_value * t * height_multiplier;
+    r_derivative = t_gradient * ((curve_slope * t + curve_value) * height_multiplier);
 }
 
 void WorldgenHeight::get_height_with_normal(const Vector2 &p_position, Vector3 &r_normal, float &r_height) const {
@@ -49,12 +145,13 @@ int WorldgenHeight::get_seed() const {
 void WorldgenHeight::set_seed(int p_seed) {
     fnl->set_seed(p_seed);
 }
-_FORCE_INLINE_ float WorldgenHeightSettings::sample_height_curve(float p_t) const {
-    if (!height_curve.is_valid()) {
-        return p_t;
+void WorldgenHeightSettings::_bake_height_curve() {
+    for (int i = 0; i <= HEIGHT_CURVE_LUT_SIZE; i++) {
+        const float t = i / (float)HEIGHT_CURVE_LUT_SIZE;
+        height_curve_lut[i] = height_curve.is_valid() ? height_curve->sample(t) : t;
     }
-    return height_curve->sample(p_t);
 }
+
 void WorldgenHeightSettings::_bind_methods() {
     ClassDB::bind_method(D_METHOD("get_frequency"), &WorldgenHeightSettings::get_frequency);
     ClassDB::bind_method(D_METHOD("set_frequency", "frequency"), &WorldgenHeightSettings::set_frequency);
@@ -66,7 +163,27 @@ void WorldgenHeightSettings::_bind_methods() {
 
     ClassDB::bind_method(D_METHOD("get_octaves"), &WorldgenHeightSettings::get_octaves);
     ClassDB::bind_method(D_METHOD("set_octaves", "octaves"), &WorldgenHeightSettings::set_octaves);
-    ADD_PROPERTY(PropertyInfo(Variant::INT, "octaves"), "set_octaves", "get_octaves");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "octaves", PROPERTY_HINT_RANGE, "1,16,1"), "set_octaves", "get_octaves");
+
+    ClassDB::bind_method(D_METHOD("get_lacunarity"), &WorldgenHeightSettings::get_lacunarity);
+    ClassDB::bind_method(D_METHOD("set_lacunarity", "lacunarity"), &WorldgenHeightSettings::set_lacunarity);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lacunarity"), "set_lacunarity", "get_lacunarity");
+
+    ClassDB::bind_method(D_METHOD("get_gain"), &WorldgenHeightSettings::get_gain);
+    ClassDB::bind_method(D_METHOD("set_gain", "gain"), &WorldgenHeightSettings::set_gain);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "gain"), "set_gain", "get_gain");
+
+    ClassDB::bind_method(D_METHOD("is_ridged"), &WorldgenHeightSettings::is_ridged);
+    ClassDB::bind_method(D_METHOD("set_ridged", "ridged"), &WorldgenHeightSettings::set_ridged);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "ridged"), "set_ridged", "is_ridged");
+
+    ClassDB::bind_method(D_METHOD("get_domain_warp_amplitude"), &WorldgenHeightSettings::get_domain_warp_amplitude);
+    ClassDB::bind_method(D_METHOD("set_domain_warp_amplitude", "domain_warp_amplitude"), &WorldgenHeightSettings::set_domain_warp_amplitude);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "domain_warp_amplitude"), "set_domain_warp_amplitude", "get_domain_warp_amplitude");
+
+    ClassDB::bind_method(D_METHOD("get_domain_warp_frequency"), &WorldgenHeightSettings::get_domain_warp_frequency);
+    ClassDB::bind_method(D_METHOD("set_domain_warp_frequency", "domain_warp_frequency"), &WorldgenHeightSettings::set_domain_warp_frequency);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "domain_warp_frequency"), "set_domain_warp_frequency", "get_domain_warp_frequency");
 
     ClassDB::bind_method(D_METHOD("get_height_curve"), &WorldgenHeightSettings::get_height_curve);
     ClassDB::bind_method(D_METHOD("set_height_curve", "height_curve"), &WorldgenHeightSettings::set_height_curve);
@@ -87,6 +204,7 @@ float WorldgenHeightSettings::get_frequency() const {
 
 void WorldgenHeightSettings::set_frequency(float p_frequency) {
     frequency = p_frequency;
+    emit_changed();
 }
 
 float WorldgenHeightSettings::get_base_amplitude() const {
@@ -95,6 +213,37 @@ float WorldgenHeightSettings::get_base_amplitude() const {
 
 void WorldgenHeightSettings::set_base_amplitude(float p_base_amplitude) {
     base_amplitude = p_base_amplitude;
+    emit_changed();
+}
+
+void WorldgenHeightSettings::set_octaves(int p_octaves) {
+    octaves = MAX(1, p_octaves);
+    emit_changed();
+}
+
+void WorldgenHeightSettings::set_lacunarity(float p_lacunarity) {
+    lacunarity = p_lacunarity;
+    emit_changed();
+}
+
+void WorldgenHeightSettings::set_gain(float p_gain) {
+    gain = p_gain;
+    emit_changed();
+}
+
+void WorldgenHeightSettings::set_ridged(bool p_ridged) {
+    ridged = p_ridged;
+    emit_changed();
+}
+
+void WorldgenHeightSettings::set_domain_warp_amplitude(float p_domain_warp_amplitude) {
+    domain_warp_amplitude = p_domain_warp_amplitude;
+    emit_changed();
+}
+
+void WorldgenHeightSettings::set_domain_warp_frequency(float p_domain_warp_frequency) {
+    domain_warp_frequency = p_domain_warp_frequency;
+    emit_changed();
 }
 
 Ref<Curve> WorldgenHeightSettings::get_height_curve() const {
@@ -102,11 +251,30 @@ Ref<Curve> WorldgenHeightSettings::get_height_curve() const {
 }
 
 void WorldgenHeightSettings::set_height_curve(Ref<Curve> p_height_curve) {
+    const Callable bake_callable = callable_mp(this, &WorldgenHeightSettings::_bake_height_curve);
+    if (height_curve.is_valid()) {
+        height_curve->disconnect_changed(bake_callable);
+    }
     height_curve = p_height_curve;
+    if (height_curve.is_valid()) {
+        height_curve->connect_changed(bake_callable);
+    }
+    _bake_height_curve();
+    emit_changed();
 }
 
-void WorldgenHeightSettings::set_height_multiplier(float p_height_multiplier) { height_multiplier = p_height_multiplier; }
+void WorldgenHeightSettings::set_height_multiplier(float p_height_multiplier) {
+    height_multiplier = p_height_multiplier;
+    emit_changed();
+}
 
 Ref<FastNoiseLite> WorldgenHeightSettings::get_noise() const { return noise; }
 
-void WorldgenHeightSettings::set_noise(Ref<FastNoiseLite> p_noise) { noise = p_noise; }
+void WorldgenHeightSettings::set_noise(Ref<FastNoiseLite> p_noise) {
+    noise = p_noise;
+    emit_changed();
+}
+
+WorldgenHeightSettings::WorldgenHeightSettings() {
+    _bake_height_curve();
+}
@@ -7,18 +7,47 @@
 class Curve;
 class WorldgenHeightSettings : public Resource {
     GDCLASS(WorldgenHeightSettings, Resource);
+public:
+    // Segments in the baked height curve
+    static constexpr int HEIGHT_CURVE_LUT_SIZE = 256;
+private:
     Ref<Curve> height_curve;
     Ref<FastNoiseLite> noise;
     float frequency = 0.15f;
     float base_amplitude = 1.0f;
-    int octaves = 8;
+    int octaves = 1;
+    float lacunarity = 2.0f;
+    float gain = 0.5f;
+    bool ridged = false;
+    float domain_warp_amplitude = 0.0f;
+    float domain_warp_frequency = 0.05f;
     float height_multiplier = 1.0f;
 
-    _FORCE_INLINE_ float sample_height_curve(float p_t) const;
+    // The height curve sampled at regular steps over [0, 1], rebaked whenever the curve changes
+    float height_curve_lut[HEIGHT_CURVE_LUT_SIZE + 1];
+
+    void _bake_height_curve();
 
 protected:
     static void _bind_methods();
 public:
+    // Piecewise linear lookup into the baked curve, r_slope is the slope of the segment t falls in
+    _FORCE_INLINE_ float sample_height_curve(float p_t, float *r_slope = nullptr) const {
+        if (p_t <= 0.0f || p_t >= 1.0f) {
+            // Curve::sample clamps too, so the curve is flat outside of [0, 1]
+            if (r_slope) {
+                *r_slope = 0.0f;
+            }
+            return height_curve_lut[p_t <= 0.0f ? 0 : HEIGHT_CURVE_LUT_SIZE];
+        }
+        const float x = p_t * HEIGHT_CURVE_LUT_SIZE;
+        const int idx = MIN((int)x, HEIGHT_CURVE_LUT_SIZE - 1);
+        const float segment = height_curve_lut[idx + 1] - height_curve_lut[idx];
+        if (r_slope) {
+            *r_slope = segment * HEIGHT_CURVE_LUT_SIZE;
+        }
+        return height_curve_lut[idx] + segment * (x - idx);
+    }
 
     float get_frequency() const;
     void set_frequency(float p_frequency);
@@ -30,22 +59,54 @@ public:
     void set_height_curve(Ref<Curve> p_height_curve);
 
     int get_octaves() const { return octaves; }
-    void set_octaves(int p_octaves) { octaves = p_octaves; }
+    void set_octaves(int p_octaves);
+
+    float get_lacunarity() const { return lacunarity; }
+    void set_lacunarity(float p_lacunarity);
+
+    float get_gain() const { return gain; }
+    void set_gain(float p_gain);
+
+    bool is_ridged() const { return ridged; }
+    void set_ridged(bool p_ridged);
+
+    float get_domain_warp_amplitude() const { return domain_warp_amplitude; }
+    void set_domain_warp_amplitude(float p_domain_warp_amplitude);
+
+    float get_domain_warp_frequency() const { return domain_warp_frequency; }
+    void set_domain_warp_frequency(float p_domain_warp_frequency);
 
     float get_height_multiplier() const { return height_multiplier; }
     void set_height_multiplier(float p_height_multiplier);
 
     Ref<FastNoiseLite> get_noise() const;
     void set_noise(Ref<FastNoiseLite> p_noise);
+    // For the sampling hot paths, skips the reference counting of get_noise()
+    _FORCE_INLINE_ const FastNoiseLite *get_noise_ptr() const { return noise.ptr(); }
+
+    WorldgenHeightSettings();
 };
 
 class WorldgenHeight : public RefCounted {
     Ref<FastNoiseLite> fnl;
     Ref<WorldgenHeightSettings> settings;
     int seed;
+    // Octaves are shifted apart so they don't all have a feature at the origin
+    static constexpr float OCTAVE_OFFSET = 131.7f;
+    // Where the two warp components sample the noise
+    static constexpr float WARP_OFFSET_X = 1337.0f;
+    static constexpr float WARP_OFFSET_Y = -2791.0f;
+    // Positions are processed in blocks of this size to keep the buffers small
+    static constexpr int HEIGHT_BATCH_SIZE = 256;
+
+    // p_count can be at most BLOCK_SIZE, single samples use a block of 1 so they don't set up the full buffers
+    template <int BLOCK_SIZE>
+    void get_heights_block(const Vector2 *p_positions, int p_count, float *r_heights) const;
 public:
     float get_height(const Vector2 &p_position) const;
-    void get_height_with_derivative(const Vector2 &p_position, float &r_height, Vector2 &r_derivative, float p_dir_eps = 0.01f) const;
+    // Same as get_height, but every octave is evaluated for all positions in one batched noise call
+    void get_heights(const Vector2 *p_positions, int p_count, float *r_heights) const;
+    void get_height_with_derivative(const Vector2 &p_position, float &r_height, Vector2 &r_derivative) const;
     void get_height_with_normal(const Vector2 &p_position, Vector3 &r_normal, float &r_height) const;
 
     int get_seed() const;